@@ -0,0 +1,112 @@
+#include <stdatomic.h>
+#include "be32vect.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BE32VECT_X86
+#endif
+
+typedef void (*swapFunc)(void *dst, const void *src, size_t len);
+
+// Byte-swap each 32-bit word one at a time.
+static void swapScalar(void *dst, const void *src, size_t len) {
+    size_t i;
+    for(i = 0; i < len; i += 4) {
+        uint32_t x = be32dec((const uint8_t *)src + i);
+        memcpy((uint8_t *)dst + i, &x, 4);
+    }
+}
+
+#ifdef BE32VECT_X86
+__attribute__((target("ssse3")))
+static void swapSSSE3(void *dst, const void *src, size_t len) {
+    const __m128i shuffle = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    size_t i = 0;
+    for(; i + 64 <= len; i += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_shuffle_epi8(v0, shuffle));
+        _mm_storeu_si128((__m128i *)(d + i + 16), _mm_shuffle_epi8(v1, shuffle));
+        _mm_storeu_si128((__m128i *)(d + i + 32), _mm_shuffle_epi8(v2, shuffle));
+        _mm_storeu_si128((__m128i *)(d + i + 48), _mm_shuffle_epi8(v3, shuffle));
+    }
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_shuffle_epi8(v, shuffle));
+    }
+    swapScalar(d + i, s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void swapAVX2(void *dst, const void *src, size_t len) {
+    const __m256i shuffle = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    size_t i = 0;
+    for(; i + 128 <= len; i += 128) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+        _mm256_storeu_si256((__m256i *)(d + i), _mm256_shuffle_epi8(v0, shuffle));
+        _mm256_storeu_si256((__m256i *)(d + i + 32), _mm256_shuffle_epi8(v1, shuffle));
+        _mm256_storeu_si256((__m256i *)(d + i + 64), _mm256_shuffle_epi8(v2, shuffle));
+        _mm256_storeu_si256((__m256i *)(d + i + 96), _mm256_shuffle_epi8(v3, shuffle));
+    }
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_si256((__m256i *)(d + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+    swapScalar(d + i, s + i, len - i);
+}
+#endif
+
+// Pick the best byte-swap loop for this CPU.
+static swapFunc selectSwap(void) {
+#ifdef BE32VECT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return swapAVX2;
+    }
+    if(__builtin_cpu_supports("ssse3")) {
+        return swapSSSE3;
+    }
+#endif
+    return swapScalar;
+}
+
+static _Atomic(swapFunc) swapImpl = NULL;
+
+// Return the selected byte-swap loop, selecting it on the first call.  Racing first calls select the same loop.
+static inline swapFunc getSwap(void) {
+    swapFunc swap = atomic_load_explicit(&swapImpl, memory_order_acquire);
+    if(swap == NULL) {
+        swap = selectSwap();
+        atomic_store_explicit(&swapImpl, swap, memory_order_release);
+    }
+    return swap;
+}
+
+// Byte-swap each 32-bit word of src into dst, dispatching on CPU features.
+void be32swap_vect(void *dst, const void *src, size_t len) {
+    getSwap()(dst, src, len);
+}
+
+// The name of the byte-swap loop picked for this CPU.
+const char *be32vectImplementation(void) {
+    swapFunc swap = getSwap();
+#ifdef BE32VECT_X86
+    if(swap == swapAVX2) {
+        return "avx2";
+    }
+    if(swap == swapSSSE3) {
+        return "ssse3";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,61 @@
+#ifndef _BE32VECT_H_
+#define _BE32VECT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "pbkdf2.h"
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// Vectorized versions of be32enc_vect and be32dec_vect from pbkdf2.h.  As with the scalar helpers, len is in
+// bytes and must be a multiple of 4.  dst and src may be the same buffer, but must not otherwise overlap.
+// Buffers of 64 bytes or more go through be32swap_vect, which picks an AVX2 or SSSE3 loop for the running CPU
+// on first use.  Shorter ones are swapped inline, with PSHUFB when compiled for SSSE3.
+
+// Byte-swap each 32-bit word of src into dst, dispatching on CPU features.
+void be32swap_vect(void *dst, const void *src, size_t len);
+
+// The name of the byte-swap loop picked for this CPU: "avx2", "ssse3" or "scalar".
+const char *be32vectImplementation(void);
+
+// Byte-swap a buffer of less than 64 bytes.  Big-endian encoding and decoding are the same permutation of bytes.
+static inline void
+be32swap_vect_short(void *dst, const void *src, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSSE3__
+	const __m128i shuffle = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)((const uint8_t *)src + i));
+		_mm_storeu_si128((__m128i *)((uint8_t *)dst + i), _mm_shuffle_epi8(v, shuffle));
+	}
+#endif
+	for (; i < len; i += 4) {
+		uint32_t x = be32dec((const uint8_t *)src + i);
+		memcpy((uint8_t *)dst + i, &x, 4);
+	}
+}
+
+static inline void
+be32enc_vect_fast(unsigned char *dst, const uint32_t *src, size_t len)
+{
+	if (len < 64)
+		be32swap_vect_short(dst, src, len);
+	else
+		be32swap_vect(dst, src, len);
+}
+
+static inline void
+be32dec_vect_fast(uint32_t *dst, const unsigned char *src, size_t len)
+{
+	if (len < 64)
+		be32swap_vect_short(dst, src, len);
+	else
+		be32swap_vect(dst, src, len);
+}
+
+#endif /* !_BE32VECT_H_ */
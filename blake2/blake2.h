@@ -125,6 +125,8 @@ extern "C" {
   int blake2b_init_param( blake2b_state *S, const blake2b_param *P );
   int blake2b_update( blake2b_state *S, const uint8_t *in, uint64_t inlen );
   int blake2b_final( blake2b_state *S, uint8_t *out, uint8_t outlen );
+  // Compress a full block straight away.  Nothing may be buffered in S.
+  int blake2b_absorb_block( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
 
   int blake2sp_init( blake2sp_state *S, const uint8_t outlen );
   int blake2sp_init_key( blake2sp_state *S, const uint8_t outlen, const void *key, const uint8_t keylen );
@@ -143,6 +145,15 @@ extern "C" {
   int blake2sp( uint8_t *out, const void *in, const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen );
   int blake2bp( uint8_t *out, const void *in, const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen );
 
+  // Multi-buffer API: 4 or 8 independent messages of equal length, one per SIMD lane
+  int blake2s_x4( uint8_t *const out[4], const uint8_t *const in[4], const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen );
+  int blake2s_x8( uint8_t *const out[8], const uint8_t *const in[8], const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen );
+
+  // Update each state with inlen bytes of its own input, then finalize it.  The states must share their
+  // buffered length, counter and flags, as copies of one state or states initialized the same way do.
+  int blake2s_x4_update_final( blake2s_state *const S[4], const uint8_t *const in[4], uint64_t inlen, uint8_t *const out[4], uint8_t outlen );
+  int blake2s_x8_update_final( blake2s_state *const S[8], const uint8_t *const in[8], uint64_t inlen, uint8_t *const out[8], uint8_t outlen );
+
   static inline int blake2( uint8_t *out, const void *in, const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen )
   {
     return blake2b( out, in, key, outlen, inlen, keylen );
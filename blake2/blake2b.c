@@ -346,6 +346,17 @@ int blake2b_update( blake2b_state *S, const uint8_t *in, uint64_t inlen )
   return 0;
 }
 
+// Compress one full block now, rather than buffering it as blake2b_update does, so that copies of the state
+// start after it.  Only valid while nothing is buffered, as after init or a previous call.
+int blake2b_absorb_block( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  if( S->buflen != 0 ) return -1;
+
+  blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
+  blake2b_compress( S, block );
+  return 0;
+}
+
 
 int blake2b_final( blake2b_state *S, uint8_t *out, uint8_t outlen )
 {
@@ -0,0 +1,488 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Multi-buffer BLAKE2s: 4 or 8 independent messages of equal length are
+   hashed together, one message per 32-bit SIMD lane.
+
+   To the extent possible under law, the author(s) have dedicated all copyright
+   and related and neighboring rights to this software to the public domain
+   worldwide. This software is distributed without any warranty.
+
+   You should have received a copy of the CC0 Public Domain Dedication along with
+   this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+
+#include <immintrin.h>
+
+static const uint8_t blake2s_sigma[10][16] =
+{
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+};
+
+/* Compress one block in each of several states, which share t and f */
+typedef void ( *blake2s_compress_multi )( blake2s_state *const S[], const uint8_t *const block[] );
+
+/* The column and diagonal steps of one round, on vectors holding one word per lane */
+#define G( ADD, XOR, ROT16, ROT12, ROT8, ROT7, a, b, c, d, x, y ) \
+  do { \
+    a = ADD( ADD( a, b ), x ); d = ROT16( XOR( d, a ) ); \
+    c = ADD( c, d );           b = ROT12( XOR( b, c ) ); \
+    a = ADD( ADD( a, b ), y ); d = ROT8( XOR( d, a ) );  \
+    c = ADD( c, d );           b = ROT7( XOR( b, c ) );  \
+  } while( 0 )
+
+#define ROUND( G1, r ) \
+  do { \
+    G1( v[ 0], v[ 4], v[ 8], v[12], m[blake2s_sigma[r][ 0]], m[blake2s_sigma[r][ 1]] ); \
+    G1( v[ 1], v[ 5], v[ 9], v[13], m[blake2s_sigma[r][ 2]], m[blake2s_sigma[r][ 3]] ); \
+    G1( v[ 2], v[ 6], v[10], v[14], m[blake2s_sigma[r][ 4]], m[blake2s_sigma[r][ 5]] ); \
+    G1( v[ 3], v[ 7], v[11], v[15], m[blake2s_sigma[r][ 6]], m[blake2s_sigma[r][ 7]] ); \
+    G1( v[ 0], v[ 5], v[10], v[15], m[blake2s_sigma[r][ 8]], m[blake2s_sigma[r][ 9]] ); \
+    G1( v[ 1], v[ 6], v[11], v[12], m[blake2s_sigma[r][10]], m[blake2s_sigma[r][11]] ); \
+    G1( v[ 2], v[ 7], v[ 8], v[13], m[blake2s_sigma[r][12]], m[blake2s_sigma[r][13]] ); \
+    G1( v[ 3], v[ 4], v[ 9], v[14], m[blake2s_sigma[r][14]], m[blake2s_sigma[r][15]] ); \
+  } while( 0 )
+
+/* 4-way SSSE3 version: one state per 32-bit lane of an __m128i */
+
+#define ADD4( a, b ) _mm_add_epi32( a, b )
+#define XOR4( a, b ) _mm_xor_si128( a, b )
+#define ROT4( x, c ) _mm_or_si128( _mm_srli_epi32( x, c ), _mm_slli_epi32( x, 32 - ( c ) ) )
+#define ROT16_4( x ) _mm_shuffle_epi8( x, r16 )
+#define ROT12_4( x ) ROT4( x, 12 )
+#define ROT8_4( x ) _mm_shuffle_epi8( x, r8 )
+#define ROT7_4( x ) ROT4( x, 7 )
+#define G4( a, b, c, d, x, y ) G( ADD4, XOR4, ROT16_4, ROT12_4, ROT8_4, ROT7_4, a, b, c, d, x, y )
+
+/* Transpose a 4x4 matrix of 32-bit words held in four rows */
+#define TRANSPOSE4( r0, r1, r2, r3 ) \
+  do { \
+    __m128i t0 = _mm_unpacklo_epi32( r0, r1 ); \
+    __m128i t1 = _mm_unpackhi_epi32( r0, r1 ); \
+    __m128i t2 = _mm_unpacklo_epi32( r2, r3 ); \
+    __m128i t3 = _mm_unpackhi_epi32( r2, r3 ); \
+    r0 = _mm_unpacklo_epi64( t0, t2 ); \
+    r1 = _mm_unpackhi_epi64( t0, t2 ); \
+    r2 = _mm_unpacklo_epi64( t1, t3 ); \
+    r3 = _mm_unpackhi_epi64( t1, t3 ); \
+  } while( 0 )
+
+__attribute__(( target( "ssse3" ) ))
+static void blake2s_compress_x4( blake2s_state *const S[], const uint8_t *const block[] )
+{
+  const __m128i r8 = _mm_set_epi8( 12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1 );
+  const __m128i r16 = _mm_set_epi8( 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2 );
+  __m128i m[16], v[16], h[8];
+
+  for( int i = 0; i < 16; i += 4 )
+  {
+    m[i + 0] = _mm_loadu_si128( ( const __m128i * )( block[0] + 4 * i ) );
+    m[i + 1] = _mm_loadu_si128( ( const __m128i * )( block[1] + 4 * i ) );
+    m[i + 2] = _mm_loadu_si128( ( const __m128i * )( block[2] + 4 * i ) );
+    m[i + 3] = _mm_loadu_si128( ( const __m128i * )( block[3] + 4 * i ) );
+    TRANSPOSE4( m[i + 0], m[i + 1], m[i + 2], m[i + 3] );
+  }
+
+  for( int i = 0; i < 8; i += 4 )
+  {
+    h[i + 0] = _mm_loadu_si128( ( const __m128i * )&S[0]->h[i] );
+    h[i + 1] = _mm_loadu_si128( ( const __m128i * )&S[1]->h[i] );
+    h[i + 2] = _mm_loadu_si128( ( const __m128i * )&S[2]->h[i] );
+    h[i + 3] = _mm_loadu_si128( ( const __m128i * )&S[3]->h[i] );
+    TRANSPOSE4( h[i + 0], h[i + 1], h[i + 2], h[i + 3] );
+  }
+
+  for( int i = 0; i < 8; ++i ) v[i] = h[i];
+
+  v[ 8] = _mm_set1_epi32( 0x6A09E667 );
+  v[ 9] = _mm_set1_epi32( 0xBB67AE85 );
+  v[10] = _mm_set1_epi32( 0x3C6EF372 );
+  v[11] = _mm_set1_epi32( 0xA54FF53A );
+  v[12] = _mm_set1_epi32( 0x510E527F ^ S[0]->t[0] );
+  v[13] = _mm_set1_epi32( 0x9B05688C ^ S[0]->t[1] );
+  v[14] = _mm_set1_epi32( 0x1F83D9AB ^ S[0]->f[0] );
+  v[15] = _mm_set1_epi32( 0x5BE0CD19 ^ S[0]->f[1] );
+
+  for( int r = 0; r < 10; ++r )
+    ROUND( G4, r );
+
+  for( int i = 0; i < 8; ++i )
+    h[i] = XOR4( h[i], XOR4( v[i], v[i + 8] ) );
+
+  for( int i = 0; i < 8; i += 4 )
+  {
+    TRANSPOSE4( h[i + 0], h[i + 1], h[i + 2], h[i + 3] );
+    _mm_storeu_si128( ( __m128i * )&S[0]->h[i], h[i + 0] );
+    _mm_storeu_si128( ( __m128i * )&S[1]->h[i], h[i + 1] );
+    _mm_storeu_si128( ( __m128i * )&S[2]->h[i], h[i + 2] );
+    _mm_storeu_si128( ( __m128i * )&S[3]->h[i], h[i + 3] );
+  }
+}
+
+/* 8-way AVX2 version: one state per 32-bit lane of an __m256i */
+
+#define ADD8( a, b ) _mm256_add_epi32( a, b )
+#define XOR8( a, b ) _mm256_xor_si256( a, b )
+#define ROT8W( x, c ) _mm256_or_si256( _mm256_srli_epi32( x, c ), _mm256_slli_epi32( x, 32 - ( c ) ) )
+#define ROT16_8( x ) _mm256_shuffle_epi8( x, r16 )
+#define ROT12_8( x ) ROT8W( x, 12 )
+#define ROT8_8( x ) _mm256_shuffle_epi8( x, r8 )
+#define ROT7_8( x ) ROT8W( x, 7 )
+#define G8( a, b, c, d, x, y ) G( ADD8, XOR8, ROT16_8, ROT12_8, ROT8_8, ROT7_8, a, b, c, d, x, y )
+
+/* Transpose an 8x8 matrix of 32-bit words held in eight rows */
+#define TRANSPOSE8( r ) \
+  do { \
+    __m256i t0 = _mm256_unpacklo_epi32( r[0], r[1] ); \
+    __m256i t1 = _mm256_unpackhi_epi32( r[0], r[1] ); \
+    __m256i t2 = _mm256_unpacklo_epi32( r[2], r[3] ); \
+    __m256i t3 = _mm256_unpackhi_epi32( r[2], r[3] ); \
+    __m256i t4 = _mm256_unpacklo_epi32( r[4], r[5] ); \
+    __m256i t5 = _mm256_unpackhi_epi32( r[4], r[5] ); \
+    __m256i t6 = _mm256_unpacklo_epi32( r[6], r[7] ); \
+    __m256i t7 = _mm256_unpackhi_epi32( r[6], r[7] ); \
+    __m256i u0 = _mm256_unpacklo_epi64( t0, t2 ); \
+    __m256i u1 = _mm256_unpackhi_epi64( t0, t2 ); \
+    __m256i u2 = _mm256_unpacklo_epi64( t1, t3 ); \
+    __m256i u3 = _mm256_unpackhi_epi64( t1, t3 ); \
+    __m256i u4 = _mm256_unpacklo_epi64( t4, t6 ); \
+    __m256i u5 = _mm256_unpackhi_epi64( t4, t6 ); \
+    __m256i u6 = _mm256_unpacklo_epi64( t5, t7 ); \
+    __m256i u7 = _mm256_unpackhi_epi64( t5, t7 ); \
+    r[0] = _mm256_permute2x128_si256( u0, u4, 0x20 ); \
+    r[1] = _mm256_permute2x128_si256( u1, u5, 0x20 ); \
+    r[2] = _mm256_permute2x128_si256( u2, u6, 0x20 ); \
+    r[3] = _mm256_permute2x128_si256( u3, u7, 0x20 ); \
+    r[4] = _mm256_permute2x128_si256( u0, u4, 0x31 ); \
+    r[5] = _mm256_permute2x128_si256( u1, u5, 0x31 ); \
+    r[6] = _mm256_permute2x128_si256( u2, u6, 0x31 ); \
+    r[7] = _mm256_permute2x128_si256( u3, u7, 0x31 ); \
+  } while( 0 )
+
+__attribute__(( target( "avx2" ) ))
+static void blake2s_compress_x8( blake2s_state *const S[], const uint8_t *const block[] )
+{
+  const __m256i r8 = _mm256_set_epi8( 12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                      12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1 );
+  const __m256i r16 = _mm256_set_epi8( 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                       13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2 );
+  __m256i m[16], v[16], h[8];
+
+  for( int i = 0; i < 16; i += 8 )
+  {
+    for( int j = 0; j < 8; ++j )
+      m[i + j] = _mm256_loadu_si256( ( const __m256i * )( block[j] + 4 * i ) );
+
+    TRANSPOSE8( ( m + i ) );
+  }
+
+  for( int j = 0; j < 8; ++j )
+    h[j] = _mm256_loadu_si256( ( const __m256i * )S[j]->h );
+
+  TRANSPOSE8( h );
+
+  for( int i = 0; i < 8; ++i ) v[i] = h[i];
+
+  v[ 8] = _mm256_set1_epi32( 0x6A09E667 );
+  v[ 9] = _mm256_set1_epi32( 0xBB67AE85 );
+  v[10] = _mm256_set1_epi32( 0x3C6EF372 );
+  v[11] = _mm256_set1_epi32( 0xA54FF53A );
+  v[12] = _mm256_set1_epi32( 0x510E527F ^ S[0]->t[0] );
+  v[13] = _mm256_set1_epi32( 0x9B05688C ^ S[0]->t[1] );
+  v[14] = _mm256_set1_epi32( 0x1F83D9AB ^ S[0]->f[0] );
+  v[15] = _mm256_set1_epi32( 0x5BE0CD19 ^ S[0]->f[1] );
+
+  for( int r = 0; r < 10; ++r )
+    ROUND( G8, r );
+
+  for( int i = 0; i < 8; ++i )
+    h[i] = XOR8( h[i], XOR8( v[i], v[i + 8] ) );
+
+  TRANSPOSE8( h );
+
+  for( int j = 0; j < 8; ++j )
+    _mm256_storeu_si256( ( __m256i * )S[j]->h, h[j] );
+}
+
+static inline void blake2s_increment_counter_multi( blake2s_state *const S[], size_t n, const uint32_t inc )
+{
+  for( size_t j = 0; j < n; ++j )
+  {
+    uint64_t t = ( ( uint64_t )S[j]->t[1] << 32 ) | S[j]->t[0];
+    t += inc;
+    S[j]->t[0] = ( uint32_t )( t >>  0 );
+    S[j]->t[1] = ( uint32_t )( t >> 32 );
+  }
+}
+
+/* The states must be in lockstep: same buffered length, counter and flags */
+static int blake2s_check_lockstep( blake2s_state *const S[], size_t n )
+{
+  for( size_t j = 1; j < n; ++j )
+  {
+    if( S[j]->buflen != S[0]->buflen || S[j]->t[0] != S[0]->t[0] || S[j]->t[1] != S[0]->t[1] ||
+        S[j]->f[0] != S[0]->f[0] || S[j]->last_node != S[0]->last_node )
+      return -1;
+  }
+
+  return 0;
+}
+
+/* The lockstep equivalent of blake2s_update followed by blake2s_final on each state */
+static int blake2s_update_final_multi( blake2s_state *const S[], const uint8_t *const in[], uint64_t inlen,
+                                       uint8_t *const out[], uint8_t outlen, size_t n,
+                                       blake2s_compress_multi compress )
+{
+  const uint8_t *block[8];
+  uint64_t offset = 0;
+
+  if( n > 8 || blake2s_check_lockstep( S, n ) < 0 ) return -1;
+
+  for( size_t j = 0; j < n; ++j )
+    block[j] = S[j]->buf;
+
+  while( inlen > 0 )
+  {
+    size_t left = S[0]->buflen;
+    size_t fill = 2 * BLAKE2S_BLOCKBYTES - left;
+
+    if( inlen > fill )
+    {
+      for( size_t j = 0; j < n; ++j )
+      {
+        memcpy( S[j]->buf + left, in[j] + offset, fill ); // Fill buffer
+        S[j]->buflen += fill;
+      }
+
+      blake2s_increment_counter_multi( S, n, BLAKE2S_BLOCKBYTES );
+      compress( S, block ); // Compress
+
+      for( size_t j = 0; j < n; ++j )
+      {
+        memcpy( S[j]->buf, S[j]->buf + BLAKE2S_BLOCKBYTES, BLAKE2S_BLOCKBYTES ); // Shift buffer left
+        S[j]->buflen -= BLAKE2S_BLOCKBYTES;
+      }
+
+      offset += fill;
+      inlen -= fill;
+    }
+    else // inlen <= fill
+    {
+      for( size_t j = 0; j < n; ++j )
+      {
+        memcpy( S[j]->buf + left, in[j] + offset, inlen );
+        S[j]->buflen += inlen; // Be lazy, do not compress
+      }
+
+      offset += inlen;
+      inlen -= inlen;
+    }
+  }
+
+  if( S[0]->buflen > BLAKE2S_BLOCKBYTES )
+  {
+    blake2s_increment_counter_multi( S, n, BLAKE2S_BLOCKBYTES );
+    compress( S, block );
+
+    for( size_t j = 0; j < n; ++j )
+    {
+      S[j]->buflen -= BLAKE2S_BLOCKBYTES;
+      memcpy( S[j]->buf, S[j]->buf + BLAKE2S_BLOCKBYTES, S[j]->buflen );
+    }
+  }
+
+  blake2s_increment_counter_multi( S, n, ( uint32_t )S[0]->buflen );
+
+  for( size_t j = 0; j < n; ++j )
+  {
+    if( S[j]->last_node ) S[j]->f[1] = ~0U;
+
+    S[j]->f[0] = ~0U;
+    memset( S[j]->buf + S[j]->buflen, 0, 2 * BLAKE2S_BLOCKBYTES - S[j]->buflen ); /* Padding */
+  }
+
+  compress( S, block );
+
+  for( size_t j = 0; j < n; ++j )
+  {
+    uint8_t buffer[BLAKE2S_OUTBYTES];
+
+    for( int i = 0; i < 8; ++i ) /* Output full hash to temp buffer */
+      store32( buffer + sizeof( S[j]->h[i] ) * i, S[j]->h[i] );
+
+    memcpy( out[j], buffer, outlen );
+  }
+
+  return 0;
+}
+
+/* The compression functions this CPU can run, picked on first use */
+static int blake2s_multi_cpu = -1;
+
+static int blake2s_multi_features( void )
+{
+  int features = __atomic_load_n( &blake2s_multi_cpu, __ATOMIC_RELAXED );
+
+  if( features < 0 )
+  {
+    __builtin_cpu_init();
+    features = ( __builtin_cpu_supports( "ssse3" ) ? 1 : 0 ) | ( __builtin_cpu_supports( "avx2" ) ? 2 : 0 );
+    __atomic_store_n( &blake2s_multi_cpu, features, __ATOMIC_RELAXED );
+  }
+
+  return features;
+}
+
+int blake2s_x4_update_final( blake2s_state *const S[4], const uint8_t *const in[4], uint64_t inlen,
+                             uint8_t *const out[4], uint8_t outlen )
+{
+  if( blake2s_multi_features() & 1 )
+    return blake2s_update_final_multi( S, in, inlen, out, outlen, 4, blake2s_compress_x4 );
+
+  if( blake2s_check_lockstep( S, 4 ) < 0 ) return -1;
+
+  for( size_t j = 0; j < 4; ++j )
+  {
+    blake2s_update( S[j], in[j], inlen );
+    blake2s_final( S[j], out[j], outlen );
+  }
+
+  return 0;
+}
+
+int blake2s_x8_update_final( blake2s_state *const S[8], const uint8_t *const in[8], uint64_t inlen,
+                             uint8_t *const out[8], uint8_t outlen )
+{
+  if( blake2s_multi_features() & 2 )
+    return blake2s_update_final_multi( S, in, inlen, out, outlen, 8, blake2s_compress_x8 );
+
+  if( blake2s_check_lockstep( S, 8 ) < 0 ) return -1;
+
+  if( blake2s_x4_update_final( S, in, inlen, out, outlen ) < 0 ) return -1;
+
+  return blake2s_x4_update_final( S + 4, in + 4, inlen, out + 4, outlen );
+}
+
+/* Initialize n states for blake2s_x4 and blake2s_x8 */
+static int blake2s_init_multi( blake2s_state S[], size_t n, const void *key, const uint8_t outlen, uint8_t keylen )
+{
+  for( size_t j = 0; j < n; ++j )
+  {
+    if( keylen > 0 )
+    {
+      if( blake2s_init_key( &S[j], outlen, key, keylen ) < 0 ) return -1;
+    }
+    else
+    {
+      if( blake2s_init( &S[j], outlen ) < 0 ) return -1;
+    }
+  }
+
+  return 0;
+}
+
+int blake2s_x4( uint8_t *const out[4], const uint8_t *const in[4], const void *key, const uint8_t outlen,
+                const uint64_t inlen, uint8_t keylen )
+{
+  blake2s_state S[4];
+  blake2s_state *P[4] = { &S[0], &S[1], &S[2], &S[3] };
+
+  if ( NULL == key ) keylen = 0;
+
+  if( blake2s_init_multi( S, 4, key, outlen, keylen ) < 0 ) return -1;
+
+  int ret = blake2s_x4_update_final( P, in, inlen, out, outlen );
+  secure_zero_memory( S, sizeof( S ) );
+  return ret;
+}
+
+int blake2s_x8( uint8_t *const out[8], const uint8_t *const in[8], const void *key, const uint8_t outlen,
+                const uint64_t inlen, uint8_t keylen )
+{
+  blake2s_state S[8];
+  blake2s_state *P[8] = { &S[0], &S[1], &S[2], &S[3], &S[4], &S[5], &S[6], &S[7] };
+
+  if ( NULL == key ) keylen = 0;
+
+  if( blake2s_init_multi( S, 8, key, outlen, keylen ) < 0 ) return -1;
+
+  int ret = blake2s_x8_update_final( P, in, inlen, out, outlen );
+  secure_zero_memory( S, sizeof( S ) );
+  return ret;
+}
+
+#if defined(BLAKE2S_MULTI_SELFTEST)
+#include "blake2-kat.h"
+int main( int argc, char **argv )
+{
+  uint8_t key[BLAKE2S_KEYBYTES];
+  uint8_t buf[8][KAT_LENGTH];
+
+  for( size_t i = 0; i < BLAKE2S_KEYBYTES; ++i )
+    key[i] = ( uint8_t )i;
+
+  for( size_t j = 0; j < 8; ++j )
+    for( size_t i = 0; i < KAT_LENGTH; ++i )
+      buf[j][i] = ( uint8_t )( i + 37 * j );
+
+  for( size_t i = 0; i < KAT_LENGTH; ++i )
+  {
+    uint8_t hash[8][BLAKE2S_OUTBYTES];
+    uint8_t *out[8];
+    const uint8_t *in[8];
+
+    for( size_t j = 0; j < 8; ++j )
+    {
+      out[j] = hash[j];
+      in[j] = buf[0];
+    }
+
+    /* Every lane hashes the KAT message */
+    if( blake2s_x4( out, in, key, BLAKE2S_OUTBYTES, i, BLAKE2S_KEYBYTES ) < 0 ) goto fail;
+
+    for( size_t j = 0; j < 4; ++j )
+      if( 0 != memcmp( hash[j], blake2s_keyed_kat[i], BLAKE2S_OUTBYTES ) ) goto fail;
+
+    if( blake2s_x8( out, in, key, BLAKE2S_OUTBYTES, i, BLAKE2S_KEYBYTES ) < 0 ) goto fail;
+
+    for( size_t j = 0; j < 8; ++j )
+      if( 0 != memcmp( hash[j], blake2s_keyed_kat[i], BLAKE2S_OUTBYTES ) ) goto fail;
+
+    /* Lanes hash different messages, which must not leak into each other */
+    for( size_t j = 0; j < 8; ++j )
+      in[j] = buf[j];
+
+    if( blake2s_x8( out, in, NULL, BLAKE2S_OUTBYTES, i, 0 ) < 0 ) goto fail;
+
+    for( size_t j = 0; j < 8; ++j )
+    {
+      uint8_t expected[BLAKE2S_OUTBYTES];
+      blake2s( expected, in[j], NULL, BLAKE2S_OUTBYTES, i, 0 );
+
+      if( 0 != memcmp( hash[j], expected, BLAKE2S_OUTBYTES ) ) goto fail;
+    }
+  }
+
+  puts( "ok" );
+  return 0;
+fail:
+  puts( "error" );
+  return -1;
+}
+#endif
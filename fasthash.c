@@ -4,20 +4,15 @@
 #include <string.h>
 #include <getopt.h>
 #include <immintrin.h>
-#include "sha256.h"
+#include "blake2/blake2.h"
+#include "pbkdf2.h"
 
-void SHA256_Uint8(const uint8_t input[32], uint8_t hash[32]) {
-  SHA256_CTX ctx;
-  SHA256_Init(&ctx);
-  SHA256_Update(&ctx, input, 32);
-  SHA256_Final(hash, &ctx);
-}
-
-void SHA256_Uint32(uint32_t hash[8]) {
-    uint8_t in[32], out[32];
-    be32enc_vect(in, hash, 32);
-    SHA256_Uint8(in, out);
-    be32dec_vect(hash, out, 32);
+// Hash the 8 words in place with BLAKE2s, as the KDF itself does when it folds state into memory.
+void Blake2s_Uint32(uint32_t hash[8]) {
+    uint8_t buf[32];
+    be32enc_vect(buf, hash, 32);
+    blake2s(buf, buf, NULL, 32, 32, 0);
+    be32dec_vect(hash, buf, 32);
 }
 
 int main(int argc, char **argv) {
@@ -99,7 +94,7 @@ int main(int argc, char **argv) {
             ps += blocklen;
             if((i & 0x3f) == 0) {
                 uint32_t *data = ps - 8;
-                SHA256_Uint32(data);
+                Blake2s_Uint32(data);
                 vm1 = _mm_load_si128(tm - 2);
                 vm2 = _mm_load_si128(tm - 1);
             }
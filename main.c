@@ -1,10 +1,14 @@
+#define _POSIX_C_SOURCE 200112L // Otherwise sysconf is not included
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <time.h>
 #include "tigerkdf.h"
+#include "tigerkdf-batch.h"
 
 static void usage(char *format, ...) {
     va_list ap;
@@ -20,7 +24,20 @@ static void usage(char *format, ...) {
         "    -M multipliesPerBlock -- The number of sequential multiplies to execute per block\n"
         "    -r repetitions  -- A multiplier on the total number of times we hash\n"
         "    -t parallelism  -- Parallelism parameter, typically the number of threads\n"
-        "    -b blockSize    -- Memory hashed in the inner loop at once, in bytes\n");
+        "    -b blockSize    -- Memory hashed in the inner loop at once, in bytes\n"
+        "    -V version      -- Algorithm version, an or of variant flags:\n"
+        "                       1 = expand lane keys with BLAKE2Xs rather than PBKDF2\n"
+        "                       2 = use PBKDF2 over BLAKE2b rather than BLAKE2s\n"
+        "    --batch[=file]  -- Hash records from the file, or stdin, and print one hash per line in input order.\n"
+        "                       Records are lines of: password <TAB> hex salt [<TAB> flag=value]...\n"
+        "                       where flag is one of h, g, m, M, r, t, b or V and overrides the option above\n"
+        "    -j workers      -- Number of records hashed at once in batch mode, by default the number of CPUs\n"
+        "    -v              -- Print time per phase and how long lanes waited for the multiply thread\n"
+        "    --graph=file    -- Also write the block dependency graph the hash followed to the file\n"
+        "    --timeout=secs  -- Give up on the hash if it takes longer than this many seconds\n"
+        "    --bandwidth=GiB/s -- Pace the hash to read and write at most this much memory per second\n"
+        "    --estimate[=model] -- Print the memory, traffic and work the hash would take, and its time with the\n"
+        "                       cost model tigerkdf-bench calibrate wrote, rather than hashing\n");
     exit(1);
 }
 
@@ -96,6 +113,89 @@ static void printHex(
     }
 }
 
+// Print the non-empty buckets of a histogram.
+static void printHistogram(const TigerKDFHistogram *histogram) {
+    uint32_t b;
+    for(b = 0; b < TIGERKDF_HISTOGRAM_BUCKETS; b++) {
+        uint64_t count = histogram->counts[b];
+        if(count == 0) {
+            continue;
+        }
+        if(b <= 1) {
+            printf("    %25u: %llu\n", b, (unsigned long long)count);
+        } else {
+            char range[64];
+            snprintf(range, sizeof(range), "%llu-%llu", 1ULL << (b - 1), (1ULL << b) - 1);
+            printf("    %25s: %llu\n", range, (unsigned long long)count);
+        }
+    }
+}
+
+// Return the number of blocks in a histogram of waits that waited at all.
+static uint64_t countWaits(const TigerKDFHistogram *histogram) {
+    uint64_t total = 0;
+    uint32_t b;
+    for(b = 1; b < TIGERKDF_HISTOGRAM_BUCKETS; b++) {
+        total += histogram->counts[b];
+    }
+    return total;
+}
+
+// Print where the time of a hash went, and which lanes waited on the multiply thread, if we have them.
+static void printStats(const TigerKDFStats *stats, uint32_t parallelism) {
+    printf("total: %.3fs\n", stats->totalSeconds);
+    uint32_t phase;
+    for(phase = 0; phase < 2; phase++) {
+        printf("phase %u: %.3fs, %.2fGB/s, lanes throttled for %.3fs\n", phase, stats->phaseSeconds[phase],
+            stats->phaseBytes[phase]/stats->phaseSeconds[phase]/1e9, stats->throttleSeconds[phase]);
+        printf("  nanoseconds each block waited for the multiply thread:\n");
+        printHistogram(stats->waits + phase);
+    }
+    printf("page faults: %llu minor, %llu major; RSS grew %.1fMB, %.1fMB in huge pages\n",
+        (unsigned long long)stats->minorFaults, (unsigned long long)stats->majorFaults, stats->rssBytes/1e6,
+        stats->hugePageBytes/1e6);
+    printf("blocks the multiply thread was ahead of the slowest lane:\n");
+    printHistogram(&stats->multLead);
+    if(stats->laneWaits == NULL) {
+        return;
+    }
+    printf("blocks that waited, by lane, in phase 0 and 1:\n");
+    uint32_t p;
+    for(p = 0; p < parallelism; p++) {
+        uint64_t waits0 = countWaits(stats->laneWaits + p);
+        uint64_t waits1 = countWaits(stats->laneWaits + parallelism + p);
+        if(waits0 != 0 || waits1 != 0) {
+            printf("    lane %u: %llu %llu\n", p, (unsigned long long)waits0, (unsigned long long)waits1);
+        }
+    }
+}
+
+// Print what hashing with these parameters would cost, with the time if modelFile is not NULL.
+static bool printEstimate(uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
+        uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, const TigerKDFOptions *options,
+        const char *modelFile) {
+    TigerKDFCostModel model;
+    if(modelFile != NULL && !TigerKDF_ReadCostModel(&model, modelFile)) {
+        return false;
+    }
+    TigerKDFCost cost;
+    if(!TigerKDF_EstimateCost(&cost, hashSize, memSize, multipliesPerBlock, 0, garlic, blockSize, parallelism,
+            repetitions, options, modelFile != NULL? &model : NULL)) {
+        fprintf(stderr, "Invalid parameters\n");
+        return false;
+    }
+    printf("peak bytes: %llu (memory %llu, multiply hashes %llu, schedule %llu, stacks %llu)\n",
+        (unsigned long long)cost.peakBytes, (unsigned long long)cost.memBytes,
+        (unsigned long long)cost.multHashBytes, (unsigned long long)cost.scheduleBytes,
+        (unsigned long long)cost.stackBytes);
+    printf("traffic bytes: %llu\nBLAKE2s calls: %llu\nmultiplies: %llu\n", (unsigned long long)cost.trafficBytes,
+        (unsigned long long)cost.blake2sCalls, (unsigned long long)cost.multiplies);
+    if(modelFile != NULL) {
+        printf("predicted time: %.3fs\n", cost.seconds);
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     uint32_t memorySize = 2048*1024, derivedKeySize = 32;
     uint32_t repetitions = 1, parallelism = 2, blockSize = 16384;
@@ -105,10 +205,67 @@ int main(int argc, char **argv) {
     uint8_t *password = (uint8_t *)"password";
     uint32_t passwordSize = 8;
     uint32_t multipliesPerBlock = 4096;
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    bool batch = false;
+    bool verbose = false;
+    char *batchFile = NULL;
+    bool estimate = false;
+    char *modelFile = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t workers = cpus < 1? 1 : cpus;
+    static const struct option longOptions[] = {
+        {"batch", optional_argument, NULL, 'B'},
+        {"graph", required_argument, NULL, 'G'},
+        {"timeout", required_argument, NULL, 'T'},
+        {"bandwidth", required_argument, NULL, 'W'},
+        {"estimate", optional_argument, NULL, 'E'},
+        {NULL, 0, NULL, 0}
+    };
 
-    char c;
-    while((c = getopt(argc, argv, "h:p:s:g:m:M:r:t:b:d")) != -1) {
+    int c;
+    while((c = getopt_long(argc, argv, "h:p:s:g:m:M:r:t:b:V:j:dv", longOptions, NULL)) != -1) {
         switch (c) {
+        case 'B':
+            batch = true;
+            batchFile = optarg;
+            break;
+        case 'E':
+            estimate = true;
+            modelFile = optarg;
+            break;
+        case 'G':
+            options.graphFile = optarg;
+            break;
+        case 'T': {
+            char *endPtr;
+            double timeout = strtod(optarg, &endPtr);
+            if(*optarg == '\0' || *endPtr != '\0' || timeout <= 0.0) {
+                usage("Invalid timeout");
+            }
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            options.deadline = ts.tv_sec + ts.tv_nsec*1e-9 + timeout;
+            break;
+        }
+        case 'W': {
+            char *endPtr;
+            options.maxBandwidth = strtod(optarg, &endPtr);
+            if(*optarg == '\0' || *endPtr != '\0' || options.maxBandwidth <= 0.0) {
+                usage("Invalid bandwidth");
+            }
+            break;
+        }
+        case 'j':
+            workers = readuint32_t(c, optarg);
+            if(workers == 0) {
+                usage("Workers must be at least 1");
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
         case 'h':
             derivedKeySize = readuint32_t(c, optarg);
             break;
@@ -137,6 +294,9 @@ int main(int argc, char **argv) {
         case 'b':
             blockSize = readuint32_t(c, optarg);
             break;
+        case 'V':
+            options.version = readuint32_t(c, optarg);
+            break;
         default:
             usage("Invalid argumet");
         }
@@ -145,15 +305,42 @@ int main(int argc, char **argv) {
         usage("Extra parameters not recognised\n");
     }
 
+    if(batch) {
+        TigerKDFBatchParams params = {derivedKeySize, memorySize, multipliesPerBlock, garlic, blockSize,
+            parallelism, repetitions, options.version};
+        setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+        return !runBatch(batchFile, stdout, &params, workers);
+    }
+
+    if(estimate) {
+        return !printEstimate(derivedKeySize, memorySize, multipliesPerBlock, garlic, blockSize, parallelism,
+            repetitions, &options, modelFile);
+    }
+
     printf("garlic:%u memorySize:%u multipliesPerBlock:%u repetitions:%u numThreads:%u blockSize:%u\n", 
         garlic, memorySize, multipliesPerBlock, repetitions, parallelism, blockSize);
     uint8_t *derivedKey = (uint8_t *)calloc(derivedKeySize, sizeof(uint8_t));
-    if(!TigerKDF_HashPassword(derivedKey, derivedKeySize, password, passwordSize, salt, saltSize,
-            memorySize, multipliesPerBlock, garlic, NULL, 0, blockSize, parallelism, repetitions)) {
+    TigerKDFStats stats;
+    memset(&stats, 0, sizeof(TigerKDFStats));
+    stats.size = sizeof(TigerKDFStats);
+    if(verbose) {
+        // Per-lane histograms are only worth their memory for a modest number of lanes.
+        if(parallelism <= 1 << 16) {
+            stats.laneWaits = (TigerKDFHistogram *)calloc(2*parallelism, sizeof(TigerKDFHistogram));
+            stats.numLaneWaits = stats.laneWaits != NULL? 2*parallelism : 0;
+        }
+        options.stats = &stats;
+    }
+    if(!TigerKDF_HashPasswordExt(derivedKey, derivedKeySize, password, passwordSize, salt, saltSize,
+            memorySize, multipliesPerBlock, garlic, NULL, 0, blockSize, parallelism, repetitions, &options)) {
         fprintf(stderr, "Key stretching failed.\n");
         return 1;
     }
     printHex(derivedKey, derivedKeySize);
     printf("\n");
+    if(verbose) {
+        printStats(&stats, parallelism);
+        free(stats.laneWaits);
+    }
     return 0;
 }
@@ -24,9 +24,13 @@
  * SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200112L /* For sysconf */
 #include <sys/types.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include "pbkdf2.h"
 #include "blake2/blake2.h"
 
@@ -97,15 +101,219 @@ HMAC_BLAKE2_Final(unsigned char digest[32], HMAC_BLAKE2_CTX * ctx)
     memset(ihash, 0, 32);
 }
 
-/**
- * PBKDF2_BLAKE2(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
- * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-BLAKE2 as the PRF, and
- * write the output to buf.  The value dkLen must be at most 32 * (2^32 - 1).
+typedef struct HMAC_BLAKE2BContext {
+    blake2b_state ictx;
+    blake2b_state octx;
+} HMAC_BLAKE2B_CTX;
+
+/*
+ * Hash the 128-byte pad into the freshly initialized state S, compressing it
+ * now.  blake2b_update keeps the last full block buffered, so a state that had
+ * only been updated with the pad would compress it again every time a copy of
+ * it is used.  blake2b_absorb_block, which blake2/blake2b.c adds to the
+ * reference API, compresses it straight away.
  */
-void PBKDF2_BLAKE2(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt,
-        size_t saltlen, uint64_t c, uint8_t* buf, size_t dkLen) {
-    HMAC_BLAKE2_CTX PShctx, hctx;
+static void
+HMAC_BLAKE2B_AbsorbPad(blake2b_state * S, const unsigned char pad[128])
+{
+
+    blake2b_absorb_block(S, pad);
+}
+
+/*
+ * Initialize an HMAC-BLAKE2b operation with the given key.  Unlike
+ * HMAC_BLAKE2_Init, this is standard HMAC over BLAKE2b's 128-byte block.
+ */
+static void
+HMAC_BLAKE2B_Init(HMAC_BLAKE2B_CTX * ctx, const void * _K, size_t Klen)
+{
+    unsigned char pad[128];
+    unsigned char khash[64];
+    const unsigned char * K = _K;
     size_t i;
+
+    /* If Klen > 128, the key is really BLAKE2b(K). */
+    if (Klen > 128) {
+        blake2b_init(&ctx->ictx, 64);
+        blake2b_update(&ctx->ictx, K, Klen);
+        blake2b_final(&ctx->ictx, khash, 64);
+        K = khash;
+        Klen = 64;
+    }
+
+    /* Inner BLAKE2b operation is BLAKE2b(K xor [block of 0x36] || data). */
+    blake2b_init(&ctx->ictx, 64);
+    memset(pad, 0x36, 128);
+    for (i = 0; i < Klen; i++)
+        pad[i] ^= K[i];
+    HMAC_BLAKE2B_AbsorbPad(&ctx->ictx, pad);
+
+    /* Outer BLAKE2b operation is BLAKE2b(K xor [block of 0x5c] || hash). */
+    blake2b_init(&ctx->octx, 64);
+    memset(pad, 0x5c, 128);
+    for (i = 0; i < Klen; i++)
+        pad[i] ^= K[i];
+    HMAC_BLAKE2B_AbsorbPad(&ctx->octx, pad);
+
+    /* Clean the stack. */
+    memset(khash, 0, 64);
+    memset(pad, 0, 128);
+}
+
+/* Add bytes to the HMAC-BLAKE2b operation. */
+static void
+HMAC_BLAKE2B_Update(HMAC_BLAKE2B_CTX * ctx, const void *in, size_t len)
+{
+
+    /* Feed data to the inner BLAKE2b operation. */
+    blake2b_update(&ctx->ictx, in, len);
+}
+
+/* Finish an HMAC-BLAKE2b operation. */
+static void
+HMAC_BLAKE2B_Final(unsigned char digest[64], HMAC_BLAKE2B_CTX * ctx)
+{
+    unsigned char ihash[64];
+
+    /* Finish the inner BLAKE2b operation. */
+    blake2b_final(&ctx->ictx, ihash, 64);
+
+    /* Feed the inner hash to the outer BLAKE2b operation. */
+    blake2b_update(&ctx->octx, ihash, 64);
+
+    /* Finish the outer BLAKE2b operation. */
+    blake2b_final(&ctx->octx, digest, 64);
+
+    /* Clean the stack. */
+    memset(ihash, 0, 64);
+}
+
+/* Below this many HMAC computations, PBKDF2_BLAKE2 does not start threads. */
+#define PBKDF2_THREAD_MIN_HMACS (1 << 14)
+
+/* The most threads PBKDF2_BLAKE2 starts for one derivation. */
+#define PBKDF2_MAX_THREADS 8
+
+/* The threads PBKDF2_BLAKE2_SetThreads asked for, or 0 for one per CPU. */
+static _Atomic unsigned PBKDF2_threads = 0;
+
+/* The state shared by the threads computing one PBKDF2 output. */
+typedef struct PBKDF2_BLAKE2Work {
+    const HMAC_BLAKE2_CTX * Phctx;
+    const HMAC_BLAKE2_CTX * PShctx;
+    uint64_t c;
+    uint8_t * buf;
+    size_t dkLen;
+    size_t firstBlock;
+    size_t lastBlock;
+} PBKDF2_BLAKE2_WORK;
+
+/*
+ * Compute n HMACs at once, each keyed by copies of ctx and over its own
+ * msglen-byte message, with multi-buffer BLAKE2s.  The value n must be 4 or 8.
+ * A digest may share its buffer with its message.
+ */
+static void
+HMAC_BLAKE2_Multi(const HMAC_BLAKE2_CTX * ctx, const uint8_t * const msg[],
+    size_t msglen, uint8_t * const digest[], size_t n)
+{
+    blake2s_state S[8];
+    blake2s_state * P[8];
+    unsigned char ihash[8][32];
+    uint8_t * ih[8];
+    size_t j;
+
+    /* Inner BLAKE2 operations. */
+    for (j = 0; j < n; j++) {
+        memcpy(&S[j], &ctx->ictx, sizeof(blake2s_state));
+        P[j] = &S[j];
+        ih[j] = ihash[j];
+    }
+    if (n == 8)
+        blake2s_x8_update_final(P, msg, msglen, ih, 32);
+    else
+        blake2s_x4_update_final(P, msg, msglen, ih, 32);
+
+    /* Outer BLAKE2 operations. */
+    for (j = 0; j < n; j++)
+        memcpy(&S[j], &ctx->octx, sizeof(blake2s_state));
+    if (n == 8)
+        blake2s_x8_update_final(P, (const uint8_t * const *)ih, 32, digest, 32);
+    else
+        blake2s_x4_update_final(P, (const uint8_t * const *)ih, 32, digest, 32);
+
+    /* Clean the stack. */
+    memset(S, 0, sizeof(S));
+    memset(ihash, 0, sizeof(ihash));
+}
+
+/*
+ * Compute output blocks [firstBlock, firstBlock + n) of a PBKDF2 derivation
+ * together, with multi-buffer BLAKE2s.  The value n must be 4 or 8.
+ */
+static void
+PBKDF2_BLAKE2_MultiBlocks(const PBKDF2_BLAKE2_WORK * work, size_t firstBlock,
+    size_t n)
+{
+    uint8_t ivec[8][4];
+    uint8_t U[8][32];
+    uint8_t T[8][32];
+    const uint8_t * msg[8];
+    uint8_t * digest[8];
+    uint64_t j;
+    size_t b;
+    int k;
+    size_t clen;
+
+    for (b = 0; b < n; b++) {
+        /* Generate INT(i + 1). */
+        be32enc(ivec[b], (uint32_t)(firstBlock + b + 1));
+        msg[b] = ivec[b];
+        digest[b] = U[b];
+    }
+
+    /* Compute U_1 = PRF(P, S || INT(i)). */
+    HMAC_BLAKE2_Multi(work->PShctx, msg, 4, digest, n);
+
+    /* T_i = U_1 ... */
+    memcpy(T, U, n * 32);
+
+    for (b = 0; b < n; b++)
+        msg[b] = U[b];
+    for (j = 2; j <= work->c; j++) {
+        /* Compute U_j, starting from the cached pad states. */
+        HMAC_BLAKE2_Multi(work->Phctx, msg, 32, digest, n);
+
+        /* ... xor U_j ... */
+        for (b = 0; b < n; b++)
+            for (k = 0; k < 32; k++)
+                T[b][k] ^= U[b][k];
+    }
+
+    /* Copy as many bytes as necessary into buf. */
+    for (b = 0; b < n; b++) {
+        clen = work->dkLen - (firstBlock + b) * 32;
+        if (clen > 32)
+            clen = 32;
+        memcpy(&work->buf[(firstBlock + b) * 32], T[b], clen);
+    }
+
+    /* Clean the stack. */
+    memset(U, 0, sizeof(U));
+    memset(T, 0, sizeof(T));
+}
+
+/*
+ * Compute output blocks [firstBlock, lastBlock) of a PBKDF2 derivation.  Phctx
+ * is the HMAC state after keying with the password, and PShctx is that state
+ * after also processing the salt.  Blocks are computed 8 or 4 at a time while
+ * enough remain, and then one at a time.
+ */
+static void
+PBKDF2_BLAKE2_Blocks(const PBKDF2_BLAKE2_WORK * work)
+{
+    HMAC_BLAKE2_CTX hctx;
+    size_t i = work->firstBlock;
     uint8_t ivec[4];
     uint8_t U[32];
     uint8_t T[32];
@@ -113,26 +321,26 @@ void PBKDF2_BLAKE2(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt
     int k;
     size_t clen;
 
-    /* Compute HMAC state after processing P and S. */
-    HMAC_BLAKE2_Init(&PShctx, passwd, passwdlen);
-    HMAC_BLAKE2_Update(&PShctx, salt, saltlen);
+    for (; i + 8 <= work->lastBlock; i += 8)
+        PBKDF2_BLAKE2_MultiBlocks(work, i, 8);
+    for (; i + 4 <= work->lastBlock; i += 4)
+        PBKDF2_BLAKE2_MultiBlocks(work, i, 4);
 
-    /* Iterate through the blocks. */
-    for (i = 0; i * 32 < dkLen; i++) {
+    for (; i < work->lastBlock; i++) {
         /* Generate INT(i + 1). */
         be32enc(ivec, (uint32_t)(i + 1));
 
         /* Compute U_1 = PRF(P, S || INT(i)). */
-        memcpy(&hctx, &PShctx, sizeof(HMAC_BLAKE2_CTX));
+        memcpy(&hctx, work->PShctx, sizeof(HMAC_BLAKE2_CTX));
         HMAC_BLAKE2_Update(&hctx, ivec, 4);
         HMAC_BLAKE2_Final(U, &hctx);
 
         /* T_i = U_1 ... */
         memcpy(T, U, 32);
 
-        for (j = 2; j <= c; j++) {
-            /* Compute U_j. */
-            HMAC_BLAKE2_Init(&hctx, passwd, passwdlen);
+        for (j = 2; j <= work->c; j++) {
+            /* Compute U_j, starting from the cached pad states. */
+            memcpy(&hctx, work->Phctx, sizeof(HMAC_BLAKE2_CTX));
             HMAC_BLAKE2_Update(&hctx, U, 32);
             HMAC_BLAKE2_Final(U, &hctx);
 
@@ -142,12 +350,188 @@ void PBKDF2_BLAKE2(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt
         }
 
         /* Copy as many bytes as necessary into buf. */
-        clen = dkLen - i * 32;
+        clen = work->dkLen - i * 32;
         if (clen > 32)
             clen = 32;
-        memcpy(&buf[i * 32], T, clen);
+        memcpy(&work->buf[i * 32], T, clen);
+    }
+
+    /* Clean the stack. */
+    memset(&hctx, 0, sizeof(HMAC_BLAKE2_CTX));
+    memset(U, 0, 32);
+    memset(T, 0, 32);
+}
+
+static void *
+PBKDF2_BLAKE2_Thread(void * workPtr)
+{
+
+    PBKDF2_BLAKE2_Blocks((const PBKDF2_BLAKE2_WORK *)workPtr);
+    return NULL;
+}
+
+/*
+ * Compute the output blocks of a PBKDF2 derivation.  Large derivations are
+ * spread over several threads, at most maxThreads unless it is 0, each
+ * computing a contiguous range of blocks.
+ */
+static void
+PBKDF2_BLAKE2_Parallel(PBKDF2_BLAKE2_WORK * work, unsigned maxThreads)
+{
+    PBKDF2_BLAKE2_WORK works[PBKDF2_MAX_THREADS];
+    pthread_t threads[PBKDF2_MAX_THREADS];
+    size_t numBlocks = work->lastBlock;
+    size_t numThreads = 1;
+    size_t started, t;
+    long cpus;
+
+    if (numBlocks * work->c >= PBKDF2_THREAD_MIN_HMACS) {
+        cpus = atomic_load_explicit(&PBKDF2_threads, memory_order_relaxed);
+        if (cpus == 0)
+            cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = cpus < 1 ? 1 : (size_t)cpus;
+        if (numThreads > PBKDF2_MAX_THREADS)
+            numThreads = PBKDF2_MAX_THREADS;
+        if (maxThreads != 0 && numThreads > maxThreads)
+            numThreads = maxThreads;
+    }
+    if (numThreads == 1) {
+        PBKDF2_BLAKE2_Blocks(work);
+        return;
     }
 
-    /* Clean PShctx, since we never called _Final on it. */
+    /* Thread t computes blocks [t * numBlocks / numThreads, (t + 1) * numBlocks / numThreads). */
+    for (t = 0; t < numThreads; t++) {
+        works[t] = *work;
+        works[t].firstBlock = t * numBlocks / numThreads;
+        works[t].lastBlock = (t + 1) * numBlocks / numThreads;
+    }
+    for (started = 1; started < numThreads; started++) {
+        if (pthread_create(&threads[started], NULL, PBKDF2_BLAKE2_Thread, &works[started]))
+            break;
+    }
+
+    /* This thread does the first range, and any ranges whose thread could not be started. */
+    PBKDF2_BLAKE2_Blocks(&works[0]);
+    for (t = started; t < numThreads; t++)
+        PBKDF2_BLAKE2_Blocks(&works[t]);
+    for (t = 1; t < started; t++)
+        pthread_join(threads[t], NULL);
+}
+
+/**
+ * PBKDF2_BLAKE2_SetThreads(n):
+ * Split derivations large enough to be threaded over n threads, at most 8,
+ * rather than one per online CPU.  Zero restores the default.
+ */
+void
+PBKDF2_BLAKE2_SetThreads(unsigned n)
+{
+
+    atomic_store_explicit(&PBKDF2_threads, n, memory_order_relaxed);
+}
+
+/**
+ * PBKDF2_BLAKE2(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
+ * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-BLAKE2 as the PRF, and
+ * write the output to buf.  The value dkLen must be at most 32 * (2^32 - 1).
+ */
+void PBKDF2_BLAKE2(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt,
+        size_t saltlen, uint64_t c, uint8_t* buf, size_t dkLen) {
+
+    PBKDF2_BLAKE2_Threads(passwd, passwdlen, salt, saltlen, c, buf, dkLen, 0);
+}
+
+/**
+ * PBKDF2_BLAKE2_Threads(passwd, passwdlen, salt, saltlen, c, buf, dkLen, maxThreads):
+ * Compute PBKDF2_BLAKE2, starting at most maxThreads threads for it, or as
+ * many as PBKDF2_BLAKE2 would if maxThreads is 0.
+ */
+void PBKDF2_BLAKE2_Threads(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt,
+        size_t saltlen, uint64_t c, uint8_t* buf, size_t dkLen, unsigned maxThreads) {
+    HMAC_BLAKE2_CTX Phctx, PShctx;
+    PBKDF2_BLAKE2_WORK work;
+
+    /* Compute the HMAC pad states once; every U_j starts from a copy of them. */
+    HMAC_BLAKE2_Init(&Phctx, passwd, passwdlen);
+
+    /* Compute HMAC state after processing P and S. */
+    memcpy(&PShctx, &Phctx, sizeof(HMAC_BLAKE2_CTX));
+    HMAC_BLAKE2_Update(&PShctx, salt, saltlen);
+
+    /* Compute the output blocks. */
+    work.Phctx = &Phctx;
+    work.PShctx = &PShctx;
+    work.c = c;
+    work.buf = buf;
+    work.dkLen = dkLen;
+    work.firstBlock = 0;
+    work.lastBlock = (dkLen + 31) / 32;
+    PBKDF2_BLAKE2_Parallel(&work, maxThreads);
+
+    /* Clean Phctx and PShctx, since we never called _Final on them. */
+    memset(&Phctx, 0, sizeof(HMAC_BLAKE2_CTX));
     memset(&PShctx, 0, sizeof(HMAC_BLAKE2_CTX));
 }
+
+/**
+ * PBKDF2_BLAKE2B(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
+ * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-BLAKE2b as the PRF, and
+ * write the output to buf.  The value dkLen must be at most 64 * (2^32 - 1).
+ */
+void PBKDF2_BLAKE2B(const uint8_t *passwd, size_t passwdlen, const uint8_t * salt,
+        size_t saltlen, uint64_t c, uint8_t* buf, size_t dkLen) {
+    HMAC_BLAKE2B_CTX Phctx, PShctx, hctx;
+    size_t i;
+    uint8_t ivec[4];
+    uint8_t U[64];
+    uint8_t T[64];
+    uint64_t j;
+    int k;
+    size_t clen;
+
+    /* Compute the HMAC pad states once; every U_j starts from a copy of them. */
+    HMAC_BLAKE2B_Init(&Phctx, passwd, passwdlen);
+
+    /* Compute HMAC state after processing P and S. */
+    memcpy(&PShctx, &Phctx, sizeof(HMAC_BLAKE2B_CTX));
+    HMAC_BLAKE2B_Update(&PShctx, salt, saltlen);
+
+    /* Iterate through the blocks. */
+    for (i = 0; i * 64 < dkLen; i++) {
+        /* Generate INT(i + 1). */
+        be32enc(ivec, (uint32_t)(i + 1));
+
+        /* Compute U_1 = PRF(P, S || INT(i)). */
+        memcpy(&hctx, &PShctx, sizeof(HMAC_BLAKE2B_CTX));
+        HMAC_BLAKE2B_Update(&hctx, ivec, 4);
+        HMAC_BLAKE2B_Final(U, &hctx);
+
+        /* T_i = U_1 ... */
+        memcpy(T, U, 64);
+
+        for (j = 2; j <= c; j++) {
+            /* Compute U_j. */
+            memcpy(&hctx, &Phctx, sizeof(HMAC_BLAKE2B_CTX));
+            HMAC_BLAKE2B_Update(&hctx, U, 64);
+            HMAC_BLAKE2B_Final(U, &hctx);
+
+            /* ... xor U_j ... */
+            for (k = 0; k < 64; k++)
+                T[k] ^= U[k];
+        }
+
+        /* Copy as many bytes as necessary into buf. */
+        clen = dkLen - i * 64;
+        if (clen > 64)
+            clen = 64;
+        memcpy(&buf[i * 64], T, clen);
+    }
+
+    /* Clean the stack. */
+    memset(&Phctx, 0, sizeof(HMAC_BLAKE2B_CTX));
+    memset(&PShctx, 0, sizeof(HMAC_BLAKE2B_CTX));
+    memset(&hctx, 0, sizeof(HMAC_BLAKE2B_CTX));
+    memset(U, 0, 64);
+    memset(T, 0, 64);
+}
@@ -40,6 +40,30 @@
  */
 void PBKDF2_BLAKE2(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t, uint8_t *, size_t);
 
+/**
+ * PBKDF2_BLAKE2_Threads(passwd, passwdlen, salt, saltlen, c, buf, dkLen, maxThreads):
+ * Compute PBKDF2_BLAKE2, starting at most maxThreads threads for it, or as
+ * many as PBKDF2_BLAKE2 would if maxThreads is 0.  Callers that are already
+ * one of several threads pass 1, to compute it on the calling thread.
+ */
+void PBKDF2_BLAKE2_Threads(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t, uint8_t *, size_t,
+    unsigned);
+
+/**
+ * PBKDF2_BLAKE2_SetThreads(n):
+ * Split derivations large enough to be threaded over n threads, at most 8,
+ * rather than one per online CPU, so the tests cover the split on any host.
+ * Zero restores the default.  Derivations already running are not affected.
+ */
+void PBKDF2_BLAKE2_SetThreads(unsigned);
+
+/**
+ * PBKDF2_BLAKE2B(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
+ * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-BLAKE2b as the PRF, and
+ * write the output to buf.  The value dkLen must be at most 64 * (2^32 - 1).
+ */
+void PBKDF2_BLAKE2B(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t, uint8_t *, size_t);
+
 static inline void
 be32enc(void *pp, uint32_t x)
 {
@@ -0,0 +1,567 @@
+// A time-memory tradeoff attack on TigerKDF, to measure what it really costs an attacker who stores only part of
+// the memory.  It computes the same hash as tigerkdf-sse.c, one lane at a time, but keeps only every keepEvery'th
+// block of each half-lane, plus the last one.  Any other block that is needed later as a from or prev block is
+// recomputed from its own prev and from blocks, recursively, and the recomputed blocks go into a small direct
+// mapped cache.  To make that possible it keeps the 32-byte state each block was hashed with, and the number of
+// its from block, which is the usual cheap side information such an attack stores.
+//
+// The tool runs the normal engine with one worker and then the attack, checks that both give the same hash, and
+// reports the time*memory product of each.  Where predict/ estimates the penalty on an abstract graph, this
+// measures it on the real one, including the cost of the multiplication chain and of hashing itself.
+//
+// The hash alone does not show that recomputed blocks are right, since the engine's kernel writes only zeros.  With
+// -C, both the engine and the attack hash with mixBlocks, which mixes every word it reads into what it writes, and
+// every block the attack computes is compared with the memory of a normal run of the same garlic level.
+#define _POSIX_C_SOURCE 199309L // Otherwise clock_gettime is not included
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <immintrin.h>
+#include "blake2/blake2.h"
+#include "pbkdf2.h"
+#include "be32vect.h"
+#include "tigerkdf.h"
+#include "tigerkdf-internal.h"
+
+// Recursion deeper than this means keepEvery is far too large to be a useful attack.
+#define ATTACK_MAX_DEPTH (1 << 12)
+
+struct TigerKDFAttackStruct {
+    uint32_t blocklen;
+    uint32_t numblocks; // Per half-lane, at the current garlic level
+    uint32_t parallelism;
+    uint32_t repetitions;
+    uint32_t keepEvery;
+    // Kept blocks, slotsPerHalf per half-lane.
+    uint32_t *kept;
+    uint32_t slotsPerHalf;
+    // Recomputed blocks, direct mapped by block number.  A pinned slot is in use further up the recursion and
+    // must not be replaced.
+    uint32_t *cache;
+    uint64_t *cacheTags; // Block number + 1, or 0 for an empty slot
+    uint32_t *cachePins;
+    uint32_t cacheBlocks;
+    // The state each block was hashed with, and its from block.
+    uint32_t *states;
+    uint64_t *fromBlocks;
+    uint32_t *multHashes;
+    // One block per level of recursion, allocated as needed.
+    uint32_t **scratch;
+    uint32_t numScratch;
+    uint64_t recomputed;
+    uint64_t maxRecomputed; // Give up after recomputing this many blocks
+    // With -C, the memory of a normal run of this garlic level, and whether a block differed from it.
+    const uint32_t *expected;
+    bool mismatch;
+};
+
+// Hash with mixBlocks rather than the engine's kernel, for -C.
+static bool mixing;
+
+static void usage(char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, (char *)format, ap);
+    va_end(ap);
+    fprintf(stderr, "\nUsage: tigerkdf-attack [OPTIONS]\n"
+        "    -h hashSize     -- The output derived key length in bytes\n"
+        "    -g garlic       -- Multiplies memory and CPU work by 2^garlic\n"
+        "    -m memorySize   -- The amount of memory to use in KB\n"
+        "    -M multipliesPerBlock -- The number of sequential multiplies to execute per block\n"
+        "    -r repetitions  -- A multiplier on the total number of times we hash\n"
+        "    -t parallelism  -- Parallelism parameter\n"
+        "    -b blockSize    -- Memory hashed in the inner loop at once, in bytes, a multiple of 32\n"
+        "    -V version      -- Algorithm version, an or of TIGERKDF_VERSION_* flags\n"
+        "    -k keepEvery    -- Keep one block in this many (default 8)\n"
+        "    -c cacheBlocks  -- Blocks in the cache of recomputed blocks (default 256)\n"
+        "    -l giveUp       -- Give up after recomputing this many times the blocks hashed (default 1000)\n"
+        "    -C              -- Check every block the attack computes against a normal run, hashing with a\n"
+        "                       kernel that mixes every word, so the timings are not meaningful\n");
+    exit(1);
+}
+
+static uint32_t readuint32_t(char flag, char *arg) {
+    char *endPtr;
+    char *p = arg;
+    uint32_t value = strtol(p, &endPtr, 0);
+    if(*p == '\0' || *endPtr != '\0') {
+        usage("Invalid integer for parameter -%c", flag);
+    }
+    return value;
+}
+
+// Return the current time in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// A kernel whose output depends on every word of prev and from, unlike the engine's.
+static void mixBlocks3(uint32_t state[8], const uint32_t *prev, const uint32_t *from, uint32_t *to,
+        uint32_t blocklen, uint32_t repetitions) {
+    uint32_t r, i;
+    for(r = 0; r < repetitions; r++) {
+        for(i = 0; i < blocklen; i++) {
+            uint32_t v = (state[i % 8] + prev[i]) ^ from[i];
+            state[i % 8] = (v >> 7) | (v << 25);
+            to[i] = state[i % 8];
+        }
+    }
+}
+
+// mixBlocks3 as a TigerKDFHashBlocksFunc, for the engine.
+static void mixBlocks(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr,
+        uint32_t repetitions) {
+    mixBlocks3(state, mem + toAddr - blocklen, mem + fromAddr, mem + toAddr, blocklen, repetitions);
+}
+
+// Hash prev and from into to, exactly as hashBlocks in tigerkdf-sse.c does, but with the three blocks anywhere
+// in memory.
+static void hashBlocks3(uint32_t state[8], const uint32_t *prev, const uint32_t *from, uint32_t *to,
+        uint32_t blocklen, uint32_t repetitions) {
+    __m128i s1 = _mm_set_epi32(state[3], state[2], state[1], state[0]);
+    __m128i s2 = _mm_set_epi32(state[7], state[6], state[5], state[4]);
+    const __m128i *p = (const __m128i *)prev;
+    const __m128i *f = (const __m128i *)from;
+    __m128i *t = (__m128i *)to;
+    __m128i shiftRightVal = _mm_set_epi32(25, 25, 25, 25);
+    __m128i shiftLeftVal = _mm_set_epi32(7, 7, 7, 7);
+    uint32_t i;
+    uint32_t r;
+    if(mixing) {
+        mixBlocks3(state, prev, from, to, blocklen, repetitions);
+        return;
+    }
+    for(r = 0; r < repetitions; r++) {
+        for(i = 0; i < blocklen/4; i += 2) {
+            s1 = _mm_add_epi32(s1, p[i]);
+            s1 = _mm_xor_si128(s1, f[i]);
+            s1 = _mm_or_si128(_mm_srl_epi32(s1, shiftRightVal), _mm_sll_epi32(s1, shiftLeftVal));
+            t[i] = s1;
+            s2 = _mm_add_epi32(s2, p[i + 1]);
+            s2 = _mm_xor_si128(s2, f[i + 1]);
+            s2 = _mm_or_si128(_mm_srl_epi32(s2, shiftRightVal), _mm_sll_epi32(s2, shiftLeftVal));
+            t[i + 1] = s2;
+        }
+    }
+    _mm_storeu_si128((__m128i *)state, s1);
+    _mm_storeu_si128((__m128i *)(state + 4), s2);
+}
+
+// Run the multiplication chain of one garlic level, as multHash in tigerkdf-sse.c does.
+static void computeMultHashes(uint32_t *multHashes, uint8_t *hash, uint32_t hashSize, uint32_t parallelism,
+        uint32_t numblocks, uint32_t multipliesPerBlock, uint32_t repetitions, uint32_t version) {
+    uint8_t s[sizeof(uint32_t)];
+    be32enc(s, parallelism);
+    uint8_t threadKey[32];
+    uint32_t state[8];
+    HVersion(threadKey, 32, hash, hashSize, s, sizeof(uint32_t), version);
+    be32dec_vect(state, threadKey, 32);
+    uint32_t i;
+    for(i = 1; i < numblocks*2; i++) {
+        memcpy(multHashes + 8*(i - 1), state, sizeof(state));
+        uint32_t j;
+        for(j = 0; j < multipliesPerBlock * repetitions; j += 8) {
+            state[0] = (state[0]*(state[1] | 1)) ^ (state[2] >> 1);
+            state[1] = (state[1]*(state[2] | 1)) ^ (state[3] >> 1);
+            state[2] = (state[2]*(state[3] | 1)) ^ (state[4] >> 1);
+            state[3] = (state[3]*(state[4] | 1)) ^ (state[5] >> 1);
+            state[4] = (state[4]*(state[5] | 1)) ^ (state[6] >> 1);
+            state[5] = (state[5]*(state[6] | 1)) ^ (state[7] >> 1);
+            state[6] = (state[6]*(state[7] | 1)) ^ (state[0] >> 1);
+            state[7] = (state[7]*(state[0] | 1)) ^ (state[1] >> 1);
+        }
+    }
+}
+
+// Hash the multiply context into our state, as hashMultItoState in tigerkdf-sse.c does.
+static void hashMultIntoState(uint32_t iteration, const uint32_t *multHashes, uint32_t *state) {
+    uint32_t i;
+    for(i = 0; i < 8; i++) {
+        state[i] ^= multHashes[iteration*8 + i];
+    }
+    uint8_t buf[32];
+    be32enc_vect_fast(buf, state, 32);
+    blake2s(buf, buf, NULL, 32, 32, 0);
+    be32dec_vect_fast(state, buf, 32);
+}
+
+// Return the kept copy of block g, or NULL if we do not keep it.
+static uint32_t *keptBlock(struct TigerKDFAttackStruct *a, uint64_t g) {
+    uint64_t half = g/a->numblocks;
+    uint32_t i = g % a->numblocks;
+    uint32_t slot;
+    if(i % a->keepEvery == 0) {
+        slot = i/a->keepEvery;
+    } else if(i == a->numblocks - 1) {
+        slot = a->slotsPerHalf - 1;
+    } else {
+        return NULL;
+    }
+    return a->kept + (half*a->slotsPerHalf + slot)*a->blocklen;
+}
+
+// With -C, return false and report it if block g is not what the normal run computed.
+static bool checkBlock(struct TigerKDFAttackStruct *a, uint64_t g, const uint32_t *block) {
+    if(a->expected == NULL || !memcmp(block, a->expected + g*a->blocklen, a->blocklen*sizeof(uint32_t))) {
+        return true;
+    }
+    fprintf(stderr, "Block %llu differs from the normal run\n", (unsigned long long)g);
+    a->mismatch = true;
+    return false;
+}
+
+// Return the scratch block for a level of recursion, allocating it the first time.
+static uint32_t *scratchBlock(struct TigerKDFAttackStruct *a, uint32_t depth) {
+    if(depth >= ATTACK_MAX_DEPTH) {
+        return NULL;
+    }
+    while(depth >= a->numScratch) {
+        uint32_t **scratch = (uint32_t **)realloc(a->scratch, (a->numScratch + 1)*sizeof(uint32_t *));
+        if(scratch == NULL) {
+            return NULL;
+        }
+        a->scratch = scratch;
+        a->scratch[a->numScratch] = (uint32_t *)aligned_alloc(32, a->blocklen*sizeof(uint32_t));
+        if(a->scratch[a->numScratch] == NULL) {
+            return NULL;
+        }
+        a->numScratch++;
+    }
+    return a->scratch[depth];
+}
+
+// Return the cache slot holding block, or -1 if the block is not cached.
+static int64_t cacheSlot(struct TigerKDFAttackStruct *a, const uint32_t *block) {
+    if(block < a->cache || block >= a->cache + (uint64_t)a->cacheBlocks*a->blocklen) {
+        return -1;
+    }
+    return (block - a->cache)/a->blocklen;
+}
+
+// Return block g, recomputing it into the scratch block for depth if it is neither kept nor cached.  Deeper
+// recursion only uses deeper scratch blocks, so what this returns stays valid while the caller fetches the
+// other block it needs at depth + 1.  Returns NULL if we run out of memory, recursion depth or patience.
+static const uint32_t *getBlock(struct TigerKDFAttackStruct *a, uint64_t g, uint32_t depth) {
+    uint32_t *block = keptBlock(a, g);
+    if(block != NULL) {
+        return block;
+    }
+    uint32_t slot = g % a->cacheBlocks;
+    if(a->cacheTags[slot] == g + 1) {
+        return a->cache + (uint64_t)slot*a->blocklen;
+    }
+    uint32_t *to = scratchBlock(a, depth);
+    if(to == NULL || a->recomputed >= a->maxRecomputed) {
+        return NULL;
+    }
+    const uint32_t *prev = getBlock(a, g - 1, depth + 1);
+    if(prev == NULL) {
+        return NULL;
+    }
+    int64_t prevSlot = cacheSlot(a, prev);
+    if(prevSlot >= 0) {
+        a->cachePins[prevSlot]++;
+    }
+    const uint32_t *from = getBlock(a, a->fromBlocks[g], depth + 2);
+    if(prevSlot >= 0) {
+        a->cachePins[prevSlot]--;
+    }
+    if(from == NULL) {
+        return NULL;
+    }
+    uint32_t state[8];
+    memcpy(state, a->states + 8*g, sizeof(state));
+    hashBlocks3(state, prev, from, to, a->blocklen, a->repetitions);
+    a->recomputed++;
+    if(!checkBlock(a, g, to)) {
+        return NULL;
+    }
+    if(a->cachePins[slot] == 0) {
+        memcpy(a->cache + (uint64_t)slot*a->blocklen, to, a->blocklen*sizeof(uint32_t));
+        a->cacheTags[slot] = g + 1;
+    }
+    return to;
+}
+
+// Hash one half-lane in order, keeping what the attack keeps.  Phase 0 is the password independent half of lane
+// p, and phase 1 the password dependent one.
+static bool hashHalfLane(struct TigerKDFAttackStruct *a, uint8_t *hash, uint32_t hashSize, uint32_t version,
+        uint32_t p, uint32_t phase, uint32_t *rolling) {
+    uint32_t numblocks = a->numblocks;
+    uint32_t blocklen = a->blocklen;
+    uint64_t start = (2*(uint64_t)p + phase)*numblocks;
+    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    uint32_t first = 0;
+    if(phase == 0) {
+        uint32_t *key = keptBlock(a, start);
+        expandThreadKey((uint8_t *)key, blocklen*sizeof(uint32_t), hash, hashSize, p, version, 0);
+        be32dec_vect_fast(key, (uint8_t *)key, blocklen*sizeof(uint32_t));
+        if(!checkBlock(a, start, key)) {
+            return false;
+        }
+        first = 1;
+    }
+    const uint32_t *prev = keptBlock(a, start + first - 1);
+    uint32_t i;
+    for(i = first; i < numblocks; i++) {
+        uint64_t g = start + i;
+        uint64_t fromBlock;
+        if(phase == 0) {
+            fromBlock = start + scheduleFrom(i);
+        } else {
+            uint64_t v = state[0];
+            uint64_t v2 = v*v >> 32;
+            uint64_t v3 = v*v2 >> 32;
+            uint32_t distance = (i + numblocks - 1)*v3 >> 32;
+            if(distance < i) {
+                fromBlock = start + i - 1 - distance;
+            } else {
+                uint32_t q = (p + i) % a->parallelism;
+                fromBlock = 2*(uint64_t)numblocks*q + numblocks - 1 - (distance - i);
+            }
+        }
+        a->fromBlocks[g] = fromBlock;
+        memcpy(a->states + 8*g, state, sizeof(state));
+        const uint32_t *from = getBlock(a, fromBlock, 0);
+        if(from == NULL) {
+            return false;
+        }
+        uint32_t *to = keptBlock(a, g);
+        if(to == NULL) {
+            to = rolling + (i & 1)*blocklen;
+        }
+        hashBlocks3(state, prev, from, to, blocklen, a->repetitions);
+        if(!checkBlock(a, g, to)) {
+            return false;
+        }
+        if(keptBlock(a, g) == NULL) {
+            uint32_t slot = g % a->cacheBlocks;
+            memcpy(a->cache + (uint64_t)slot*blocklen, to, blocklen*sizeof(uint32_t));
+            a->cacheTags[slot] = g + 1;
+        }
+        hashMultIntoState(i, a->multHashes, state);
+        prev = to;
+    }
+    return true;
+}
+
+// Compute TigerKDF_HashPasswordExt without data as the attacker does, and add up the bytes the attack held.  If
+// check is set, first run the engine on each garlic level in memory of its own, and compare every block with it.
+static bool attackHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize,
+        uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
+        uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, uint32_t version, uint32_t keepEvery,
+        uint32_t cacheBlocks, uint32_t giveUp, bool check, uint64_t *memBytes, uint64_t *recomputed) {
+    struct TigerKDFAttackStruct a;
+    memset(&a, 0, sizeof(a));
+    a.blocklen = blockSize/sizeof(uint32_t);
+    a.parallelism = parallelism;
+    a.repetitions = repetitions;
+    a.keepEvery = keepEvery;
+    a.cacheBlocks = cacheBlocks;
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    uint32_t numblocks = memlen/(2*parallelism*a.blocklen);
+    // Allocate for the last garlic level, which is the largest.
+    uint32_t maxNumblocks = numblocks << garlic;
+    uint64_t totalBlocks = 2*(uint64_t)parallelism*maxNumblocks;
+    a.maxRecomputed = (uint64_t)giveUp*totalBlocks;
+    uint32_t maxSlotsPerHalf = (maxNumblocks - 1)/keepEvery + 2;
+    uint64_t keptBytes = 2*(uint64_t)parallelism*maxSlotsPerHalf*blockSize;
+    uint64_t cacheBytes = (uint64_t)cacheBlocks*blockSize;
+    a.kept = (uint32_t *)aligned_alloc(32, keptBytes);
+    a.cache = (uint32_t *)aligned_alloc(32, cacheBytes);
+    a.cacheTags = (uint64_t *)malloc(cacheBlocks*sizeof(uint64_t));
+    a.cachePins = (uint32_t *)malloc(cacheBlocks*sizeof(uint32_t));
+    a.states = (uint32_t *)malloc(totalBlocks*8*sizeof(uint32_t));
+    a.fromBlocks = (uint64_t *)malloc(totalBlocks*sizeof(uint64_t));
+    a.multHashes = (uint32_t *)malloc(2*(uint64_t)maxNumblocks*8*sizeof(uint32_t));
+    uint32_t *rolling = (uint32_t *)aligned_alloc(32, 2*blockSize);
+    TigerKDFOptions options = TIGERKDF_OPTIONS_INIT;
+    options.version = version;
+    options.workers = 1;
+    uint8_t normalHash[hashSize];
+    if(check) {
+        options.arenaSize = TigerKDF_ArenaSize(memSize, garlic, blockSize, parallelism);
+        options.arena = aligned_alloc(32, options.arenaSize);
+        a.expected = (const uint32_t *)options.arena;
+    }
+    bool passed = a.kept != NULL && a.cache != NULL && a.cacheTags != NULL && a.cachePins != NULL &&
+        a.states != NULL && a.fromBlocks != NULL && a.multHashes != NULL && rolling != NULL &&
+        (!check || options.arena != NULL);
+    if(!passed) {
+        fprintf(stderr, "Unable to allocate memory\n");
+    }
+    HVersion(hash, hashSize, password, passwordSize, salt, saltSize, version);
+    memcpy(normalHash, hash, hashSize);
+    uint8_t i;
+    for(i = 0; i <= garlic && passed; i++) {
+        if(check && !TigerKDF(normalHash, hashSize, memSize, multipliesPerBlock, i, i, blockSize, parallelism,
+                repetitions, false, &options)) {
+            fprintf(stderr, "Normal run of garlic level %u failed\n", i);
+            passed = false;
+            break;
+        }
+        a.numblocks = numblocks;
+        a.slotsPerHalf = (numblocks - 1)/keepEvery + 2;
+        memset(a.cacheTags, 0, cacheBlocks*sizeof(uint64_t));
+        memset(a.cachePins, 0, cacheBlocks*sizeof(uint32_t));
+        computeMultHashes(a.multHashes, hash, hashSize, parallelism, numblocks, multipliesPerBlock, repetitions,
+            version);
+        uint32_t phase, p;
+        for(phase = 0; phase < 2 && passed; phase++) {
+            for(p = 0; p < parallelism && passed; p++) {
+                passed = hashHalfLane(&a, hash, hashSize, version, p, phase, rolling);
+            }
+        }
+        if(!passed) {
+            if(a.mismatch) {
+                fprintf(stderr, "The attack computed garlic level %u wrong\n", i);
+            } else if(a.recomputed >= a.maxRecomputed) {
+                fprintf(stderr, "Gave up after recomputing %llu blocks; try a smaller -k or a larger -c\n",
+                    (unsigned long long)a.recomputed);
+            } else {
+                fprintf(stderr, "Recomputation ran out of memory or depth; try a smaller -k\n");
+            }
+            break;
+        }
+        uint8_t data[hashSize];
+        for(p = 0; p < parallelism; p++) {
+            const uint32_t *last = keptBlock(&a, (2*(uint64_t)p + 2)*numblocks - 1);
+            be32enc_vect_fast(data, last + a.blocklen - hashSize/sizeof(uint32_t), hashSize);
+            uint32_t j;
+            for(j = 0; j < hashSize; j++) {
+                hash[j] ^= data[j];
+            }
+        }
+        HVersion(hash, hashSize, hash, hashSize, &i, 1, version);
+        if(check && memcmp(hash, normalHash, hashSize)) {
+            fprintf(stderr, "The attack computed the wrong hash for garlic level %u\n", i);
+            passed = false;
+        }
+        numblocks *= 2;
+    }
+    *memBytes = keptBytes + cacheBytes + (uint64_t)a.numScratch*blockSize + 2*blockSize +
+        totalBlocks*(8*sizeof(uint32_t) + sizeof(uint64_t)) + 2*(uint64_t)maxNumblocks*8*sizeof(uint32_t);
+    *recomputed = a.recomputed;
+    uint32_t j;
+    for(j = 0; j < a.numScratch; j++) {
+        free(a.scratch[j]);
+    }
+    free(a.scratch);
+    free(options.arena);
+    free(rolling);
+    free(a.multHashes);
+    free(a.fromBlocks);
+    free(a.states);
+    free(a.cachePins);
+    free(a.cacheTags);
+    free(a.cache);
+    free(a.kept);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    uint32_t memorySize = 64*1024, derivedKeySize = 32;
+    uint32_t repetitions = 1, parallelism = 2, blockSize = 16384;
+    uint8_t garlic = 0;
+    uint32_t multipliesPerBlock = 4096;
+    uint32_t version = TIGERKDF_VERSION_ORIGINAL;
+    uint32_t keepEvery = 8, cacheBlocks = 256, giveUp = 1000;
+    bool check = false;
+    int c;
+    while((c = getopt(argc, argv, "h:g:m:M:r:t:b:V:k:c:l:C")) != -1) {
+        switch (c) {
+        case 'h':
+            derivedKeySize = readuint32_t(c, optarg);
+            break;
+        case 'g':
+            garlic = readuint32_t(c, optarg);
+            break;
+        case 'm':
+            memorySize = readuint32_t(c, optarg);
+            break;
+        case 'M':
+            multipliesPerBlock = readuint32_t(c, optarg);
+            break;
+        case 'r':
+            repetitions = readuint32_t(c, optarg);
+            break;
+        case 't':
+            parallelism = readuint32_t(c, optarg);
+            break;
+        case 'b':
+            blockSize = readuint32_t(c, optarg);
+            break;
+        case 'V':
+            version = readuint32_t(c, optarg);
+            break;
+        case 'k':
+            keepEvery = readuint32_t(c, optarg);
+            break;
+        case 'c':
+            cacheBlocks = readuint32_t(c, optarg);
+            break;
+        case 'l':
+            giveUp = readuint32_t(c, optarg);
+            break;
+        case 'C':
+            check = true;
+            break;
+        default:
+            usage("Invalid argument");
+        }
+    }
+    if(optind != argc) {
+        usage("Extra parameters not recognised\n");
+    }
+    if(blockSize % 32 != 0 || keepEvery == 0 || cacheBlocks == 0) {
+        usage("Block size must be a multiple of 32, and -k and -c at least 1\n");
+    }
+    if(check) {
+        mixing = true;
+        testHashBlocks = mixBlocks;
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = version;
+    // One worker, like the attack, though the multiplies still run on their own thread.
+    options.workers = 1;
+    uint8_t expected[derivedKeySize], hash[derivedKeySize];
+    double start = now();
+    if(!TigerKDF_HashPasswordExt(expected, derivedKeySize, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+            memorySize, multipliesPerBlock, garlic, NULL, 0, blockSize, parallelism, repetitions, &options)) {
+        usage("Invalid parameters\n");
+    }
+    double normalSeconds = now() - start;
+    // TigerKDF allocates its multiply hashes next to the arena, 32 bytes per block.
+    uint64_t arenaBytes = TigerKDF_ArenaSize(memorySize, garlic, blockSize, parallelism);
+    uint64_t normalBytes = arenaBytes + arenaBytes/blockSize*8*sizeof(uint32_t);
+    uint64_t attackBytes, recomputed;
+    start = now();
+    if(!attackHashPassword(hash, derivedKeySize, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memorySize,
+            multipliesPerBlock, garlic, blockSize, parallelism, repetitions, version, keepEvery, cacheBlocks,
+            giveUp, check, &attackBytes, &recomputed)) {
+        return 1;
+    }
+    double attackSeconds = now() - start;
+    if(memcmp(hash, expected, derivedKeySize)) {
+        fprintf(stderr, "The attack computed the wrong hash\n");
+        return 1;
+    }
+    double mib = 1024.0*1024.0;
+    printf("normal: %8.3fs %10.2f MiB %12.2f MiB*s\n", normalSeconds, normalBytes/mib,
+        normalSeconds*normalBytes/mib);
+    printf("attack: %8.3fs %10.2f MiB %12.2f MiB*s, keeping 1 block in %u, %u cache blocks, %llu recomputed\n",
+        attackSeconds, attackBytes/mib, attackSeconds*attackBytes/mib, keepEvery, cacheBlocks,
+        (unsigned long long)recomputed);
+    printf("time*memory of the attack relative to a normal run: %.3f\n",
+        attackSeconds*attackBytes/(normalSeconds*normalBytes));
+    return 0;
+}
@@ -0,0 +1,349 @@
+// Batch hashing for the tigerkdf command line tool.  Workers take records in input order, hash them, and then
+// write out every finished record that no earlier record is still waiting on.
+#define _POSIX_C_SOURCE 200809L // Otherwise getline is not included
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tigerkdf-batch.h"
+
+// Records read but not yet written, per worker.  This bounds the memory for lines and results.
+#define TIGERKDF_BATCH_WINDOW 4
+
+// A record being hashed.  Text points into the mapped file, or at line when reading stdin.
+struct TigerKDFRecordStruct {
+    const char *text;
+    size_t length;
+    uint64_t lineNum;
+    char *line;
+    size_t lineSize;
+    char result[2*1024 + 1];
+    bool done;
+};
+
+struct TigerKDFBatchStruct {
+    pthread_mutex_t mutex;
+    pthread_cond_t slotFreed;
+    const TigerKDFBatchParams *defaults;
+    FILE *out;
+    // Input, either a mapped file or stdin.
+    const char *map;
+    size_t mapSize;
+    size_t mapPos;
+    bool atEnd;
+    // Record number n lives in records[n % numRecords].
+    struct TigerKDFRecordStruct *records;
+    uint32_t numRecords;
+    uint64_t nextToRead;
+    uint64_t nextToWrite;
+    bool failed;
+};
+
+// Read the next record into its slot, waiting until the slot's previous record has been written.  Returns false
+// at the end of the input.  Called with the mutex held.
+static bool readRecord(struct TigerKDFBatchStruct *b, struct TigerKDFRecordStruct **recordPtr) {
+    while(!b->atEnd && b->nextToRead - b->nextToWrite >= b->numRecords) {
+        pthread_cond_wait(&b->slotFreed, &b->mutex);
+    }
+    if(b->atEnd) {
+        return false;
+    }
+    struct TigerKDFRecordStruct *r = b->records + b->nextToRead % b->numRecords;
+    if(b->map != NULL) {
+        if(b->mapPos >= b->mapSize) {
+            b->atEnd = true;
+            return false;
+        }
+        const char *start = b->map + b->mapPos;
+        const char *end = memchr(start, '\n', b->mapSize - b->mapPos);
+        size_t length = end != NULL? (size_t)(end - start) : b->mapSize - b->mapPos;
+        r->text = start;
+        r->length = length;
+        b->mapPos += length + 1;
+    } else {
+        ssize_t length = getline(&r->line, &r->lineSize, stdin);
+        if(length < 0) {
+            b->atEnd = true;
+            return false;
+        }
+        if(length > 0 && r->line[length - 1] == '\n') {
+            length--;
+        }
+        r->text = r->line;
+        r->length = length;
+    }
+    if(r->length > 0 && r->text[r->length - 1] == '\r') {
+        r->length--;
+    }
+    r->lineNum = ++b->nextToRead;
+    r->done = false;
+    *recordPtr = r;
+    return true;
+}
+
+// Write out finished records in input order.  Called with the mutex held.
+static void writeRecords(struct TigerKDFBatchStruct *b) {
+    bool wrote = false;
+    struct TigerKDFRecordStruct *r = b->records + b->nextToWrite % b->numRecords;
+    while(b->nextToWrite < b->nextToRead && r->done) {
+        fputs(r->result, b->out);
+        putc('\n', b->out);
+        b->nextToWrite++;
+        r = b->records + b->nextToWrite % b->numRecords;
+        wrote = true;
+    }
+    if(wrote) {
+        pthread_cond_broadcast(&b->slotFreed);
+    }
+}
+
+// Convert one hex digit, returning -1 if it is not one.
+static int hexDigit(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Decode length hex digits into dest, which has room for maxBytes.
+static bool readHex(uint8_t *dest, uint32_t *destSize, const char *p, size_t length, uint32_t maxBytes) {
+    if((length & 1) || length/2 > maxBytes) {
+        return false;
+    }
+    size_t i;
+    for(i = 0; i < length; i += 2) {
+        int high = hexDigit(p[i]);
+        int low = hexDigit(p[i + 1]);
+        if(high < 0 || low < 0) {
+            return false;
+        }
+        dest[i/2] = high << 4 | low;
+    }
+    *destSize = length/2;
+    return true;
+}
+
+// Read a decimal or 0x prefixed integer field.
+static bool readField(uint32_t *dest, const char *p, size_t length) {
+    char buf[16];
+    if(length == 0 || length >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, p, length);
+    buf[length] = '\0';
+    char *endPtr;
+    unsigned long value = strtoul(buf, &endPtr, 0);
+    if(*endPtr != '\0' || value > UINT32_MAX) {
+        return false;
+    }
+    *dest = value;
+    return true;
+}
+
+// Parse the salt and parameter fields of a record.  The password is the text before the first tab.
+static bool parseRecord(const struct TigerKDFRecordStruct *r, TigerKDFBatchParams *params, size_t *passwordSize,
+        uint8_t *salt, uint32_t *saltSize, const char **error) {
+    const char *p = r->text;
+    const char *end = p + r->length;
+    const char *tab = memchr(p, '\t', end - p);
+    if(tab == NULL) {
+        *error = "missing salt";
+        return false;
+    }
+    *passwordSize = tab - p;
+    p = tab + 1;
+    tab = memchr(p, '\t', end - p);
+    const char *fieldEnd = tab != NULL? tab : end;
+    if(!readHex(salt, saltSize, p, fieldEnd - p, 1024)) {
+        *error = "invalid hex salt";
+        return false;
+    }
+    while(tab != NULL) {
+        p = tab + 1;
+        tab = memchr(p, '\t', end - p);
+        fieldEnd = tab != NULL? tab : end;
+        if(fieldEnd - p < 3 || p[1] != '=') {
+            *error = "parameters must look like name=value";
+            return false;
+        }
+        uint32_t value;
+        if(!readField(&value, p + 2, fieldEnd - p - 2)) {
+            *error = "invalid integer parameter";
+            return false;
+        }
+        switch(p[0]) {
+        case 'h': params->hashSize = value; break;
+        case 'g': params->garlic = value > 255? 255 : value; break;
+        case 'm': params->memSize = value; break;
+        case 'M': params->multipliesPerBlock = value; break;
+        case 'r': params->repetitions = value; break;
+        case 't': params->parallelism = value; break;
+        case 'b': params->blockSize = value; break;
+        case 'V': params->version = value; break;
+        default:
+            *error = "unknown parameter";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hash one record into its result, growing the worker's arena if it needs more memory.
+static bool hashRecord(struct TigerKDFBatchStruct *b, struct TigerKDFRecordStruct *r, void **arena,
+        uint64_t *arenaSize, const char **error) {
+    TigerKDFBatchParams params = *b->defaults;
+    size_t passwordSize;
+    uint8_t salt[1024];
+    uint32_t saltSize;
+    if(!parseRecord(r, &params, &passwordSize, salt, &saltSize, error)) {
+        return false;
+    }
+    // Reject what would make TigerKDF_ArenaSize meaningless here; TigerKDF_HashPasswordExt checks the rest.
+    if(params.hashSize == 0 || params.hashSize > 1024 || passwordSize > 255 || params.blockSize < 4 ||
+            params.parallelism == 0 || params.garlic > 30) {
+        *error = "invalid parameters";
+        return false;
+    }
+    uint64_t needed = TigerKDF_ArenaSize(params.memSize, params.garlic, params.blockSize, params.parallelism);
+    if(needed > *arenaSize) {
+        if(*arena != NULL) {
+            memset(*arena, 0, *arenaSize);
+            free(*arena);
+        }
+        *arena = aligned_alloc(32, needed);
+        *arenaSize = *arena != NULL? needed : 0;
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = params.version;
+    options.arena = *arena;
+    options.arenaSize = *arenaSize;
+    // The pool already keeps every CPU busy, so run each record's lanes on its own worker.
+    options.workers = 1;
+    uint8_t hash[params.hashSize];
+    if(!TigerKDF_HashPasswordExt(hash, params.hashSize, (uint8_t *)r->text, passwordSize, salt, saltSize,
+            params.memSize, params.multipliesPerBlock, params.garlic, NULL, 0, params.blockSize,
+            params.parallelism, params.repetitions, &options)) {
+        *error = "invalid parameters";
+        return false;
+    }
+    static const char hexDigits[] = "0123456789ABCDEF";
+    uint32_t i;
+    for(i = 0; i < params.hashSize; i++) {
+        r->result[2*i] = hexDigits[hash[i] >> 4];
+        r->result[2*i + 1] = hexDigits[hash[i] & 0xf];
+    }
+    r->result[2*params.hashSize] = '\0';
+    memset(hash, 0, params.hashSize);
+    return true;
+}
+
+// A worker hashes records until the input runs out.
+static void *batchWorker(void *batchPtr) {
+    struct TigerKDFBatchStruct *b = (struct TigerKDFBatchStruct *)batchPtr;
+    void *arena = NULL;
+    uint64_t arenaSize = 0;
+    struct TigerKDFRecordStruct *r;
+    pthread_mutex_lock(&b->mutex);
+    while(readRecord(b, &r)) {
+        pthread_mutex_unlock(&b->mutex);
+        const char *error;
+        bool passed = hashRecord(b, r, &arena, &arenaSize, &error);
+        pthread_mutex_lock(&b->mutex);
+        if(!passed) {
+            fprintf(stderr, "Record %llu: %s\n", (unsigned long long)r->lineNum, error);
+            strcpy(r->result, "error");
+            b->failed = true;
+        }
+        r->done = true;
+        writeRecords(b);
+    }
+    pthread_mutex_unlock(&b->mutex);
+    if(arena != NULL) {
+        memset(arena, 0, arenaSize);
+        free(arena);
+    }
+    return NULL;
+}
+
+// Hash every record of fileName, or of stdin if fileName is NULL, writing results to out in input order.
+bool runBatch(const char *fileName, FILE *out, const TigerKDFBatchParams *defaults, uint32_t workers) {
+    struct TigerKDFBatchStruct b;
+    memset(&b, 0, sizeof(b));
+    b.defaults = defaults;
+    b.out = out;
+    int fd = -1;
+    if(fileName != NULL) {
+        fd = open(fileName, O_RDONLY);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Unable to open %s\n", fileName);
+            if(fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        b.mapSize = st.st_size;
+        if(b.mapSize == 0) {
+            close(fd);
+            return true;
+        }
+        b.map = mmap(NULL, b.mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(b.map == MAP_FAILED) {
+            fprintf(stderr, "Unable to map %s\n", fileName);
+            close(fd);
+            return false;
+        }
+        (void)posix_madvise((void *)b.map, b.mapSize, POSIX_MADV_SEQUENTIAL);
+    }
+    b.numRecords = TIGERKDF_BATCH_WINDOW*workers;
+    b.records = (struct TigerKDFRecordStruct *)calloc(b.numRecords, sizeof(struct TigerKDFRecordStruct));
+    pthread_t *threads = (pthread_t *)malloc(workers*sizeof(pthread_t));
+    if(b.records == NULL || threads == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        b.failed = true;
+        workers = 0;
+    }
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_cond_init(&b.slotFreed, NULL);
+    uint32_t started;
+    for(started = 0; started < workers; started++) {
+        if(pthread_create(&threads[started], NULL, batchWorker, &b)) {
+            break;
+        }
+    }
+    if(started == 0 && workers != 0) {
+        // We could not start any threads, so hash everything here.
+        batchWorker(&b);
+    }
+    uint32_t i;
+    for(i = 0; i < started; i++) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    fflush(out);
+    pthread_cond_destroy(&b.slotFreed);
+    pthread_mutex_destroy(&b.mutex);
+    if(b.records != NULL) {
+        for(i = 0; i < b.numRecords; i++) {
+            free(b.records[i].line);
+        }
+    }
+    free(b.records);
+    free(threads);
+    if(b.map != NULL) {
+        munmap((void *)b.map, b.mapSize);
+        close(fd);
+    }
+    return !b.failed;
+}
@@ -0,0 +1,31 @@
+// Batch hashing for the tigerkdf command line tool.
+#ifndef TIGERKDF_BATCH_H
+#define TIGERKDF_BATCH_H
+
+#include <stdio.h>
+#include "tigerkdf.h"
+
+// Hash parameters, used as the defaults for every record of a batch.
+typedef struct TigerKDFBatchParamsStruct {
+    uint32_t hashSize;
+    uint32_t memSize; // In KiB
+    uint32_t multipliesPerBlock;
+    uint8_t garlic;
+    uint32_t blockSize;
+    uint32_t parallelism;
+    uint32_t repetitions;
+    uint32_t version;
+} TigerKDFBatchParams;
+
+// Hash every record of fileName, or of stdin if fileName is NULL, on a pool of workers, writing one line of hex
+// per record to out in input order.  Records are lines of tab separated fields:
+//
+//     password <TAB> hex salt [<TAB> name=value]...
+//
+// where the optional fields override the defaults for that record.  The names are the tigerkdf flags: h, g, m,
+// M, r, t, b and V.  Passwords therefore cannot contain tabs or newlines.  A record that cannot be hashed gets
+// the line "error" and a message on stderr.  Each worker reuses one arena for all its records, and at most
+// 4*workers records are in memory at once.  Files are read with mmap.  Returns false if any record failed.
+bool runBatch(const char *fileName, FILE *out, const TigerKDFBatchParams *defaults, uint32_t workers);
+
+#endif
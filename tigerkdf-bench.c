@@ -0,0 +1,1045 @@
+// Benchmarks for TigerKDF and the primitives it is built on.
+#define _POSIX_C_SOURCE 199309L // Otherwise clock_gettime is not included
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "pbkdf2.h"
+#include "be32vect.h"
+#include "blake2/blake2.h"
+#include "tigerkdf.h"
+#include "tigerkdf-internal.h"
+
+static void usage(char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, (char *)format, ap);
+    va_end(ap);
+    fprintf(stderr, "\nUsage: tigerkdf-bench [OPTIONS] benchmark\n"
+        "    -n bytes        -- Total bytes to process per measurement (default 256 MiB)\n"
+        "    -m size         -- Memory size in KiB for roofline (default 1 GiB)\n"
+        "    -M multiplies   -- Multiplies per block for roofline (default 4096)\n"
+        "    -t parallelism  -- Threads for roofline (default 2)\n"
+        "    -b blockSize    -- Block size in bytes for roofline (default 16 KiB)\n"
+        "    -f file         -- Baseline file for save and compare (default tigerkdf-baseline.json)\n"
+        "    -k samples      -- Timed hashes per point for save and compare (default 10)\n"
+        "    -o file         -- Cost model file for calibrate (default tigerkdf-model.txt)\n"
+        "Benchmarks:\n"
+        "    be32            -- Scalar vs. vectorized be32enc_vect/be32dec_vect from 32 bytes to 1 MiB\n"
+        "    blake2s         -- Scalar vs. 4-way and 8-way multi-buffer BLAKE2s, and PBKDF2_BLAKE2\n"
+        "    H               -- PBKDF2 over BLAKE2s vs. BLAKE2b, alone and in small-memory password hashes\n"
+        "    roofline        -- TigerKDF bandwidth per phase vs. a fasthash-style fill of the same memory\n"
+        "    kernels         -- Generic vs. block size specialized hashBlocks kernels\n"
+        "    interleave      -- One lane per thread vs. two lanes interleaved in one thread, as kernels and as\n"
+        "                       hashes with -m, -M and -t on one worker\n"
+        "    save            -- Time TigerKDF at 1, 4 and 16 KiB blocks with each H, using -m, -M and -t, and\n"
+        "                       store the samples in the baseline file under this CPU and kernel\n"
+        "    compare         -- Rerun the points saved for this CPU and kernel, and exit with status 2 if any\n"
+        "                       is significantly slower than its baseline\n"
+        "    calibrate       -- Measure this host's lane and memory bandwidth, BLAKE2s and multiply rates using\n"
+        "                       -m and -b, write them as the cost model for TigerKDF_EstimateCost, and compare\n"
+        "                       its predictions against hashes with -M and -t\n");
+    exit(1);
+}
+
+static uint64_t readuint64_t(char flag, char *arg) {
+    char *endPtr;
+    char *p = arg;
+    uint64_t value = strtoull(p, &endPtr, 0);
+    if(*p == '\0' || *endPtr != '\0') {
+        usage("Invalid integer for parameter -%c", flag);
+    }
+    return value;
+}
+
+// Return the current time in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Time byte-swapping len bytes in a loop, either with the scalar helpers or the dispatched ones.
+static double timeSwap(uint8_t *bytes, uint32_t *words, size_t len, uint64_t loops, bool fast, bool encode) {
+    double start = now();
+    uint64_t i;
+    for(i = 0; i < loops; i++) {
+        if(encode) {
+            if(fast) {
+                be32enc_vect_fast(bytes, words, len);
+            } else {
+                be32enc_vect(bytes, words, len);
+            }
+            // Keep the compiler from hoisting the loop body.
+            words[i % (len/4)] ^= bytes[len - 1];
+        } else {
+            if(fast) {
+                be32dec_vect_fast(words, bytes, len);
+            } else {
+                be32dec_vect(words, bytes, len);
+            }
+            bytes[i % len] ^= (uint8_t)words[len/4 - 1];
+        }
+    }
+    return now() - start;
+}
+
+// Compare scalar and vectorized big-endian encoding and decoding from 32 bytes to 1 MiB.
+static bool benchBe32(uint64_t totalBytes) {
+    size_t maxLen = 1 << 20;
+    uint8_t *bytes = (uint8_t *)aligned_alloc(32, maxLen);
+    uint8_t *check = (uint8_t *)aligned_alloc(32, maxLen);
+    uint32_t *words = (uint32_t *)aligned_alloc(32, maxLen);
+    if(bytes == NULL || check == NULL || words == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    size_t i;
+    for(i = 0; i < maxLen/4; i++) {
+        words[i] = i*0x9E3779B9u;
+    }
+    printf("be32 implementation: %s\n", be32vectImplementation());
+    printf("%10s %12s %12s %8s %12s %12s %8s\n", "bytes", "enc scalar", "enc fast", "speedup",
+        "dec scalar", "dec fast", "speedup");
+    size_t len;
+    for(len = 32; len <= maxLen; len <<= 1) {
+        be32enc_vect(check, words, len);
+        be32enc_vect_fast(bytes, words, len);
+        if(memcmp(check, bytes, len)) {
+            fprintf(stderr, "be32enc_vect_fast differs from be32enc_vect at %zu bytes\n", len);
+            return false;
+        }
+        uint64_t loops = totalBytes/len;
+        if(loops == 0) {
+            loops = 1;
+        }
+        double gb = (double)loops*len/1e9;
+        double encScalar = gb/timeSwap(bytes, words, len, loops, false, true);
+        double encFast = gb/timeSwap(bytes, words, len, loops, true, true);
+        double decScalar = gb/timeSwap(bytes, words, len, loops, false, false);
+        double decFast = gb/timeSwap(bytes, words, len, loops, true, false);
+        printf("%10zu %10.2fGB/s %10.2fGB/s %7.2fx %10.2fGB/s %10.2fGB/s %7.2fx\n", len, encScalar, encFast,
+            encFast/encScalar, decScalar, decFast, decFast/decScalar);
+    }
+    free(words);
+    free(check);
+    free(bytes);
+    return true;
+}
+
+// Time hashing loops*lanes messages of len bytes, lanes messages at a time.  Lanes is 1, 4 or 8.
+static double timeBlake2s(uint8_t *msgs, size_t len, uint64_t loops, uint32_t lanes) {
+    uint8_t hashes[8][BLAKE2S_OUTBYTES];
+    uint8_t *out[8];
+    const uint8_t *in[8];
+    uint32_t j;
+    for(j = 0; j < 8; j++) {
+        out[j] = hashes[j];
+        in[j] = msgs + j*len;
+    }
+    double start = now();
+    uint64_t i;
+    for(i = 0; i < loops; i++) {
+        if(lanes == 8) {
+            blake2s_x8(out, in, NULL, BLAKE2S_OUTBYTES, len, 0);
+        } else if(lanes == 4) {
+            blake2s_x4(out, in, NULL, BLAKE2S_OUTBYTES, len, 0);
+        } else {
+            blake2s(hashes[0], msgs, NULL, BLAKE2S_OUTBYTES, len, 0);
+        }
+        // Chain the hashes into the next messages so no call can be skipped.
+        msgs[0] ^= hashes[0][0];
+    }
+    return now() - start;
+}
+
+// Compare scalar BLAKE2s against the 4-way and 8-way multi-buffer versions on short messages, and report
+// PBKDF2_BLAKE2 throughput, whose output blocks are computed 8 at a time.
+static bool benchBlake2s(uint64_t totalBytes) {
+    uint8_t msgs[8*1024];
+    size_t i;
+    for(i = 0; i < sizeof(msgs); i++) {
+        msgs[i] = i;
+    }
+    printf("%10s %14s %14s %14s %8s %8s\n", "bytes", "scalar", "x4", "x8", "x4 gain", "x8 gain");
+    size_t lens[] = {32, 64, 128, 1024};
+    for(i = 0; i < sizeof(lens)/sizeof(size_t); i++) {
+        size_t len = lens[i];
+        uint64_t messages = totalBytes/len/64;
+        if(messages < 8) {
+            messages = 8;
+        }
+        double scalar = messages/timeBlake2s(msgs, len, messages, 1);
+        double x4 = messages/timeBlake2s(msgs, len, messages/4, 4);
+        double x8 = messages/timeBlake2s(msgs, len, messages/8, 8);
+        printf("%10zu %10.2fM/s %10.2fM/s %10.2fM/s %7.2fx %7.2fx\n", len, scalar/1e6, x4/1e6, x8/1e6,
+            x4/scalar, x8/scalar);
+    }
+    uint32_t dkLen = 16384;
+    uint8_t *key = malloc(dkLen);
+    if(key == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    uint64_t loops = totalBytes/dkLen/64 + 1;
+    double start = now();
+    for(i = 0; i < loops; i++) {
+        PBKDF2_BLAKE2(msgs, 32, (uint8_t *)"salt", 4, 1, key, dkLen);
+    }
+    printf("PBKDF2_BLAKE2 %u bytes: %.1fus\n", dkLen, (now() - start)*1e6/loops);
+    free(key);
+    return true;
+}
+
+// Time hashing a password with the given version and memory size in KiB, and return the average seconds.
+static double timeHash(uint32_t version, uint32_t memSize, uint32_t loops) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = version;
+    uint8_t hash[32];
+    double start = now();
+    uint32_t i;
+    for(i = 0; i < loops; i++) {
+        if(!TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memSize, 4096, 0,
+                NULL, 0, 16384, 1, 1, &options)) {
+            return -1.0;
+        }
+    }
+    return (now() - start)/loops;
+}
+
+// Compare the BLAKE2s and BLAKE2b versions of H, first at the sizes TigerKDF derives, and then in whole
+// password hashes small enough that H is a large part of the cost.
+static bool benchH(uint64_t totalBytes) {
+    uint32_t dkLens[] = {32, 64, 1024, 16384};
+    uint8_t key[16384];
+    uint32_t i;
+    printf("%10s %12s %12s %8s\n", "bytes", "BLAKE2s", "BLAKE2b", "gain");
+    for(i = 0; i < sizeof(dkLens)/sizeof(uint32_t); i++) {
+        uint32_t dkLen = dkLens[i];
+        uint64_t loops = totalBytes/dkLen/64 + 1;
+        uint64_t j;
+        double start = now();
+        for(j = 0; j < loops; j++) {
+            PBKDF2_BLAKE2((uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1, key, dkLen);
+        }
+        double s = (now() - start)/loops;
+        start = now();
+        for(j = 0; j < loops; j++) {
+            PBKDF2_BLAKE2B((uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1, key, dkLen);
+        }
+        double b = (now() - start)/loops;
+        printf("%10u %10.2fus %10.2fus %7.2fx\n", dkLen, s*1e6, b*1e6, s/b);
+    }
+    uint32_t memSizes[] = {64, 256, 1024, 4096};
+    printf("\n%10s %12s %12s %8s\n", "KiB", "BLAKE2s", "BLAKE2b", "gain");
+    for(i = 0; i < sizeof(memSizes)/sizeof(uint32_t); i++) {
+        uint32_t memSize = memSizes[i];
+        uint32_t loops = totalBytes/((uint64_t)memSize << 10)/4 + 1;
+        double s = timeHash(TIGERKDF_VERSION_ORIGINAL, memSize, loops);
+        double b = timeHash(TIGERKDF_VERSION_BLAKE2B, memSize, loops);
+        if(s < 0.0 || b < 0.0) {
+            fprintf(stderr, "Password hashing failed\n");
+            return false;
+        }
+        printf("%10u %10.2fus %10.2fus %7.2fx\n", memSize, s*1e6, b*1e6, s/b);
+    }
+    return true;
+}
+
+// One thread of the raw-bandwidth fill.  Like fasthash.c, each block is the previous block plus a
+// pseudo-random earlier block of the same lane, but without any hashing or multiplication chain.
+struct RooflineLaneStruct {
+    uint32_t *mem;
+    uint32_t blocklen;
+    uint32_t numblocks;
+    uint32_t value;
+};
+
+static void *fillLane(void *lanePtr) {
+    struct RooflineLaneStruct *l = (struct RooflineLaneStruct *)lanePtr;
+    uint32_t blocklen = l->blocklen;
+    uint32_t value = l->value;
+    uint32_t i;
+    for(i = 0; i < blocklen; i++) {
+        l->mem[i] = value + i;
+    }
+    for(i = 1; i < l->numblocks; i++) {
+        __m128i *prev = (__m128i *)(l->mem + (uint64_t)(i - 1)*blocklen);
+        __m128i *from = (__m128i *)(l->mem + (uint64_t)(value % i)*blocklen);
+        __m128i *to = (__m128i *)(l->mem + (uint64_t)i*blocklen);
+        __m128i v = _mm_set1_epi32(value);
+        uint32_t j;
+        for(j = 0; j < blocklen/4; j++) {
+            v = _mm_add_epi32(v, _mm_load_si128(prev + j));
+            v = _mm_xor_si128(v, _mm_load_si128(from + j));
+            _mm_store_si128(to + j, v);
+        }
+        // Make the next from address depend on this block so no block can be skipped.
+        value = value*(*(uint32_t *)to | 3) + i;
+    }
+    l->value = value;
+    return NULL;
+}
+
+// Time filling mem with one fasthash-style lane per thread, laid out like TigerKDF's memory at garlic 0, and
+// return the seconds, or -1 if a thread could not be started.
+static double timeFill(uint32_t *mem, uint32_t blocklen, uint32_t numblocks, uint32_t parallelism) {
+    struct RooflineLaneStruct lanes[parallelism];
+    pthread_t threads[parallelism];
+    double start = now();
+    uint32_t started;
+    for(started = 0; started < parallelism; started++) {
+        struct RooflineLaneStruct *l = lanes + started;
+        l->mem = mem + (uint64_t)started*numblocks*blocklen;
+        l->blocklen = blocklen;
+        l->numblocks = numblocks;
+        l->value = started + 1;
+        if(pthread_create(threads + started, NULL, fillLane, l)) {
+            break;
+        }
+    }
+    uint32_t i;
+    for(i = 0; i < started; i++) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    return started == parallelism? now() - start : -1.0;
+}
+
+// Print one roofline row: the fill ceiling and each TigerKDF phase as GB/s and a percentage of that ceiling, then
+// the page faults, resident set growth and huge page backing of the hash.
+static void printRoofline(const char *run, double ceiling, const TigerKDFStats *stats) {
+    printf("%-6s %10.2fGB/s", run, ceiling/1e9);
+    uint32_t phase;
+    for(phase = 0; phase < 2; phase++) {
+        double bandwidth = stats->phaseBytes[phase]/stats->phaseSeconds[phase];
+        printf(" %10.2fGB/s %6.1f%%", bandwidth/1e9, 100.0*bandwidth/ceiling);
+    }
+    printf(" %9.3fs %10llu %10llu %7.1fMB %7.1fMB\n", stats->totalSeconds, (unsigned long long)stats->minorFaults,
+        (unsigned long long)stats->majorFaults, stats->rssBytes/1e6, stats->hugePageBytes/1e6);
+}
+
+// Compare TigerKDF's write+read bandwidth in each phase against a raw fill of the same memory with the same
+// threads and block size, the ceiling fasthash.c says TigerKDF should approach.  Bandwidth counts the read of
+// the previous and from blocks and the write of each new block, for both the fill and TigerKDF.  The cold run
+// uses fresh memory each time, so page faults are included, while the warm run reuses memory already touched.
+static bool benchRoofline(uint32_t memSize, uint32_t multipliesPerBlock, uint32_t blockSize,
+        uint32_t parallelism) {
+    if(blockSize == 0 || blockSize % 32 != 0 || parallelism == 0) {
+        fprintf(stderr, "Roofline needs a block size that is a multiple of 32 and at least one thread\n");
+        return false;
+    }
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    // Each thread fills one lane in each of TigerKDF's two phases, so the fill gives it both at once.
+    uint32_t numblocks = 2*(memlen/(2*parallelism*blocklen));
+    uint64_t arenaSize = TigerKDF_ArenaSize(memSize, 0, blockSize, parallelism);
+    if(numblocks < 2 || arenaSize == 0) {
+        fprintf(stderr, "Memory size too small for %u threads of %u byte blocks\n", parallelism, blockSize);
+        return false;
+    }
+    double fillBytes = 3.0*parallelism*(numblocks - 1)*blockSize;
+    TigerKDFStats stats = TIGERKDF_STATS_INIT;
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.stats = &stats;
+    uint8_t hash[32];
+    printf("%u KiB, %u threads, %u byte blocks, %u multiplies per block\n", memSize, parallelism, blockSize,
+        multipliesPerBlock);
+    printf("%-6s %14s %22s %22s %10s %10s %10s %9s %9s\n", "run", "fill", "phase 0 (no password)",
+        "phase 1 (password)", "total", "minor", "major", "RSS", "huge");
+    uint32_t *mem = (uint32_t *)aligned_alloc(32, arenaSize);
+    if(mem == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    double coldFill = timeFill(mem, blocklen, numblocks, parallelism);
+    double warmFill = timeFill(mem, blocklen, numblocks, parallelism);
+    bool passed = coldFill > 0.0 && warmFill > 0.0 && TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password",
+        8, (uint8_t *)"salt", 4, memSize, multipliesPerBlock, 0, NULL, 0, blockSize, parallelism, 1, &options);
+    if(passed) {
+        printRoofline("cold", fillBytes/coldFill, &stats);
+        options.arena = mem;
+        options.arenaSize = arenaSize;
+        passed = TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memSize,
+            multipliesPerBlock, 0, NULL, 0, blockSize, parallelism, 1, &options);
+    }
+    if(passed) {
+        printRoofline("warm", fillBytes/warmFill, &stats);
+        printf("Cached address schedule: %llu bytes\n", (unsigned long long)stats.scheduleBytes);
+    } else {
+        fprintf(stderr, "Roofline run failed\n");
+    }
+    free(mem);
+    return passed;
+}
+
+// Time hashing loops passes over a 1 MiB buffer of blockSize blocks with one hashBlocks kernel.
+static double timeHashBlocks(TigerKDFHashBlocksFunc hashBlocks, uint32_t *mem, uint32_t memlen,
+        uint32_t blockSize, uint64_t loops) {
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    uint32_t numblocks = memlen/blocklen;
+    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    double start = now();
+    uint64_t l;
+    for(l = 0; l < loops; l++) {
+        uint32_t i;
+        for(i = 1; i < numblocks; i++) {
+            hashBlocks(state, mem, blocklen, (uint64_t)(i >> 1)*blocklen, (uint64_t)i*blocklen, 1);
+        }
+    }
+    return now() - start;
+}
+
+// Compare the generic hashBlocks kernel against the ones specialized for each deployed block size, with one
+// repetition, on a buffer small enough to stay in cache so the loop itself is what is measured.
+static bool benchKernels(uint64_t totalBytes) {
+    uint32_t memlen = (1 << 20)/sizeof(uint32_t);
+    uint32_t *mem = (uint32_t *)aligned_alloc(32, memlen*sizeof(uint32_t));
+    if(mem == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    uint32_t i;
+    for(i = 0; i < memlen; i++) {
+        mem[i] = i*0x9E3779B9u;
+    }
+    printf("%10s %12s %12s %8s\n", "bytes", "generic", "specialized", "gain");
+    uint32_t blockSizes[] = {64, 1024, 4096, 16384};
+    for(i = 0; i < sizeof(blockSizes)/sizeof(uint32_t); i++) {
+        uint32_t blockSize = blockSizes[i];
+        uint32_t blocklen = blockSize/sizeof(uint32_t);
+        TigerKDFHashBlocksFunc generic = selectHashBlocks(blocklen, 1, false);
+        TigerKDFHashBlocksFunc specialized = selectHashBlocks(blocklen, 1, true);
+        uint64_t loops = totalBytes/(memlen*sizeof(uint32_t)) + 1;
+        double gb = 3.0*loops*(memlen/blocklen - 1)*blockSize/1e9;
+        double g = gb/timeHashBlocks(generic, mem, memlen, blockSize, loops);
+        double s = gb/timeHashBlocks(specialized, mem, memlen, blockSize, loops);
+        printf("%10u %10.2fGB/s %10.2fGB/s %7.2fx\n", blockSize, g, s, s/g);
+    }
+    free(mem);
+    return true;
+}
+
+// Time hashing loops passes over two lanes of a buffer, each memlen/2 words of blockSize blocks, either one lane's
+// block after the other's or both at once with a two-lane kernel.
+static double timeLanePair(TigerKDFHashBlocksFunc hashBlocks, TigerKDFHashBlocks2Func hashBlocks2, uint32_t *mem,
+        uint32_t memlen, uint32_t blockSize, uint64_t loops) {
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    uint32_t numblocks = memlen/2/blocklen;
+    uint64_t lane1 = (uint64_t)numblocks*blocklen;
+    uint32_t state0[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    uint32_t state1[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    double start = now();
+    uint64_t l;
+    for(l = 0; l < loops; l++) {
+        uint32_t i;
+        for(i = 1; i < numblocks; i++) {
+            uint64_t fromAddr = (uint64_t)(i >> 1)*blocklen;
+            uint64_t toAddr = (uint64_t)i*blocklen;
+            if(hashBlocks2 != NULL) {
+                hashBlocks2(state0, state1, mem, blocklen, fromAddr, toAddr, lane1 + fromAddr, lane1 + toAddr, 1);
+            } else {
+                hashBlocks(state0, mem, blocklen, fromAddr, toAddr, 1);
+                hashBlocks(state1, mem, blocklen, lane1 + fromAddr, lane1 + toAddr, 1);
+            }
+        }
+    }
+    return now() - start;
+}
+
+// Compare one lane per thread against two lanes interleaved in one thread, first as bare kernels on a buffer that
+// stays in cache, and then as whole hashes of -m KiB with -t lanes on one worker thread, where the time per lane
+// also includes BLAKE2s and waiting for memory.
+static bool benchInterleave(uint64_t totalBytes, uint32_t memSize, uint32_t multipliesPerBlock,
+        uint32_t parallelism) {
+    uint32_t memlen = (2 << 20)/sizeof(uint32_t);
+    uint32_t *mem = (uint32_t *)aligned_alloc(32, memlen*sizeof(uint32_t));
+    if(mem == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    uint32_t i;
+    for(i = 0; i < memlen; i++) {
+        mem[i] = i*0x9E3779B9u;
+    }
+    printf("%10s %12s %12s %8s %10s %10s %8s\n", "bytes", "one lane", "two lanes", "gain", "one lane",
+        "two lanes", "gain");
+    uint32_t blockSizes[] = {64, 1024, 4096, 16384};
+    for(i = 0; i < sizeof(blockSizes)/sizeof(uint32_t); i++) {
+        uint32_t blockSize = blockSizes[i];
+        uint32_t blocklen = blockSize/sizeof(uint32_t);
+        TigerKDFHashBlocksFunc single = selectHashBlocks(blocklen, 1, true);
+        TigerKDFHashBlocks2Func pair = selectHashBlocks2(blocklen, 1, true);
+        uint64_t loops = totalBytes/(memlen*sizeof(uint32_t)) + 1;
+        double gb = 3.0*loops*2*(memlen/2/blocklen - 1)*blockSize/1e9;
+        double one = gb/timeLanePair(single, NULL, mem, memlen, blockSize, loops);
+        double two = gb/timeLanePair(NULL, pair, mem, memlen, blockSize, loops);
+        printf("%10u %10.2fGB/s %10.2fGB/s %7.2fx", blockSize, one, two, two/one);
+        TigerKDFStats stats = TIGERKDF_STATS_INIT;
+        TigerKDFOptions options;
+        memset(&options, 0, sizeof(TigerKDFOptions));
+        options.size = sizeof(TigerKDFOptions);
+        options.stats = &stats;
+        options.workers = 1;
+        uint8_t hash1[32], hash2[32];
+        uint32_t multiplies = multipliesPerBlock < blockSize? multipliesPerBlock : blockSize;
+        options.interleave = TIGERKDF_INTERLEAVE_OFF;
+        double start = now();
+        bool passed = TigerKDF_HashPasswordExt(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+            memSize, multiplies, 0, NULL, 0, blockSize, parallelism, 1, &options);
+        double oneSeconds = now() - start;
+        options.interleave = TIGERKDF_INTERLEAVE_PAIRS;
+        start = now();
+        passed = passed && TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+            memSize, multiplies, 0, NULL, 0, blockSize, parallelism, 1, &options);
+        double twoSeconds = now() - start;
+        if(!passed || memcmp(hash1, hash2, 32)) {
+            printf("\n");
+            fprintf(stderr, "Interleaved lanes failed or changed the hash\n");
+            free(mem);
+            return false;
+        }
+        printf(" %9.3fs %9.3fs %7.2fx\n", oneSeconds, twoSeconds, oneSeconds/twoSeconds);
+    }
+    free(mem);
+    return true;
+}
+
+// Slowdowns smaller than this fraction are not reported as regressions, however significant.
+#define BASELINE_MIN_REGRESSION 0.01
+#define BASELINE_MAX_RECORDS 1024
+#define BASELINE_MAX_SAMPLES 100
+
+// One benchmark point and its timings, as stored in the baseline file.
+struct BaselineRecordStruct {
+    char cpu[128];
+    char kernel[64];
+    uint32_t memSize;
+    uint32_t blockSize;
+    uint32_t parallelism;
+    uint32_t multipliesPerBlock;
+    uint32_t version;
+    uint32_t numSamples;
+    double samples[BASELINE_MAX_SAMPLES];
+};
+
+// Read the CPU model from /proc/cpuinfo, without characters that would need escaping in JSON.
+static void readCpuModel(char *model, size_t size) {
+    snprintf(model, size, "unknown");
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if(file == NULL) {
+        return;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char *colon = strchr(line, ':');
+        if(!strncmp(line, "model name", 10) && colon != NULL) {
+            snprintf(model, size, "%s", colon + 2);
+            char *p;
+            for(p = model; *p != '\0'; p++) {
+                if(*p == '"' || *p == '\\' || (uint8_t)*p < ' ') {
+                    *p = *p == '\n'? '\0' : '_';
+                }
+            }
+            break;
+        }
+    }
+    fclose(file);
+}
+
+// Name the code paths a point runs: the hashBlocks kernel for its block size and the byte-swap loop.
+static void describeKernel(char *kernel, size_t size, uint32_t blockSize) {
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    bool specialized = selectHashBlocks(blocklen, 1, true) != selectHashBlocks(blocklen, 1, false);
+    snprintf(kernel, size, "%s/%s", specialized? "specialized" : "generic", be32vectImplementation());
+}
+
+// Return whether two records are for the same host, kernel and parameters.
+static bool sameBaselinePoint(const struct BaselineRecordStruct *a, const struct BaselineRecordStruct *b) {
+    return !strcmp(a->cpu, b->cpu) && !strcmp(a->kernel, b->kernel) && a->memSize == b->memSize &&
+        a->blockSize == b->blockSize && a->parallelism == b->parallelism &&
+        a->multipliesPerBlock == b->multipliesPerBlock && a->version == b->version;
+}
+
+// Find "key": in line and return what follows it, or NULL.
+static const char *findJsonKey(const char *line, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(line, pattern);
+    if(p == NULL) {
+        return NULL;
+    }
+    p += strlen(pattern);
+    while(*p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+static bool readJsonString(const char *line, const char *key, char *value, size_t size) {
+    const char *p = findJsonKey(line, key);
+    if(p == NULL || *p++ != '"') {
+        return false;
+    }
+    const char *end = strchr(p, '"');
+    if(end == NULL || (size_t)(end - p) >= size) {
+        return false;
+    }
+    memcpy(value, p, end - p);
+    value[end - p] = '\0';
+    return true;
+}
+
+static bool readJsonUint32(const char *line, const char *key, uint32_t *value) {
+    const char *p = findJsonKey(line, key);
+    char *end;
+    if(p == NULL) {
+        return false;
+    }
+    *value = strtoul(p, &end, 10);
+    return end != p;
+}
+
+// Parse one record.  The baseline file is written by writeBaseline with one record per line, and this reads
+// that format back rather than arbitrary JSON.
+static bool parseBaselineRecord(const char *line, struct BaselineRecordStruct *r) {
+    if(!readJsonString(line, "cpu", r->cpu, sizeof(r->cpu)) ||
+            !readJsonString(line, "kernel", r->kernel, sizeof(r->kernel)) ||
+            !readJsonUint32(line, "memSize", &r->memSize) || !readJsonUint32(line, "blockSize", &r->blockSize) ||
+            !readJsonUint32(line, "parallelism", &r->parallelism) ||
+            !readJsonUint32(line, "multipliesPerBlock", &r->multipliesPerBlock) ||
+            !readJsonUint32(line, "version", &r->version)) {
+        return false;
+    }
+    const char *p = findJsonKey(line, "samples");
+    if(p == NULL || *p++ != '[') {
+        return false;
+    }
+    r->numSamples = 0;
+    while(r->numSamples < BASELINE_MAX_SAMPLES) {
+        char *end;
+        double value = strtod(p, &end);
+        if(end == p) {
+            break;
+        }
+        r->samples[r->numSamples++] = value;
+        p = end;
+        while(*p == ',' || *p == ' ') {
+            p++;
+        }
+    }
+    return *p == ']' && r->numSamples >= 2;
+}
+
+// Read every record of the baseline file.  A missing file has no records.  Returns the number of records, or -1
+// if the file is malformed.
+static int readBaseline(const char *fileName, struct BaselineRecordStruct *records) {
+    FILE *file = fopen(fileName, "r");
+    if(file == NULL) {
+        return 0;
+    }
+    int numRecords = 0;
+    char line[4096];
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(strstr(line, "\"cpu\"") == NULL) {
+            continue;
+        }
+        if(numRecords == BASELINE_MAX_RECORDS || !parseBaselineRecord(line, records + numRecords)) {
+            fprintf(stderr, "Unable to read record %d of %s\n", numRecords + 1, fileName);
+            fclose(file);
+            return -1;
+        }
+        numRecords++;
+    }
+    fclose(file);
+    return numRecords;
+}
+
+static bool writeBaseline(const char *fileName, const struct BaselineRecordStruct *records, int numRecords) {
+    FILE *file = fopen(fileName, "w");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to write %s\n", fileName);
+        return false;
+    }
+    fprintf(file, "{\"records\": [\n");
+    int i;
+    for(i = 0; i < numRecords; i++) {
+        const struct BaselineRecordStruct *r = records + i;
+        fprintf(file, "  {\"cpu\": \"%s\", \"kernel\": \"%s\", \"memSize\": %u, \"blockSize\": %u, "
+            "\"parallelism\": %u, \"multipliesPerBlock\": %u, \"version\": %u, \"samples\": [", r->cpu, r->kernel,
+            r->memSize, r->blockSize, r->parallelism, r->multipliesPerBlock, r->version);
+        uint32_t j;
+        for(j = 0; j < r->numSamples; j++) {
+            fprintf(file, "%s%.9f", j == 0? "" : ", ", r->samples[j]);
+        }
+        fprintf(file, "]}%s\n", i + 1 < numRecords? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
+
+// Time numSamples hashes at the record's point, after one untimed hash to fault in the arena.
+static bool sampleBaselinePoint(struct BaselineRecordStruct *r, uint32_t numSamples) {
+    uint64_t arenaSize = TigerKDF_ArenaSize(r->memSize, 0, r->blockSize, r->parallelism);
+    void *arena = arenaSize != 0? aligned_alloc(32, arenaSize) : NULL;
+    if(arena == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = r->version;
+    options.arena = arena;
+    options.arenaSize = arenaSize;
+    uint8_t hash[32];
+    bool passed = true;
+    uint32_t i;
+    for(i = 0; i <= numSamples && passed; i++) {
+        double start = now();
+        passed = TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, r->memSize,
+            r->multipliesPerBlock, 0, NULL, 0, r->blockSize, r->parallelism, 1, &options);
+        if(i > 0) {
+            r->samples[i - 1] = now() - start;
+        }
+    }
+    r->numSamples = numSamples;
+    free(arena);
+    if(!passed) {
+        fprintf(stderr, "Password hashing failed at %u KiB, %u byte blocks\n", r->memSize, r->blockSize);
+    }
+    return passed;
+}
+
+// The two-sided 95% quantile of Student's t distribution with df degrees of freedom.
+static double studentT95(double df) {
+    static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201,
+        2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+        2.052, 2.048, 2.045, 2.042};
+    uint32_t i = df < 1.0? 0 : (uint32_t)df - 1;
+    return i < sizeof(t)/sizeof(double)? t[i] : 1.960;
+}
+
+static void sampleStats(const struct BaselineRecordStruct *r, double *mean, double *variance) {
+    double sum = 0.0;
+    uint32_t i;
+    for(i = 0; i < r->numSamples; i++) {
+        sum += r->samples[i];
+    }
+    *mean = sum/r->numSamples;
+    double squares = 0.0;
+    for(i = 0; i < r->numSamples; i++) {
+        squares += (r->samples[i] - *mean)*(r->samples[i] - *mean);
+    }
+    *variance = squares/(r->numSamples - 1);
+}
+
+// Compare a new run against its baseline with Welch's t-test, printing one row, and return true if the new run
+// is significantly slower by at least BASELINE_MIN_REGRESSION.  Comparing a record with itself prints it.
+static bool compareBaselinePoint(const struct BaselineRecordStruct *base, const struct BaselineRecordStruct *now) {
+    double baseMean, baseVariance, newMean, newVariance;
+    sampleStats(base, &baseMean, &baseVariance);
+    sampleStats(now, &newMean, &newVariance);
+    double baseError = baseVariance/base->numSamples;
+    double newError = newVariance/now->numSamples;
+    double stdError = sqrt(baseError + newError);
+    double df = stdError == 0.0? 1e9 : (baseError + newError)*(baseError + newError)/
+        (baseError*baseError/(base->numSamples - 1) + newError*newError/(now->numSamples - 1));
+    double margin = studentT95(df)*stdError;
+    double diff = newMean - baseMean;
+    bool regressed = diff - margin > 0.0 && diff > BASELINE_MIN_REGRESSION*baseMean;
+    const char *verdict = base == now? "saved" : regressed? "REGRESSION" : diff + margin < 0.0? "faster" : "same";
+    printf("%6u %6u %3u %2u %10.4fs +-%7.4f %10.4fs +-%7.4f %+7.1f%% %s\n", now->memSize, now->blockSize,
+        now->parallelism, now->version, baseMean, studentT95(base->numSamples - 1)*sqrt(baseError), newMean,
+        studentT95(now->numSamples - 1)*sqrt(newError), 100.0*diff/baseMean, verdict);
+    return regressed;
+}
+
+// Save or compare baselines for TigerKDF at 1, 4 and 16 KiB blocks with the BLAKE2s and BLAKE2b versions of H.
+// Save replaces this host's records for those points and keeps every other record.  Compare returns 2 if any
+// point regressed, 1 on errors, and 0 otherwise.
+static int benchBaseline(bool save, const char *fileName, uint32_t numSamples, uint32_t memSize,
+        uint32_t multipliesPerBlock, uint32_t parallelism) {
+    if(numSamples < 2 || numSamples > BASELINE_MAX_SAMPLES) {
+        fprintf(stderr, "Samples must be from 2 to %u\n", BASELINE_MAX_SAMPLES);
+        return 1;
+    }
+    struct BaselineRecordStruct *records = (struct BaselineRecordStruct *)malloc(
+        (BASELINE_MAX_RECORDS + 1)*sizeof(struct BaselineRecordStruct));
+    if(records == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return 1;
+    }
+    int numRecords = readBaseline(fileName, records);
+    if(numRecords < 0) {
+        free(records);
+        return 1;
+    }
+    char cpu[128];
+    readCpuModel(cpu, sizeof(cpu));
+    printf("%s\n%6s %6s %3s %2s %22s %22s %8s\n", cpu, "KiB", "block", "t", "V", "baseline", "now", "change");
+    struct BaselineRecordStruct *r = records + BASELINE_MAX_RECORDS;
+    uint32_t blockSizes[] = {1024, 4096, 16384};
+    uint32_t versions[] = {TIGERKDF_VERSION_ORIGINAL, TIGERKDF_VERSION_BLAKE2B};
+    int status = 0;
+    bool compared = false;
+    uint32_t i, j;
+    for(i = 0; i < sizeof(blockSizes)/sizeof(uint32_t) && status != 1; i++) {
+        for(j = 0; j < sizeof(versions)/sizeof(uint32_t) && status != 1; j++) {
+            memset(r, 0, sizeof(struct BaselineRecordStruct));
+            snprintf(r->cpu, sizeof(r->cpu), "%s", cpu);
+            describeKernel(r->kernel, sizeof(r->kernel), blockSizes[i]);
+            r->memSize = memSize;
+            r->blockSize = blockSizes[i];
+            r->parallelism = parallelism;
+            // TigerKDF allows at most one multiply per byte of block.
+            r->multipliesPerBlock = multipliesPerBlock < blockSizes[i]? multipliesPerBlock : blockSizes[i];
+            r->version = versions[j];
+            int k;
+            for(k = 0; k < numRecords && !sameBaselinePoint(records + k, r); k++);
+            if(!save && k == numRecords) {
+                continue;
+            }
+            if(!sampleBaselinePoint(r, numSamples)) {
+                status = 1;
+            } else if(save) {
+                if(k == numRecords && numRecords == BASELINE_MAX_RECORDS) {
+                    fprintf(stderr, "Too many records in %s\n", fileName);
+                    status = 1;
+                } else {
+                    records[k] = *r;
+                    numRecords += k == numRecords;
+                    compareBaselinePoint(r, r);
+                }
+            } else {
+                compared = true;
+                if(compareBaselinePoint(records + k, r)) {
+                    status = 2;
+                }
+            }
+        }
+    }
+    if(status != 1 && save && !writeBaseline(fileName, records, numRecords)) {
+        status = 1;
+    }
+    if(status != 1 && !save && !compared) {
+        fprintf(stderr, "No baseline in %s for this CPU, kernel and parameters\n", fileName);
+        status = 1;
+    }
+    free(records);
+    return status;
+}
+
+// Time loops of the multiply thread's inner loop, 8 multiplies each, and return the seconds.
+static double timeMultiplies(uint64_t loops) {
+    uint32_t state[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    double start = now();
+    uint64_t j;
+    for(j = 0; j < loops; j++) {
+        state[0] = (state[0]*(state[1] | 1)) ^ (state[2] >> 1);
+        state[1] = (state[1]*(state[2] | 1)) ^ (state[3] >> 1);
+        state[2] = (state[2]*(state[3] | 1)) ^ (state[4] >> 1);
+        state[3] = (state[3]*(state[4] | 1)) ^ (state[5] >> 1);
+        state[4] = (state[4]*(state[5] | 1)) ^ (state[6] >> 1);
+        state[5] = (state[5]*(state[6] | 1)) ^ (state[7] >> 1);
+        state[6] = (state[6]*(state[7] | 1)) ^ (state[0] >> 1);
+        state[7] = (state[7]*(state[0] | 1)) ^ (state[1] >> 1);
+    }
+    double seconds = now() - start;
+    // Keep the loop from being optimized away.
+    volatile uint32_t sink = state[0];
+    (void)sink;
+    return seconds;
+}
+
+// Hash a password on workers threads, filling in stats, and return the wall-clock seconds, or -1 if it fails.
+static double timeStatsHash(TigerKDFStats *stats, uint32_t memSize, uint32_t multipliesPerBlock,
+        uint32_t blockSize, uint32_t parallelism, uint32_t workers) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    memset(stats, 0, sizeof(TigerKDFStats));
+    stats->size = sizeof(TigerKDFStats);
+    options.stats = stats;
+    options.workers = workers;
+    uint8_t hash[32];
+    double start = now();
+    if(!TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memSize,
+            multipliesPerBlock, 0, NULL, 0, blockSize, parallelism, 1, &options)) {
+        return -1.0;
+    }
+    return now() - start;
+}
+
+// Return the bandwidth of the password dependent phase in stats, without the time its BLAKE2s calls took on
+// each of workers.
+static double laneBandwidth(const TigerKDFStats *stats, uint32_t blockSize, uint32_t workers,
+        double blake2sPerSecond) {
+    double blocks = stats->phaseBytes[1]/(3.0*blockSize);
+    double seconds = stats->phaseSeconds[1] - blocks/workers/blake2sPerSecond;
+    // BLAKE2s cannot take all of the time, but guard against timer noise on tiny hashes.
+    if(seconds < stats->phaseSeconds[1]/16) {
+        seconds = stats->phaseSeconds[1]/16;
+    }
+    return stats->phaseBytes[1]/seconds;
+}
+
+// Measure the rates TigerKDF_EstimateCost predicts time from, and write them to fileName.  Lane bandwidth comes
+// from the password dependent phase of a -m KiB hash with no multiplies, so lanes never wait, first with one lane
+// and then with one lane per CPU.  What is left of a 1 MiB hash is the fixed cost.  Then compare predictions
+// against real hashes at -M multiplies, with one lane and with -t lanes.
+static bool benchCalibrate(const char *fileName, uint64_t totalBytes, uint32_t memSize,
+        uint32_t multipliesPerBlock, uint32_t blockSize, uint32_t parallelism) {
+    TigerKDFCostModel model;
+    memset(&model, 0, sizeof(TigerKDFCostModel));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    model.cpus = cpus > 0? cpus : 1;
+    uint8_t msgs[8*32] = {0};
+    uint64_t loops = totalBytes/32/64 + 1;
+    model.blake2sPerSecond = loops/timeBlake2s(msgs, 32, loops, 1);
+    loops = totalBytes/8 + 1;
+    model.multipliesPerSecond = 8*loops/timeMultiplies(loops);
+    TigerKDFStats stats;
+    if(timeStatsHash(&stats, memSize, 0, blockSize, 1, 1) < 0.0) {
+        fprintf(stderr, "Calibration hash failed\n");
+        return false;
+    }
+    model.laneBytesPerSecond = laneBandwidth(&stats, blockSize, 1, model.blake2sPerSecond);
+    model.memoryBytesPerSecond = model.laneBytesPerSecond;
+    if(model.cpus > 1) {
+        if(timeStatsHash(&stats, memSize, 0, blockSize, model.cpus, model.cpus) < 0.0) {
+            fprintf(stderr, "Calibration hash failed\n");
+            return false;
+        }
+        model.memoryBytesPerSecond = laneBandwidth(&stats, blockSize, model.cpus, model.blake2sPerSecond);
+    }
+    uint32_t fixedMemSize = 1024;
+    uint32_t fixedLoops = 16;
+    double seconds = 0.0;
+    uint32_t i;
+    for(i = 0; i < fixedLoops; i++) {
+        double s = timeStatsHash(&stats, fixedMemSize, multipliesPerBlock, blockSize, 1, 1);
+        if(s < 0.0) {
+            fprintf(stderr, "Calibration hash failed\n");
+            return false;
+        }
+        seconds += s;
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.workers = 1;
+    TigerKDFCost cost;
+    if(!TigerKDF_EstimateCost(&cost, 32, fixedMemSize, multipliesPerBlock, 0, 0, blockSize, 1, 1, &options,
+            &model)) {
+        fprintf(stderr, "Invalid parameters\n");
+        return false;
+    }
+    model.fixedSeconds = seconds/fixedLoops - cost.seconds;
+    if(model.fixedSeconds < 0.0) {
+        model.fixedSeconds = 0.0;
+    }
+    char cpu[128];
+    readCpuModel(cpu, sizeof(cpu));
+    printf("%s, %u CPUs, %u byte blocks\n", cpu, model.cpus, blockSize);
+    printf("one lane: %.2fGB/s, all lanes: %.2fGB/s, BLAKE2s: %.2fM/s, multiplies: %.2fG/s, fixed: %.1fus\n",
+        model.laneBytesPerSecond/1e9, model.memoryBytesPerSecond/1e9, model.blake2sPerSecond/1e6,
+        model.multipliesPerSecond/1e9, model.fixedSeconds*1e6);
+    if(!TigerKDF_WriteCostModel(&model, fileName)) {
+        return false;
+    }
+    printf("Wrote %s\n%6s %10s %12s %12s %8s\n", fileName, "lanes", "multiplies", "predicted", "measured",
+        "error");
+    uint32_t lanes[] = {1, parallelism};
+    for(i = 0; i < sizeof(lanes)/sizeof(uint32_t); i++) {
+        if(!TigerKDF_EstimateCost(&cost, 32, memSize, multipliesPerBlock, 0, 0, blockSize, lanes[i], 1, NULL,
+                &model)) {
+            fprintf(stderr, "Invalid parameters\n");
+            return false;
+        }
+        seconds = timeStatsHash(&stats, memSize, multipliesPerBlock, blockSize, lanes[i], 0);
+        if(seconds < 0.0) {
+            fprintf(stderr, "Password hashing failed\n");
+            return false;
+        }
+        printf("%6u %10u %11.3fs %11.3fs %+7.1f%%\n", lanes[i], multipliesPerBlock, cost.seconds, seconds,
+            100.0*(cost.seconds - seconds)/seconds);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint64_t totalBytes = 256 << 20;
+    uint32_t memSize = 1024*1024, multipliesPerBlock = 4096, parallelism = 2, blockSize = 16384;
+    uint32_t numSamples = 10;
+    const char *baselineFile = "tigerkdf-baseline.json";
+    const char *modelFile = "tigerkdf-model.txt";
+    int c;
+    while((c = getopt(argc, argv, "n:m:M:t:b:f:k:o:")) != -1) {
+        switch (c) {
+        case 'n':
+            totalBytes = readuint64_t(c, optarg);
+            break;
+        case 'm':
+            memSize = readuint64_t(c, optarg);
+            break;
+        case 'M':
+            multipliesPerBlock = readuint64_t(c, optarg);
+            break;
+        case 't':
+            parallelism = readuint64_t(c, optarg);
+            break;
+        case 'b':
+            blockSize = readuint64_t(c, optarg);
+            break;
+        case 'f':
+            baselineFile = optarg;
+            break;
+        case 'k':
+            numSamples = readuint64_t(c, optarg);
+            break;
+        case 'o':
+            modelFile = optarg;
+            break;
+        default:
+            usage("Invalid argument");
+        }
+    }
+    if(optind + 1 != argc) {
+        usage("Expected exactly one benchmark name\n");
+    }
+    char *benchmark = argv[optind];
+    bool passed = false;
+    if(!strcmp(benchmark, "be32")) {
+        passed = benchBe32(totalBytes);
+    } else if(!strcmp(benchmark, "blake2s")) {
+        passed = benchBlake2s(totalBytes);
+    } else if(!strcmp(benchmark, "H")) {
+        passed = benchH(totalBytes);
+    } else if(!strcmp(benchmark, "kernels")) {
+        passed = benchKernels(totalBytes);
+    } else if(!strcmp(benchmark, "interleave")) {
+        passed = benchInterleave(totalBytes, memSize, multipliesPerBlock, parallelism);
+    } else if(!strcmp(benchmark, "roofline")) {
+        passed = benchRoofline(memSize, multipliesPerBlock, blockSize, parallelism);
+    } else if(!strcmp(benchmark, "calibrate")) {
+        passed = benchCalibrate(modelFile, totalBytes, memSize, multipliesPerBlock, blockSize, parallelism);
+    } else if(!strcmp(benchmark, "save") || !strcmp(benchmark, "compare")) {
+        return benchBaseline(!strcmp(benchmark, "save"), baselineFile, numSamples, memSize, multipliesPerBlock,
+            parallelism);
+    } else {
+        usage("Unknown benchmark %s\n", benchmark);
+    }
+    return passed? 0 : 1;
+}
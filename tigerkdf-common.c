@@ -1,11 +1,21 @@
+#define _POSIX_C_SOURCE 200112L // Otherwise clock_gettime and ftruncate are not included
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "blake2/blake2.h"
 #include "pbkdf2.h"
+#include "be32vect.h"
 #include "tigerkdf.h"
-
-bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t startGarlic,
-        uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash);
+#include "tigerkdf-internal.h"
+#include "tigerkdf-probes.h"
 
 // Verify that parameters are valid for password hashing.
 static bool verifyParameters(uint32_t hashSize, uint32_t passwordSize, uint32_t saltSize, uint32_t memSize,
@@ -26,12 +36,814 @@ static bool verifyParameters(uint32_t hashSize, uint32_t passwordSize, uint32_t
     return true;
 }
 
+TigerKDFHashBlocksFunc testHashBlocks;
+TigerKDFHashBlocks2Func testHashBlocks2;
+
+// Larger schedules are computed on the fly rather than cached.  This is 4 MiB of schedule.
+#define TIGERKDF_MAX_SCHEDULE_BLOCKS (1 << 20)
+// Schedules no hash is using are kept until they add up to this many bytes.
+#define TIGERKDF_SCHEDULE_CACHE_BYTES (16 << 20)
+
+static pthread_mutex_t scheduleMutex = PTHREAD_MUTEX_INITIALIZER;
+static TigerKDFSchedule *schedules;
+static uint64_t unusedScheduleBytes;
+
+// Build the schedule for numblocks.
+static TigerKDFSchedule *buildSchedule(uint32_t numblocks) {
+    TigerKDFSchedule *schedule = (TigerKDFSchedule *)malloc(sizeof(TigerKDFSchedule) +
+        numblocks*sizeof(uint32_t));
+    if(schedule == NULL) {
+        return NULL;
+    }
+    schedule->numblocks = numblocks;
+    schedule->refs = 0;
+    schedule->from[0] = 0;
+    uint32_t i;
+    for(i = 1; i < numblocks; i++) {
+        schedule->from[i] = scheduleFrom(i);
+    }
+    return schedule;
+}
+
+// Return the schedule for numblocks, building it if it is not cached.  Returns NULL if numblocks is too large to
+// cache or memory is short, in which case compute the addresses on the fly.
+TigerKDFSchedule *acquireSchedule(uint32_t numblocks) {
+    if(numblocks > TIGERKDF_MAX_SCHEDULE_BLOCKS) {
+        return NULL;
+    }
+    pthread_mutex_lock(&scheduleMutex);
+    TigerKDFSchedule *schedule = schedules;
+    while(schedule != NULL && schedule->numblocks != numblocks) {
+        schedule = schedule->next;
+    }
+    if(schedule == NULL) {
+        // Building is cheap next to the hash, so do it under the lock rather than have two threads race to it.
+        schedule = buildSchedule(numblocks);
+        if(schedule == NULL) {
+            pthread_mutex_unlock(&scheduleMutex);
+            return NULL;
+        }
+        schedule->next = schedules;
+        schedules = schedule;
+    } else if(schedule->refs == 0) {
+        unusedScheduleBytes -= numblocks*sizeof(uint32_t);
+    }
+    schedule->refs++;
+    pthread_mutex_unlock(&scheduleMutex);
+    return schedule;
+}
+
+// Release a schedule returned by acquireSchedule, which may be NULL.  When unused schedules take more than the
+// cache size, free unused ones, this one last.
+void releaseSchedule(TigerKDFSchedule *schedule) {
+    if(schedule == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&scheduleMutex);
+    if(--schedule->refs == 0) {
+        unusedScheduleBytes += schedule->numblocks*sizeof(uint32_t);
+        TigerKDFSchedule **link = &schedules;
+        while(*link != NULL && unusedScheduleBytes > TIGERKDF_SCHEDULE_CACHE_BYTES) {
+            TigerKDFSchedule *s = *link;
+            if(s->refs == 0 && s != schedule) {
+                *link = s->next;
+                unusedScheduleBytes -= s->numblocks*sizeof(uint32_t);
+                free(s);
+            } else {
+                link = &s->next;
+            }
+        }
+        if(unusedScheduleBytes > TIGERKDF_SCHEDULE_CACHE_BYTES) {
+            for(link = &schedules; *link != schedule; link = &(*link)->next);
+            *link = schedule->next;
+            unusedScheduleBytes -= schedule->numblocks*sizeof(uint32_t);
+            free(schedule);
+        }
+    }
+    pthread_mutex_unlock(&scheduleMutex);
+}
+
+// One worker's share of the lanes, as next << 32 | end.  The owner takes lanes from next and thieves take them
+// from end, so each lane is run exactly once.  Shares sit on their own cache lines.
+struct TigerKDFLaneShareStruct {
+    _Alignas(64) atomic_uint_least64_t range;
+};
+
+struct TigerKDFLaneRunStruct {
+    TigerKDFLaneFunc lane;
+    void *arg;
+    struct TigerKDFLaneShareStruct *shares;
+    uint32_t workers;
+};
+
+struct TigerKDFLaneWorkerStruct {
+    struct TigerKDFLaneRunStruct *run;
+    uint32_t w;
+};
+
+// Take a lane from the front of a share, or from its end when stealing.  Returns false if it is empty.
+static bool takeLane(struct TigerKDFLaneShareStruct *share, bool steal, uint32_t *p) {
+    uint_least64_t range = atomic_load_explicit(&share->range, memory_order_relaxed);
+    while(true) {
+        uint32_t next = range >> 32;
+        uint32_t end = (uint32_t)range;
+        if(next >= end) {
+            return false;
+        }
+        uint_least64_t newRange = steal? (uint64_t)next << 32 | (end - 1) : (uint64_t)(next + 1) << 32 | end;
+        if(atomic_compare_exchange_weak_explicit(&share->range, &range, newRange, memory_order_relaxed,
+                memory_order_relaxed)) {
+            *p = steal? end - 1 : next;
+            return true;
+        }
+    }
+}
+
+// Run our own share of lanes, and then steal from the other workers until every share is empty.
+static void *laneWorker(void *workerPtr) {
+    struct TigerKDFLaneWorkerStruct *worker = (struct TigerKDFLaneWorkerStruct *)workerPtr;
+    struct TigerKDFLaneRunStruct *run = worker->run;
+    uint32_t p;
+    while(takeLane(run->shares + worker->w, false, &p)) {
+        run->lane(run->arg, p, worker->w);
+    }
+    uint32_t i;
+    for(i = 1; i < run->workers; i++) {
+        struct TigerKDFLaneShareStruct *victim = run->shares + (worker->w + i) % run->workers;
+        while(takeLane(victim, true, &p)) {
+            run->lane(run->arg, p, worker->w);
+        }
+    }
+    return NULL;
+}
+
+// Run lane(arg, p, w) for every p < parallelism on workers threads, counting the calling one.  Each worker runs its
+// own share of the lanes and then steals lanes from the others' shares.  Lanes of one phase must not wait on each
+// other.  Returns when every lane is done, so it is the barrier between phases.  If threads cannot be started,
+// the ones that did, or just the calling thread, run every lane.
+void runLanes(TigerKDFLaneFunc lane, void *arg, uint32_t parallelism, uint32_t workers) {
+    struct TigerKDFLaneRunStruct run;
+    run.lane = lane;
+    run.arg = arg;
+    run.workers = workers;
+    run.shares = NULL;
+    pthread_t *threads = NULL;
+    struct TigerKDFLaneWorkerStruct *w = NULL;
+    if(workers > 1) {
+        run.shares = (struct TigerKDFLaneShareStruct *)aligned_alloc(64,
+            workers*sizeof(struct TigerKDFLaneShareStruct));
+        threads = (pthread_t *)malloc(workers*sizeof(pthread_t));
+        w = (struct TigerKDFLaneWorkerStruct *)malloc(workers*sizeof(struct TigerKDFLaneWorkerStruct));
+    }
+    if(run.shares == NULL || threads == NULL || w == NULL) {
+        uint32_t p;
+        for(p = 0; p < parallelism; p++) {
+            lane(arg, p, 0);
+        }
+        free(w);
+        free(threads);
+        free(run.shares);
+        return;
+    }
+    uint32_t i;
+    for(i = 0; i < workers; i++) {
+        uint32_t first = (uint64_t)parallelism*i/workers;
+        uint32_t end = (uint64_t)parallelism*(i + 1)/workers;
+        atomic_init(&run.shares[i].range, (uint64_t)first << 32 | end);
+        w[i].run = &run;
+        w[i].w = i;
+    }
+    uint32_t started;
+    for(started = 1; started < workers; started++) {
+        if(pthread_create(threads + started, NULL, laneWorker, w + started)) {
+            break;
+        }
+    }
+    laneWorker(w);
+    for(i = 1; i < started; i++) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    free(w);
+    free(threads);
+    free(run.shares);
+}
+
+// Copy callerSize bytes of a caller's struct into ours of size bytes, zeroing the rest.  Returns false if the
+// caller's is smaller than minSize, or is larger and sets any byte past size.
+static bool copyCallerStruct(void *to, uint32_t size, const void *from, uint32_t callerSize, uint32_t minSize) {
+    if(callerSize < minSize) {
+        return false;
+    }
+    uint32_t i;
+    for(i = size; i < callerSize; i++) {
+        if(((const uint8_t *)from)[i] != 0) {
+            return false;
+        }
+    }
+    memset(to, 0, size);
+    memcpy(to, from, callerSize < size? callerSize : size);
+    return true;
+}
+
+// Copy the caller's options and stats into call.
+bool startCall(TigerKDFCall *call, const TigerKDFOptions *options) {
+    memset(call, 0, sizeof(TigerKDFCall));
+    if(options == NULL) {
+        return true;
+    }
+    if(!copyCallerStruct(&call->options, sizeof(TigerKDFOptions), options, options->size,
+            TIGERKDF_OPTIONS_MIN_SIZE)) {
+        return false;
+    }
+    call->callerOptions = options;
+    if(options->stats != NULL) {
+        if(!copyCallerStruct(&call->stats, sizeof(TigerKDFStats), options->stats, options->stats->size,
+                TIGERKDF_STATS_MIN_SIZE)) {
+            return false;
+        }
+        call->callerStats = options->stats;
+        call->options.stats = &call->stats;
+    }
+    return true;
+}
+
+// Copy the stats back into the caller's struct.
+void endCall(TigerKDFCall *call) {
+    TigerKDFStats *stats = call->callerStats;
+    if(stats != NULL) {
+        uint32_t size = stats->size;
+        memcpy(stats, &call->stats, size < sizeof(TigerKDFStats)? size : sizeof(TigerKDFStats));
+        stats->size = size;
+    }
+}
+
+// Return the number of workers to run parallelism lanes on, from options, which may be NULL.
+uint32_t getWorkers(const TigerKDFOptions *options, uint32_t parallelism) {
+    uint32_t workers = options != NULL? options->workers : 0;
+    if(workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0? cpus : 1;
+    }
+    return workers < parallelism? workers : parallelism;
+}
+
+// Return the current time in seconds, for TigerKDFStats.
+double getTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Read the process's page faults and resident set.
+static void readMemoryUsage(TigerKDFMemoryUsage *usage) {
+    memset(usage, 0, sizeof(TigerKDFMemoryUsage));
+    struct rusage rusage;
+    if(getrusage(RUSAGE_SELF, &rusage) == 0) {
+        usage->minorFaults = rusage.ru_minflt;
+        usage->majorFaults = rusage.ru_majflt;
+    }
+    // The second field of statm is the resident set in pages.
+    FILE *file = fopen("/proc/self/statm", "r");
+    if(file != NULL) {
+        unsigned long long size, resident;
+        if(fscanf(file, "%llu %llu", &size, &resident) == 2) {
+            usage->rssBytes = resident*sysconf(_SC_PAGESIZE);
+        }
+        fclose(file);
+    }
+}
+
+// Return the AnonHugePages bytes of the mapping in /proc/self/smaps that holds addr, or 0 if there is none.
+static uint64_t readHugePageBytes(const void *addr) {
+    FILE *file = fopen("/proc/self/smaps", "r");
+    if(file == NULL) {
+        return 0;
+    }
+    uint64_t hugePageBytes = 0;
+    bool inMapping = false;
+    char line[512];
+    while(fgets(line, sizeof(line), file) != NULL) {
+        unsigned long long start, end, kib;
+        // Each mapping starts with its address range, followed by lines of its fields.
+        if(sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+            if(inMapping) {
+                break;
+            }
+            inMapping = start <= (uintptr_t)addr && (uintptr_t)addr < end;
+        } else if(inMapping && sscanf(line, "AnonHugePages: %llu kB", &kib) == 1) {
+            hugePageBytes = (uint64_t)kib << 10;
+            break;
+        }
+    }
+    fclose(file);
+    return hugePageBytes;
+}
+
+// Read the memory counters at the start of a hash.
+void startMemoryStats(TigerKDFStats *stats, TigerKDFMemoryUsage *start) {
+    if(stats != NULL) {
+        readMemoryUsage(start);
+    }
+}
+
+// Fill in the memory stats of a hash that has not yet freed mem.
+void endMemoryStats(TigerKDFStats *stats, const TigerKDFMemoryUsage *start, const void *mem, uint64_t memBytes) {
+    if(stats == NULL) {
+        return;
+    }
+    TigerKDFMemoryUsage end;
+    readMemoryUsage(&end);
+    stats->minorFaults = end.minorFaults - start->minorFaults;
+    stats->majorFaults = end.majorFaults - start->majorFaults;
+    // Other threads may have freed memory meanwhile.
+    stats->rssBytes = end.rssBytes > start->rssBytes? end.rssBytes - start->rssBytes : 0;
+    // Small memory lives in the heap, whose mapping may be larger.
+    uint64_t hugePageBytes = readHugePageBytes(mem);
+    stats->hugePageBytes = hugePageBytes < memBytes? hugePageBytes : memBytes;
+}
+
+// Lanes check their control about this often.
+#define TIGERKDF_CONTROL_INTERVAL_BYTES (64 << 10)
+// Lanes may run this far ahead of their bandwidth caps after being idle, so that short stalls are made up for.
+#define TIGERKDF_BANDWIDTH_BURST_NANOS 1000000
+
+// The process wide bandwidth cap, in nanoseconds per byte, or zero, and when the bytes hashed so far by every
+// hash are paid for under it.
+static _Atomic double processNanosPerByte;
+static atomic_uint_least64_t processBandwidthDue;
+
+// Return nanoseconds per byte for a cap of gibPerSecond, or zero for no cap.
+static double nanosPerByte(double gibPerSecond) {
+    return gibPerSecond > 0.0? 1e9/(gibPerSecond*(1 << 30)) : 0.0;
+}
+
+// Cap the memory bandwidth of all hashes in the process together.
+void TigerKDF_SetProcessBandwidth(double gibPerSecond) {
+    atomic_store(&processNanosPerByte, nanosPerByte(gibPerSecond));
+}
+
+// Set up control from options.  Without anything to check, lanes never call checkControl.
+void initControl(TigerKDFControl *control, const TigerKDFOptions *options, uint32_t blockSize,
+        uint32_t repetitions) {
+    control->progress = options != NULL? options->progress : NULL;
+    control->progressArg = options != NULL? options->progressArg : NULL;
+    control->cancel = options != NULL? options->cancel : NULL;
+    control->deadline = options != NULL? options->deadline : 0.0;
+    control->nanosPerByte = nanosPerByte(options != NULL? options->maxBandwidth : 0.0);
+    control->processCapped = atomic_load(&processNanosPerByte) != 0.0;
+    control->bytesPerBlock = 3*(uint64_t)blockSize*repetitions;
+    atomic_init(&control->bandwidthDue, 0);
+    atomic_init(&control->throttleNanos, 0);
+    control->checkMask = UINT32_MAX;
+    if(control->progress != NULL || control->cancel != NULL || control->deadline != 0.0 ||
+            control->nanosPerByte != 0.0 || control->processCapped) {
+        uint32_t interval = 1;
+        while(interval*(uint64_t)blockSize < TIGERKDF_CONTROL_INTERVAL_BYTES) {
+            interval <<= 1;
+        }
+        control->checkMask = interval - 1;
+    }
+    atomic_init(&control->doneBlocks, 0);
+    atomic_init(&control->stop, false);
+}
+
+// Stop the hash if it has been cancelled or is past its deadline.  Returns false if it is stopped.
+static bool updateControlStop(TigerKDFControl *control) {
+    if((control->cancel != NULL && *control->cancel != 0) ||
+            (control->deadline != 0.0 && getTime() >= control->deadline)) {
+        atomic_store_explicit(&control->stop, true, memory_order_relaxed);
+    }
+    return !controlStopped(control);
+}
+
+// Start reporting on a phase of a garlic level.
+void startControlPhase(TigerKDFControl *control, uint8_t garlic, uint32_t phase, uint64_t phaseBlocks) {
+    control->garlic = garlic;
+    control->phase = phase;
+    control->phaseBlocks = phaseBlocks;
+    control->nextReport = 0;
+    atomic_store_explicit(&control->doneBlocks, 0, memory_order_relaxed);
+    atomic_store_explicit(&control->throttleNanos, 0, memory_order_relaxed);
+}
+
+// Pay for bytes under a cap of nanosPerByte, as a token bucket holding up to the burst.  Due is when everything
+// paid for so far is covered.  Returns how many nanoseconds after now this payment is covered.
+static uint64_t payBandwidth(atomic_uint_least64_t *due, double nanosPerByte, uint64_t bytes, uint64_t now) {
+    uint64_t cost = bytes*nanosPerByte;
+    uint_least64_t oldDue = atomic_load_explicit(due, memory_order_relaxed);
+    // Time we were under the cap only counts up to the burst.
+    uint64_t earliest = now - TIGERKDF_BANDWIDTH_BURST_NANOS;
+    uint64_t newDue;
+    do {
+        newDue = (oldDue > earliest? oldDue : earliest) + cost;
+    } while(!atomic_compare_exchange_weak_explicit(due, &oldDue, newDue, memory_order_relaxed,
+        memory_order_relaxed));
+    return newDue > now? newDue - now : 0;
+}
+
+// Sleep until the blocks a lane just hashed are paid for under both bandwidth caps.
+static void throttleBandwidth(TigerKDFControl *control, uint32_t blocks) {
+    uint64_t bytes = blocks*control->bytesPerBlock;
+    uint64_t now = getTime()*1e9;
+    uint64_t sleepNanos = 0;
+    if(control->nanosPerByte != 0.0) {
+        sleepNanos = payBandwidth(&control->bandwidthDue, control->nanosPerByte, bytes, now);
+    }
+    double processCost = control->processCapped? atomic_load(&processNanosPerByte) : 0.0;
+    if(processCost != 0.0) {
+        uint64_t processSleep = payBandwidth(&processBandwidthDue, processCost, bytes, now);
+        if(processSleep > sleepNanos) {
+            sleepNanos = processSleep;
+        }
+    }
+    if(sleepNanos != 0) {
+        struct timespec ts;
+        ts.tv_sec = sleepNanos/1000000000;
+        ts.tv_nsec = sleepNanos%1000000000;
+        nanosleep(&ts, NULL);
+        atomic_fetch_add_explicit(&control->throttleNanos, sleepNanos, memory_order_relaxed);
+    }
+}
+
+// Count the blocks worker w hashed since its last check, and report progress every 1% of the phase.
+bool checkControl(TigerKDFControl *control, uint32_t w, uint32_t blocks) {
+    if(control->checkMask == UINT32_MAX) {
+        return true;
+    }
+    uint64_t done = atomic_fetch_add_explicit(&control->doneBlocks, blocks, memory_order_relaxed) + blocks;
+    throttleBandwidth(control, blocks);
+    if(!updateControlStop(control)) {
+        return false;
+    }
+    if(w == 0 && control->progress != NULL && done >= control->nextReport) {
+        control->nextReport = done + control->phaseBlocks/100;
+        // The block each lane is on is not counted yet, so this is below 1 until endControlPhase.
+        control->progress(control->progressArg, control->garlic, control->phase, (double)done/control->phaseBlocks);
+    }
+    return true;
+}
+
+// End a phase, reporting it done if it was not stopped.
+bool endControlPhase(TigerKDFControl *control) {
+    if(control->checkMask == UINT32_MAX) {
+        return true;
+    }
+    if(!updateControlStop(control)) {
+        return false;
+    }
+    if(control->progress != NULL) {
+        control->progress(control->progressArg, control->garlic, control->phase, 1.0);
+    }
+    return true;
+}
+
+// Create and map the graph file options asks for, if any.  The file is sized up front, so that lanes write their
+// entries straight into their own part of the mapping, and the kernel writes them out as it sees fit.
+bool openGraph(TigerKDFGraph *graph, const TigerKDFOptions *options, uint32_t parallelism, uint32_t blockSize,
+        uint32_t numblocks, uint8_t startGarlic, uint8_t stopGarlic) {
+    memset(graph, 0, sizeof(TigerKDFGraph));
+    if(options == NULL || options->graphFile == NULL) {
+        return true;
+    }
+    // Each level has twice the blocks of the one before.
+    uint64_t numEntries = 2*(uint64_t)parallelism*numblocks*((2ULL << (stopGarlic - startGarlic)) - 1);
+    uint64_t mapBytes = sizeof(TigerKDFGraphHeader) + numEntries*sizeof(uint64_t);
+    int fd = open(options->graphFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "Unable to create graph file %s\n", options->graphFile);
+        return false;
+    }
+    void *map = MAP_FAILED;
+    if(ftruncate(fd, mapBytes) == 0) {
+        map = mmap(NULL, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map graph file %s\n", options->graphFile);
+        return false;
+    }
+    TigerKDFGraphHeader *header = (TigerKDFGraphHeader *)map;
+    memcpy(header->magic, TIGERKDF_GRAPH_MAGIC, sizeof(header->magic));
+    header->format = TIGERKDF_GRAPH_FORMAT;
+    header->parallelism = parallelism;
+    header->blockSize = blockSize;
+    header->numblocks = numblocks;
+    header->startGarlic = startGarlic;
+    header->stopGarlic = stopGarlic;
+    graph->map = map;
+    graph->mapBytes = mapBytes;
+    graph->entries = (uint64_t *)(header + 1);
+    return true;
+}
+
+// Unmap the graph file.
+void closeGraph(TigerKDFGraph *graph) {
+    if(graph->map != NULL) {
+        munmap(graph->map, graph->mapBytes);
+    }
+}
+
+// The bytes of memory a hash with these parameters uses.  MemSize is in KiB.
+uint64_t TigerKDF_ArenaSize(uint32_t memSize, uint8_t garlic, uint32_t blockSize, uint32_t parallelism) {
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    if(blocklen == 0 || parallelism == 0) {
+        return 0;
+    }
+    uint32_t numblocks = memlen/(2*parallelism*blocklen);
+    memlen = (2*parallelism*(uint64_t)numblocks*blocklen) << garlic;
+    // hashBlocks works on pairs of 16-byte vectors, so when the block size is not a multiple of 32 bytes it
+    // writes up to 16 bytes past the last block.  Leave room for that, and round to the alignment as
+    // aligned_alloc requires.
+    return (memlen*sizeof(uint32_t) + 16 + 31) & ~(uint64_t)31;
+}
+
+// Predict the seconds parallelism lanes of blocks each take on workers, at bytes of traffic per block.
+static double estimateLaneSeconds(const TigerKDFCostModel *model, uint64_t blocks, uint32_t parallelism,
+        uint32_t workers, uint64_t bytes) {
+    double blockSeconds = bytes/model->laneBytesPerSecond + 1.0/model->blake2sPerSecond;
+    // Lanes are not split between workers, so the worker with the most lanes finishes last.
+    double seconds = ((parallelism + workers - 1)/workers)*blocks*blockSeconds;
+    uint32_t cpus = model->cpus < workers? model->cpus : workers;
+    double shared = (double)parallelism*blocks*blockSeconds/cpus;
+    double memory = (double)parallelism*blocks*bytes/model->memoryBytesPerSecond;
+    seconds = shared > seconds? shared : seconds;
+    return memory > seconds? memory : seconds;
+}
+
+// Predict the cost of a hash, following the arithmetic of TigerKDF.  MemSize is in KiB.
+bool TigerKDF_EstimateCost(TigerKDFCost *cost, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock,
+        uint8_t startGarlic, uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options, const TigerKDFCostModel *model) {
+    memset(cost, 0, sizeof(TigerKDFCost));
+    TigerKDFCall call;
+    if(!startCall(&call, options) || !verifyParameters(hashSize, 1, 1, memSize, multipliesPerBlock, startGarlic,
+            stopGarlic, 0, blockSize, parallelism, repetitions)) {
+        return false;
+    }
+    options = callOptions(&call);
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    uint32_t numblocks = (memlen/(2*parallelism*blocklen)) << startGarlic;
+    uint32_t workers = getWorkers(options, parallelism);
+    cost->memBytes = TigerKDF_ArenaSize(memSize, stopGarlic, blockSize, parallelism);
+    cost->multHashBytes = 8*sizeof(uint32_t)*((2*parallelism*(uint64_t)numblocks) << (stopGarlic - startGarlic));
+    uint32_t lastNumblocks = numblocks << (stopGarlic - startGarlic);
+    if(lastNumblocks <= TIGERKDF_MAX_SCHEDULE_BLOCKS) {
+        cost->scheduleBytes = sizeof(TigerKDFSchedule) + lastNumblocks*sizeof(uint32_t);
+    }
+    // The multiply thread, and the lane workers besides the calling thread.
+    size_t stackSize = 0;
+    pthread_attr_t attr;
+    if(pthread_attr_init(&attr) == 0) {
+        (void)pthread_attr_getstacksize(&attr, &stackSize);
+        pthread_attr_destroy(&attr);
+    }
+    cost->stackBytes = (uint64_t)workers*stackSize;
+    cost->peakBytes = cost->memBytes + cost->multHashBytes + cost->scheduleBytes + cost->stackBytes;
+    uint64_t blockBytes = 3*(uint64_t)blockSize*repetitions;
+    uint64_t multipliesPerIteration = 8*(((uint64_t)multipliesPerBlock*repetitions + 7)/8);
+    double seconds = model != NULL? model->fixedSeconds : 0.0;
+    uint32_t i;
+    for(i = startGarlic; i <= stopGarlic; i++) {
+        uint64_t hashedBlocks = parallelism*(2*(uint64_t)numblocks - 1);
+        cost->trafficBytes += hashedBlocks*blockBytes + (uint64_t)parallelism*blockSize;
+        cost->blake2sCalls += hashedBlocks;
+        uint64_t multiplies = (2*(uint64_t)numblocks - 1)*multipliesPerIteration;
+        cost->multiplies += multiplies;
+        if(model != NULL) {
+            // The password independent lanes run alongside the multiply thread, which finishes all of its
+            // multiplies before the password dependent lanes start.
+            double lanes0 = estimateLaneSeconds(model, numblocks - 1, parallelism, workers, blockBytes);
+            double lanes1 = estimateLaneSeconds(model, numblocks, parallelism, workers, blockBytes);
+            double mult = multiplies/model->multipliesPerSecond;
+            double cpuSeconds = (double)parallelism*(numblocks - 1)*(blockBytes/model->laneBytesPerSecond +
+                1.0/model->blake2sPerSecond) + mult;
+            double phase0 = lanes0 > mult? lanes0 : mult;
+            if(cpuSeconds/model->cpus > phase0) {
+                phase0 = cpuSeconds/model->cpus;
+            }
+            seconds += phase0 + lanes1;
+        }
+        numblocks *= 2;
+    }
+    cost->seconds = seconds;
+    return true;
+}
+
+// The fields of a cost model file.
+static const struct {
+    const char *name;
+    size_t offset;
+} costModelFields[] = {
+    {"laneBytesPerSecond", offsetof(TigerKDFCostModel, laneBytesPerSecond)},
+    {"memoryBytesPerSecond", offsetof(TigerKDFCostModel, memoryBytesPerSecond)},
+    {"blake2sPerSecond", offsetof(TigerKDFCostModel, blake2sPerSecond)},
+    {"multipliesPerSecond", offsetof(TigerKDFCostModel, multipliesPerSecond)},
+    {"fixedSeconds", offsetof(TigerKDFCostModel, fixedSeconds)},
+};
+#define TIGERKDF_COST_MODEL_FIELDS (sizeof(costModelFields)/sizeof(costModelFields[0]))
+
+// Read a cost model.  Every field must be there, and every rate must be positive.
+bool TigerKDF_ReadCostModel(TigerKDFCostModel *model, const char *fileName) {
+    memset(model, 0, sizeof(TigerKDFCostModel));
+    FILE *file = fopen(fileName, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open cost model %s\n", fileName);
+        return false;
+    }
+    char line[256];
+    uint32_t found = 0;
+    bool passed = true;
+    while(passed && fgets(line, sizeof(line), file) != NULL) {
+        char name[64];
+        double value;
+        if(line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if(sscanf(line, "%63s %lf", name, &value) != 2 || value < 0.0) {
+            passed = false;
+        } else if(!strcmp(name, "cpus")) {
+            model->cpus = value;
+            found |= 1 << TIGERKDF_COST_MODEL_FIELDS;
+        } else {
+            uint32_t i;
+            for(i = 0; i < TIGERKDF_COST_MODEL_FIELDS; i++) {
+                if(!strcmp(name, costModelFields[i].name)) {
+                    *(double *)((uint8_t *)model + costModelFields[i].offset) = value;
+                    found |= 1 << i;
+                }
+            }
+        }
+    }
+    fclose(file);
+    // Only fixedSeconds may be zero.
+    if(!passed || found != (2u << TIGERKDF_COST_MODEL_FIELDS) - 1 || model->cpus == 0 ||
+            model->laneBytesPerSecond <= 0.0 || model->memoryBytesPerSecond <= 0.0 ||
+            model->blake2sPerSecond <= 0.0 || model->multipliesPerSecond <= 0.0) {
+        fprintf(stderr, "Invalid cost model %s\n", fileName);
+        return false;
+    }
+    return true;
+}
+
+// Write a cost model that TigerKDF_ReadCostModel can read back.
+bool TigerKDF_WriteCostModel(const TigerKDFCostModel *model, const char *fileName) {
+    FILE *file = fopen(fileName, "w");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to create cost model %s\n", fileName);
+        return false;
+    }
+    fprintf(file, "# TigerKDF cost model, from tigerkdf-bench calibrate\n");
+    fprintf(file, "cpus %u\n", model->cpus);
+    uint32_t i;
+    for(i = 0; i < TIGERKDF_COST_MODEL_FIELDS; i++) {
+        fprintf(file, "%s %.6g\n", costModelFields[i].name,
+            *(const double *)((const uint8_t *)model + costModelFields[i].offset));
+    }
+    if(fclose(file) != 0) {
+        fprintf(stderr, "Unable to write cost model %s\n", fileName);
+        return false;
+    }
+    return true;
+}
+
 // This is the crytographically strong password hashing function based on PBKDF2.
-void H(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize, uint8_t *salt,
+void TigerKDF_H(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize, uint8_t *salt,
         uint32_t saltSize) {
-    uint8_t result[hashSize];
-    PBKDF2_BLAKE2(password, passwordSize, salt, saltSize, 1, result, hashSize);
-    memcpy(hash, result, hashSize);
+    HVersion(hash, hashSize, password, passwordSize, salt, saltSize, TIGERKDF_VERSION_ORIGINAL);
+}
+
+// Outputs of HVersion that overlap its inputs are built in a temporary buffer, on the stack up to this size.
+#define HVERSION_STACK_BYTES 256
+
+// Return true if the size1 bytes at p1 and the size2 bytes at p2 overlap.
+static bool overlaps(const uint8_t *p1, uint32_t size1, const uint8_t *p2, uint32_t size2) {
+    uintptr_t a1 = (uintptr_t)p1, a2 = (uintptr_t)p2;
+    return p2 != NULL && a1 < a2 + size2 && a2 < a1 + size1;
+}
+
+// Derive size bytes of key from password and salt with the PBKDF2 the version selects, on at most maxThreads
+// threads, or the default number if it is 0.  Key must not overlap them.
+static void pbkdf2Version(uint8_t *key, uint32_t size, const uint8_t *password, uint32_t passwordSize,
+        const uint8_t *salt, uint32_t saltSize, uint32_t version, uint32_t maxThreads) {
+    if(version & TIGERKDF_VERSION_BLAKE2B) {
+        PBKDF2_BLAKE2B(password, passwordSize, salt, saltSize, 1, key, size);
+    } else {
+        PBKDF2_BLAKE2_Threads(password, passwordSize, salt, saltSize, 1, key, size, maxThreads);
+    }
+}
+
+// H computed with the hash function the version selects.  Hash may be the password or the salt.
+void HVersion(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize, uint8_t *salt,
+        uint32_t saltSize, uint32_t version) {
+    TIGERKDF_PROBE2(h_start, hashSize, version);
+    if(!overlaps(hash, hashSize, password, passwordSize) && !overlaps(hash, hashSize, salt, saltSize)) {
+        pbkdf2Version(hash, hashSize, password, passwordSize, salt, saltSize, version, 0);
+    } else {
+        uint8_t small[HVERSION_STACK_BYTES];
+        uint8_t *result = hashSize <= HVERSION_STACK_BYTES? small : (uint8_t *)malloc(hashSize);
+        if(result == NULL) {
+            // Leave no hash rather than a wrong one.
+            fprintf(stderr, "Unable to allocate memory\n");
+            memset(hash, 0, hashSize);
+            return;
+        }
+        pbkdf2Version(result, hashSize, password, passwordSize, salt, saltSize, version, 0);
+        memcpy(hash, result, hashSize);
+        memset(result, 0, hashSize);
+        if(result != small) {
+            free(result);
+        }
+    }
+    TIGERKDF_PROBE2(h_end, hashSize, version);
+}
+
+// Fill a BLAKE2Xs parameter block.  The 48-bit node offset holds the 32-bit output block number followed by
+// the 16-bit output length.
+static void setXofParam(blake2s_param *P, uint8_t digestLength, uint8_t fanout, uint8_t depth,
+        uint32_t leafLength, uint32_t blockNum, uint16_t xofLength, uint8_t innerLength) {
+    memset(P, 0, sizeof(blake2s_param));
+    P->digest_length = digestLength;
+    P->fanout = fanout;
+    P->depth = depth;
+    P->leaf_length = leafLength;
+    P->node_offset[0] = blockNum;
+    P->node_offset[1] = blockNum >> 8;
+    P->node_offset[2] = blockNum >> 16;
+    P->node_offset[3] = blockNum >> 24;
+    P->node_offset[4] = xofLength;
+    P->node_offset[5] = xofLength >> 8;
+    P->inner_length = innerLength;
+}
+
+// Expand the password hash into keySize bytes with BLAKE2Xs.  The root hash is computed once, and then every
+// 32-byte output block is a single BLAKE2s compression of it that does not depend on the other blocks.
+static void expandTreeKey(uint8_t *key, uint32_t keySize, uint8_t *hash, uint32_t hashSize, uint32_t p) {
+    // Lengths that do not fit in 16 bits are encoded as "unknown in advance".
+    uint16_t xofLength = keySize < 0xffff? keySize : 0xffff;
+    blake2s_param P;
+    blake2s_state S;
+    uint8_t s[sizeof(uint32_t)];
+    uint8_t root[BLAKE2S_OUTBYTES];
+    be32enc(s, p);
+    setXofParam(&P, BLAKE2S_OUTBYTES, 1, 1, 0, 0, xofLength, 0);
+    blake2s_init_param(&S, &P);
+    blake2s_update(&S, hash, hashSize);
+    blake2s_update(&S, s, sizeof(uint32_t));
+    blake2s_final(&S, root, BLAKE2S_OUTBYTES);
+    // Full output blocks are computed 8 at a time with multi-buffer BLAKE2s.
+    uint32_t i, j;
+    for(i = 0; (i + 8)*BLAKE2S_OUTBYTES <= keySize; i += 8) {
+        blake2s_state states[8];
+        blake2s_state *S8[8];
+        const uint8_t *in[8];
+        uint8_t *out[8];
+        for(j = 0; j < 8; j++) {
+            setXofParam(&P, BLAKE2S_OUTBYTES, 0, 0, BLAKE2S_OUTBYTES, i + j, xofLength, BLAKE2S_OUTBYTES);
+            blake2s_init_param(&states[j], &P);
+            S8[j] = &states[j];
+            in[j] = root;
+            out[j] = key + (i + j)*BLAKE2S_OUTBYTES;
+        }
+        blake2s_x8_update_final(S8, in, BLAKE2S_OUTBYTES, out, BLAKE2S_OUTBYTES);
+    }
+    for(; i*BLAKE2S_OUTBYTES < keySize; i++) {
+        uint32_t length = keySize - i*BLAKE2S_OUTBYTES;
+        if(length > BLAKE2S_OUTBYTES) {
+            length = BLAKE2S_OUTBYTES;
+        }
+        setXofParam(&P, length, 0, 0, BLAKE2S_OUTBYTES, i, xofLength, BLAKE2S_OUTBYTES);
+        blake2s_init_param(&S, &P);
+        blake2s_update(&S, root, BLAKE2S_OUTBYTES);
+        blake2s_final(&S, key + i*BLAKE2S_OUTBYTES, length);
+    }
+    memset(root, 0, BLAKE2S_OUTBYTES);
+}
+
+// Expand the password hash into the first block of lane p.  KeySize is in bytes.
+void expandThreadKey(uint8_t *key, uint32_t keySize, uint8_t *hash, uint32_t hashSize, uint32_t p,
+        uint32_t version, uint32_t maxThreads) {
+    if(version & TIGERKDF_VERSION_TREE_KEY) {
+        expandTreeKey(key, keySize, hash, hashSize, p);
+        return;
+    }
+    // Key is a lane's block, so it never overlaps hash or s, and is derived in place however large it is.
+    uint8_t s[sizeof(uint32_t)];
+    be32enc(s, p);
+    pbkdf2Version(key, keySize, hash, hashSize, s, sizeof(uint32_t), version, maxThreads);
+}
+
+// Hash the password and salt, and the data if there is any, into hash, which TigerKDF then stretches.
+static void hashPasswordAndData(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize,
+        uint8_t *salt, uint32_t saltSize, uint8_t *data, uint32_t dataSize, uint32_t version) {
+    if(data != NULL && dataSize != 0) {
+        uint8_t derivedSalt[hashSize];
+        HVersion(derivedSalt, hashSize, data, dataSize, salt, saltSize, version);
+        HVersion(hash, hashSize, password, passwordSize, derivedSalt, hashSize, version);
+    } else {
+        HVersion(hash, hashSize, password, passwordSize, salt, saltSize, version);
+    }
 }
 
 // A simple password hashing interface.  MemSize is in MiB.
@@ -40,60 +852,563 @@ bool TigerKDF_SimpleHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *pass
     if(!verifyParameters(hashSize, passwordSize, saltSize, memSize, 4096, 0, 0, 0, 16384, 1, 1)) {
         return false;
     }
-    H(hash, hashSize, password, passwordSize, salt, saltSize);
-    return TigerKDF(hash, hashSize, memSize, 4096, 0, 0, 16384, 1, 1, false);
+    TigerKDF_H(hash, hashSize, password, passwordSize, salt, saltSize);
+    return TigerKDF(hash, hashSize, memSize, 4096, 0, 0, 16384, 1, 1, false, NULL);
 }
 
 // The full password hashing interface.  MemSize is in MiB.
 bool TigerKDF_HashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
         uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
         uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions) {
-    if(!verifyParameters(hashSize, passwordSize, saltSize, memSize, multipliesPerBlock, 0, garlic, dataSize,
-            blockSize, parallelism, repetitions)) {
+    return TigerKDF_HashPasswordExt(hash, hashSize, password, passwordSize, salt, saltSize, memSize,
+        multipliesPerBlock, garlic, data, dataSize, blockSize, parallelism, repetitions, NULL);
+}
+
+// The full password hashing interface with options, which may be NULL.  MemSize is in MiB.
+bool TigerKDF_HashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
+        uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
+        uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options) || !verifyParameters(hashSize, passwordSize, saltSize, memSize,
+            multipliesPerBlock, 0, garlic, dataSize, blockSize, parallelism, repetitions)) {
         return false;
     }
-    if(data != NULL && dataSize != 0) {
-        uint8_t derivedSalt[hashSize];
-        H(derivedSalt, hashSize, data, dataSize, salt, saltSize);
-        H(hash, hashSize, password, passwordSize, derivedSalt, hashSize);
+    options = callOptions(&call);
+    hashPasswordAndData(hash, hashSize, password, passwordSize, salt, saltSize, data, dataSize,
+        getVersion(options));
+    bool passed = TigerKDF(hash, hashSize, memSize, multipliesPerBlock, 0, garlic, blockSize, parallelism,
+        repetitions, false, options);
+    endCall(&call);
+    return passed;
+}
+
+// Prefix of the salt the subkeys are expanded with, so that they never collide with other uses of PBKDF2.
+#define TIGERKDF_SUBKEY_CONTEXT "TigerKDF subkeys"
+
+// Derive the subkeys from one hash of the password.
+bool TigerKDF_DeriveSubkeys(TigerKDFSubkey *subkeys, uint32_t numSubkeys, uint8_t *password, uint8_t passwordSize,
+        uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
+        uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options)) {
+        return false;
+    }
+    // The salt holds each label and key size, with the label's length before it, so that no two lists of
+    // subkeys give the same salt.
+    uint64_t contextSize = sizeof(TIGERKDF_SUBKEY_CONTEXT) - 1;
+    uint64_t totalSize = 0;
+    uint32_t i;
+    for(i = 0; i < numSubkeys; i++) {
+        if(subkeys[i].label == NULL || subkeys[i].key == NULL || subkeys[i].keySize == 0) {
+            return false;
+        }
+        contextSize += 2*sizeof(uint32_t) + strlen(subkeys[i].label);
+        totalSize += subkeys[i].keySize;
+    }
+    if(numSubkeys == 0 || contextSize > UINT32_MAX || totalSize > UINT32_MAX) {
+        return false;
+    }
+    uint8_t *context = (uint8_t *)malloc(contextSize);
+    uint8_t *keys = (uint8_t *)malloc(totalSize);
+    uint8_t hash[32];
+    bool passed = context != NULL && keys != NULL && TigerKDF_HashPasswordExt(hash, sizeof(hash), password,
+        passwordSize, salt, saltSize, memSize, multipliesPerBlock, garlic, data, dataSize, blockSize, parallelism,
+        repetitions, options);
+    if(passed) {
+        uint8_t *c = context;
+        memcpy(c, TIGERKDF_SUBKEY_CONTEXT, sizeof(TIGERKDF_SUBKEY_CONTEXT) - 1);
+        c += sizeof(TIGERKDF_SUBKEY_CONTEXT) - 1;
+        for(i = 0; i < numSubkeys; i++) {
+            uint32_t labelSize = strlen(subkeys[i].label);
+            be32enc(c, labelSize);
+            memcpy(c + sizeof(uint32_t), subkeys[i].label, labelSize);
+            be32enc(c + sizeof(uint32_t) + labelSize, subkeys[i].keySize);
+            c += 2*sizeof(uint32_t) + labelSize;
+        }
+        HVersion(keys, totalSize, hash, sizeof(hash), context, contextSize, getVersion(callOptions(&call)));
+        uint8_t *k = keys;
+        for(i = 0; i < numSubkeys; i++) {
+            memcpy(subkeys[i].key, k, subkeys[i].keySize);
+            k += subkeys[i].keySize;
+        }
+        memset(keys, 0, totalSize);
+    }
+    memset(hash, 0, sizeof(hash));
+    free(keys);
+    free(context);
+    return passed;
+}
+
+// Where a job is: the next block to hash is block i of lane p's half for phase, at garlic, once the lane is
+// started.  Block 0 of a password independent half is the lane's key, which starting the lane writes.
+struct TigerKDFJobStruct {
+    uint8_t *hash;
+    uint32_t hashSize;
+    uint32_t memSize;
+    uint32_t multipliesPerBlock;
+    uint32_t blockSize;
+    uint32_t blocklen;
+    uint32_t parallelism;
+    uint32_t repetitions;
+    uint32_t version;
+    uint8_t garlic;
+    uint8_t stopGarlic;
+    bool finished;
+    bool failed;
+    void *arena;
+    uint64_t arenaSize;
+    uint32_t *mem;
+    uint32_t *multHashes;
+    TigerKDFHashBlocksFunc hashBlocks;
+    uint32_t numblocks;
+    uint32_t phase;
+    uint32_t p;
+    uint32_t i;
+    bool laneStarted;
+    uint32_t state[8];
+    // The multiply chain of this garlic level, and how many of its states are in multHashes.
+    uint32_t multState[8];
+    uint32_t completedMultiplies;
+    // The graph file options asked for, with entries pointing at the job's garlic level.
+    TigerKDFGraph graph;
+    // Set while the job is queued in a pool.  Once the pool has admitted it, poolBytes of its memory count
+    // against the pool's limit until it is done.
+    struct TigerKDFJobStruct *next;
+    bool admitted;
+    uint64_t poolBytes;
+    double deadline;
+    uint64_t sequence;
+    TigerKDFJobDoneFunc doneFunc;
+    void *doneArg;
+};
+
+// Create a job for the hash TigerKDF_HashPasswordExt would compute.
+TigerKDFJob *TigerKDF_CreateJob(uint32_t hashSize, uint8_t *password, uint8_t passwordSize, uint8_t *salt,
+        uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic, uint8_t *data,
+        uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options) || !verifyParameters(hashSize, passwordSize, saltSize, memSize,
+            multipliesPerBlock, 0, garlic, dataSize, blockSize, parallelism, repetitions)) {
+        return NULL;
+    }
+    options = callOptions(&call);
+    TigerKDFJob *job = (TigerKDFJob *)calloc(1, sizeof(TigerKDFJob));
+    uint8_t *hash = (uint8_t *)malloc(hashSize);
+    if(job == NULL || hash == NULL) {
+        free(hash);
+        free(job);
+        return NULL;
+    }
+    job->hash = hash;
+    job->hashSize = hashSize;
+    job->memSize = memSize;
+    job->multipliesPerBlock = multipliesPerBlock;
+    job->blockSize = blockSize;
+    job->blocklen = blockSize/sizeof(uint32_t);
+    job->parallelism = parallelism;
+    job->repetitions = repetitions;
+    job->version = getVersion(options);
+    job->stopGarlic = garlic;
+    if(options != NULL) {
+        job->arena = options->arena;
+        job->arenaSize = options->arenaSize;
+    }
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    job->numblocks = memlen/(2*parallelism*job->blocklen);
+    if(!openGraph(&job->graph, options, parallelism, blockSize, job->numblocks, 0, garlic)) {
+        free(hash);
+        free(job);
+        return NULL;
+    }
+    hashPasswordAndData(hash, hashSize, password, passwordSize, salt, saltSize, data, dataSize, job->version);
+    return job;
+}
+
+// Allocate the memory a job hashes in, as TigerKDF does.
+static bool allocateJob(TigerKDFJob *job) {
+    uint64_t memBytes = TigerKDF_ArenaSize(job->memSize, job->stopGarlic, job->blockSize, job->parallelism);
+    TigerKDFOptions options = TIGERKDF_OPTIONS_INIT;
+    options.arena = job->arena;
+    options.arenaSize = job->arenaSize;
+    job->arena = getArena(&options, memBytes);
+    job->mem = job->arena != NULL? (uint32_t *)job->arena : (uint32_t *)aligned_alloc(32, memBytes);
+    // Lanes only use the first numblocks states of the multiply chain, so that is all a job computes.
+    uint64_t lastNumblocks = (uint64_t)job->numblocks << job->stopGarlic;
+    job->multHashes = (uint32_t *)malloc(lastNumblocks*8*sizeof(uint32_t));
+    if(job->mem == NULL || job->multHashes == NULL) {
+        return false;
+    }
+    if(job->blockSize % 32 != 0) {
+        memset(job->mem, 0, memBytes);
+    }
+    job->hashBlocks = selectHashBlocks(job->blocklen, job->repetitions, true);
+    return true;
+}
+
+// Extend the multiply chain of the job's garlic level until it has a state for block i, as multHash does.
+static void extendMultiplies(TigerKDFJob *job, uint32_t i) {
+    uint32_t *state = job->multState;
+    while(job->completedMultiplies <= i) {
+        memcpy(job->multHashes + 8*job->completedMultiplies, state, 8*sizeof(uint32_t));
+        job->completedMultiplies++;
+        uint32_t j;
+        for(j = 0; j < job->multipliesPerBlock * job->repetitions; j += 8) {
+            state[0] = (state[0]*(state[1] | 1)) ^ (state[2] >> 1);
+            state[1] = (state[1]*(state[2] | 1)) ^ (state[3] >> 1);
+            state[2] = (state[2]*(state[3] | 1)) ^ (state[4] >> 1);
+            state[3] = (state[3]*(state[4] | 1)) ^ (state[5] >> 1);
+            state[4] = (state[4]*(state[5] | 1)) ^ (state[6] >> 1);
+            state[5] = (state[5]*(state[6] | 1)) ^ (state[7] >> 1);
+            state[6] = (state[6]*(state[7] | 1)) ^ (state[0] >> 1);
+            state[7] = (state[7]*(state[0] | 1)) ^ (state[1] >> 1);
+        }
+    }
+}
+
+// Start a lane, or at lane 0 of phase 0 a garlic level, where the multiply chain starts from the hash so far.
+static void startJobLane(TigerKDFJob *job) {
+    uint32_t i;
+    for(i = 0; i < 8; i++) {
+        job->state[i] = 1;
+    }
+    job->laneStarted = true;
+    job->i = 0;
+    if(job->phase == 1) {
+        return;
+    }
+    if(job->p == 0) {
+        uint8_t s[sizeof(uint32_t)];
+        be32enc(s, job->parallelism);
+        uint8_t threadKey[32];
+        HVersion(threadKey, 32, job->hash, job->hashSize, s, sizeof(uint32_t), job->version);
+        be32dec_vect(job->multState, threadKey, 32);
+        job->completedMultiplies = 0;
+    }
+    uint64_t start = 2*job->p*(uint64_t)job->numblocks*job->blocklen;
+    if(job->graph.entries != NULL) {
+        job->graph.entries[start/job->blocklen] = TIGERKDF_GRAPH_NO_BLOCK;
+    }
+    uint8_t *threadKey = (uint8_t *)(job->mem + start);
+    // Jobs share the CPUs with other jobs, so a job derives its keys on its own thread.
+    expandThreadKey(threadKey, job->blockSize, job->hash, job->hashSize, job->p, job->version, 1);
+    be32dec_vect_fast(job->mem + start, threadKey, job->blockSize);
+    job->i = 1;
+}
+
+// Hash block i of the job's lane, as hashWithoutPassword or hashWithPassword would, and move on.
+static void hashJobBlock(TigerKDFJob *job) {
+    uint32_t i = job->i;
+    uint32_t blocklen = job->blocklen;
+    uint64_t toAddr, fromAddr;
+    if(job->phase == 0) {
+        uint64_t start = 2*job->p*(uint64_t)job->numblocks*blocklen;
+        toAddr = start + (uint64_t)i*blocklen;
+        fromAddr = start + (uint64_t)blocklen*scheduleFrom(i);
     } else {
-        H(hash, hashSize, password, passwordSize, salt, saltSize);
+        toAddr = ((2*job->p + 1)*(uint64_t)job->numblocks + i)*blocklen;
+        fromAddr = passwordFromAddr(job->state[0], i, job->p, job->numblocks, job->parallelism, blocklen);
+    }
+    job->hashBlocks(job->state, job->mem, blocklen, fromAddr, toAddr, job->repetitions);
+    addGraphEdge(job->graph.entries, toAddr, fromAddr, blocklen);
+    extendMultiplies(job, i);
+    uint32_t j;
+    for(j = 0; j < 8; j++) {
+        job->state[j] ^= job->multHashes[i*8 + j];
+    }
+    uint8_t buf[32];
+    be32enc_vect_fast(buf, job->state, 32);
+    blake2s(buf, buf, NULL, 32, 32, 0);
+    be32dec_vect_fast(job->state, buf, 32);
+    job->i++;
+}
+
+// Finish a garlic level: XOR the last word of each lane into the hash, and rehash it.
+static void finishJobLevel(TigerKDFJob *job) {
+    uint8_t data[job->hashSize];
+    uint32_t p;
+    for(p = 0; p < job->parallelism; p++) {
+        uint64_t pos = 2*(p + 1)*(uint64_t)job->numblocks*job->blocklen - job->hashSize/sizeof(uint32_t);
+        be32enc_vect_fast(data, job->mem + pos, job->hashSize);
+        uint32_t i;
+        for(i = 0; i < job->hashSize; i++) {
+            job->hash[i] ^= data[i];
+        }
+    }
+    HVersion(job->hash, job->hashSize, job->hash, job->hashSize, &job->garlic, 1, job->version);
+}
+
+// Hash up to blocks more blocks of a job.
+bool TigerKDF_RunJob(TigerKDFJob *job, uint64_t blocks) {
+    if(job->mem == NULL && !job->finished && !allocateJob(job)) {
+        job->failed = true;
+        job->finished = true;
+    }
+    while(!job->finished && blocks > 0) {
+        if(!job->laneStarted) {
+            startJobLane(job);
+            // The key counts as the lane's first block.
+            blocks -= job->phase == 0;
+            continue;
+        }
+        if(job->i < job->numblocks) {
+            hashJobBlock(job);
+            blocks--;
+            continue;
+        }
+        job->laneStarted = false;
+        if(++job->p < job->parallelism) {
+            continue;
+        }
+        job->p = 0;
+        if(++job->phase < 2) {
+            continue;
+        }
+        job->phase = 0;
+        finishJobLevel(job);
+        if(job->graph.entries != NULL) {
+            job->graph.entries += 2*(uint64_t)job->parallelism*job->numblocks;
+        }
+        job->numblocks *= 2;
+        job->finished = job->garlic++ == job->stopGarlic;
+    }
+    return job->finished;
+}
+
+// Copy out the hash of a done job, and free it.
+bool TigerKDF_FinishJob(TigerKDFJob *job, uint8_t *hash) {
+    bool passed = job->finished && !job->failed;
+    if(passed) {
+        memcpy(hash, job->hash, job->hashSize);
+    }
+    if(job->arena == NULL) {
+        free(job->mem);
+    }
+    closeGraph(&job->graph);
+    free(job->multHashes);
+    free(job->hash);
+    free(job);
+    return passed;
+}
+
+struct TigerKDFPoolStruct {
+    pthread_mutex_t mutex;
+    // Signalled when a job is queued, the pool is stopping, or the last job is done.
+    pthread_cond_t queued;
+    TigerKDFJob *queue; // Sorted by deadline, with jobs without one last, and then by sequence
+    uint64_t sequence;
+    uint32_t running; // Jobs submitted that are not yet done
+    bool stopping;
+    uint64_t sliceBytes;
+    uint64_t maxBytes; // Zero for no limit
+    uint64_t admittedBytes; // Memory of the admitted jobs that are not yet done
+    uint32_t numThreads;
+    pthread_t *threads;
+};
+
+// Return true if job a should run before job b.
+static bool jobBefore(const TigerKDFJob *a, const TigerKDFJob *b) {
+    if(a->deadline != b->deadline) {
+        return b->deadline == 0.0 || (a->deadline != 0.0 && a->deadline < b->deadline);
     }
-    return TigerKDF(hash, hashSize, memSize, multipliesPerBlock, 0, garlic, blockSize, parallelism, repetitions, false);
+    return a->sequence < b->sequence;
+}
+
+// Put a job in the queue behind every job that should run before it.  Call with the mutex held.
+static void queueJob(TigerKDFPool *pool, TigerKDFJob *job) {
+    job->sequence = pool->sequence++;
+    TigerKDFJob **link = &pool->queue;
+    while(*link != NULL && jobBefore(*link, job)) {
+        link = &(*link)->next;
+    }
+    job->next = *link;
+    *link = job;
+    pthread_cond_signal(&pool->queued);
+}
+
+// Take the first queued job that is admitted, or that fits in what is left of the pool's memory limit, and
+// admit it.  Jobs are admitted in queue order, so a large job is not passed over for ever by smaller ones behind
+// it, and a job larger than the limit is admitted once no other job is.  Returns NULL if there is no such job.
+// Call with the mutex held.
+static TigerKDFJob *takeJob(TigerKDFPool *pool) {
+    bool admitting = true;
+    TigerKDFJob **link;
+    for(link = &pool->queue; *link != NULL; link = &(*link)->next) {
+        TigerKDFJob *job = *link;
+        if(!job->admitted) {
+            uint64_t bytes = TigerKDF_ArenaSize(job->memSize, job->stopGarlic, job->blockSize, job->parallelism);
+            if(!admitting || (pool->maxBytes != 0 && pool->admittedBytes != 0 &&
+                    pool->admittedBytes + bytes > pool->maxBytes)) {
+                admitting = false;
+                continue;
+            }
+            job->admitted = true;
+            job->poolBytes = bytes;
+            pool->admittedBytes += bytes;
+        }
+        *link = job->next;
+        return job;
+    }
+    return NULL;
+}
+
+// Run a slice of the first job takeJob gives at a time until the pool stops and every job is done.
+static void *poolWorker(void *poolPtr) {
+    TigerKDFPool *pool = (TigerKDFPool *)poolPtr;
+    pthread_mutex_lock(&pool->mutex);
+    while(true) {
+        TigerKDFJob *job;
+        while((job = takeJob(pool)) == NULL && !(pool->stopping && pool->running == 0)) {
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+        }
+        if(job == NULL) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        uint64_t blocks = pool->sliceBytes/job->blockSize;
+        // The done function may free the job.
+        uint64_t poolBytes = job->poolBytes;
+        bool done = TigerKDF_RunJob(job, blocks > 0? blocks : 1);
+        if(done) {
+            job->doneFunc(job->doneArg, job);
+        }
+        pthread_mutex_lock(&pool->mutex);
+        if(!done) {
+            queueJob(pool, job);
+        } else {
+            pool->admittedBytes -= poolBytes;
+            pool->running--;
+            // Workers waiting to admit a job, or to stop, check again.
+            pthread_cond_broadcast(&pool->queued);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+// Start the pool's workers.
+TigerKDFPool *TigerKDF_CreatePool(uint32_t workers, uint64_t sliceBytes, uint64_t maxBytes) {
+    if(workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0? cpus : 1;
+    }
+    TigerKDFPool *pool = (TigerKDFPool *)calloc(1, sizeof(TigerKDFPool));
+    pthread_t *threads = (pthread_t *)malloc(workers*sizeof(pthread_t));
+    if(pool == NULL || threads == NULL) {
+        free(threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pool->sliceBytes = sliceBytes;
+    pool->maxBytes = maxBytes;
+    pool->threads = threads;
+    while(pool->numThreads < workers &&
+            pthread_create(threads + pool->numThreads, NULL, poolWorker, pool) == 0) {
+        pool->numThreads++;
+    }
+    if(pool->numThreads == 0) {
+        TigerKDF_DestroyPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Queue a job in the pool.
+void TigerKDF_SubmitJob(TigerKDFPool *pool, TigerKDFJob *job, double deadline, TigerKDFJobDoneFunc done,
+        void *arg) {
+    job->deadline = deadline;
+    job->admitted = false;
+    job->doneFunc = done;
+    job->doneArg = arg;
+    pthread_mutex_lock(&pool->mutex);
+    pool->running++;
+    queueJob(pool, job);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Let the workers finish every job, then stop them.
+void TigerKDF_DestroyPool(TigerKDFPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    uint32_t i;
+    for(i = 0; i < pool->numThreads; i++) {
+        (void)pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
 }
 
 // Update an existing password hash to a more difficult level of garlic.
 bool TigerKDF_UpdatePasswordHash(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock,
         uint8_t oldGarlic, uint8_t newGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions) {
-    if(!verifyParameters(hashSize, 16, 16, memSize, multipliesPerBlock, oldGarlic, newGarlic, 0,
-            blockSize, parallelism, repetitions)) {
+    return TigerKDF_UpdatePasswordHashExt(hash, hashSize, memSize, multipliesPerBlock, oldGarlic, newGarlic,
+        blockSize, parallelism, repetitions, NULL);
+}
+
+// Update an existing password hash with options, which must select the version the hash was made with.
+bool TigerKDF_UpdatePasswordHashExt(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock,
+        uint8_t oldGarlic, uint8_t newGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options) || !verifyParameters(hashSize, 16, 16, memSize, multipliesPerBlock, oldGarlic,
+            newGarlic, 0, blockSize, parallelism, repetitions)) {
         return false;
     }
-    return TigerKDF(hash, hashSize, memSize, multipliesPerBlock, oldGarlic, newGarlic, blockSize, parallelism,
-            repetitions, false);
+    bool passed = TigerKDF(hash, hashSize, memSize, multipliesPerBlock, oldGarlic, newGarlic, blockSize,
+        parallelism, repetitions, false, callOptions(&call));
+    endCall(&call);
+    return passed;
 }
 
 // Client-side portion of work for server-relief mode.
 bool TigerKDF_ClientHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
         uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
         uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions) {
-    if(!verifyParameters(hashSize, passwordSize, saltSize, memSize, multipliesPerBlock, 0, garlic, dataSize,
-            blockSize, parallelism, repetitions)) {
+    return TigerKDF_ClientHashPasswordExt(hash, hashSize, password, passwordSize, salt, saltSize, memSize,
+        multipliesPerBlock, garlic, data, dataSize, blockSize, parallelism, repetitions, NULL);
+}
+
+// Client-side portion of work for server-relief mode, with options.
+bool TigerKDF_ClientHashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
+        uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
+        uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options) || !verifyParameters(hashSize, passwordSize, saltSize, memSize,
+            multipliesPerBlock, 0, garlic, dataSize, blockSize, parallelism, repetitions)) {
         return false;
     }
-    if(data != NULL && dataSize != 0) {
-        uint8_t derivedSalt[hashSize];
-        H(derivedSalt, hashSize, data, dataSize, salt, saltSize);
-        H(hash, hashSize, password, passwordSize, derivedSalt, hashSize);
-    } else {
-        H(hash, hashSize, password, passwordSize, salt, saltSize);
-    }
-    return TigerKDF(hash, hashSize, memSize, multipliesPerBlock, 0, garlic, blockSize, parallelism, repetitions, true);
+    options = callOptions(&call);
+    hashPasswordAndData(hash, hashSize, password, passwordSize, salt, saltSize, data, dataSize,
+        getVersion(options));
+    bool passed = TigerKDF(hash, hashSize, memSize, multipliesPerBlock, 0, garlic, blockSize, parallelism,
+        repetitions, true, options);
+    endCall(&call);
+    return passed;
 }
 
 // Server portion of work for server-relief mode.
 void TigerKDF_ServerHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t garlic) {
-    H(hash, hashSize, hash, hashSize, &garlic, 1);
+    TigerKDF_ServerHashPasswordExt(hash, hashSize, garlic, NULL);
+}
+
+// Server portion of work for server-relief mode, with the options the client used.
+void TigerKDF_ServerHashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t garlic,
+        const TigerKDFOptions *options) {
+    TigerKDFCall call;
+    if(!startCall(&call, options)) {
+        memset(hash, 0, hashSize);
+        return;
+    }
+    HVersion(hash, hashSize, hash, hashSize, &garlic, 1, getVersion(callOptions(&call)));
 }
 
 // This is the prototype required for the password hashing competition.
@@ -0,0 +1,319 @@
+// Declarations shared between tigerkdf-common.c and the hashing engines, but not part of the public API.
+#ifndef TIGERKDF_INTERNAL_H
+#define TIGERKDF_INTERNAL_H
+
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "tigerkdf.h"
+
+// The TigerKDF password hashing function.  MemSize is in KiB.  Options may be NULL.
+bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t startGarlic,
+        uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash,
+        const TigerKDFOptions *options);
+
+// H computed with the hash function the version selects.
+void HVersion(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize, uint8_t *salt,
+        uint32_t saltSize, uint32_t version);
+
+// Expand the password hash into the first block of lane p.  KeySize is in bytes.  Large keys are derived on at
+// most maxThreads threads, or one per CPU if it is 0, so engines whose lanes already run on several workers pass 1.
+void expandThreadKey(uint8_t *key, uint32_t keySize, uint8_t *hash, uint32_t hashSize, uint32_t p,
+        uint32_t version, uint32_t maxThreads);
+
+// Hash the block at fromAddr and the one before toAddr into the block at toAddr, repetitions times.  Addresses
+// and blocklen are in 32-bit words.
+typedef void (*TigerKDFHashBlocksFunc)(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr,
+        uint64_t toAddr, uint32_t repetitions);
+
+// Return the fastest hashBlocks kernel for blocklen and repetitions, or the generic one if specialized is false.
+// Returns testHashBlocks instead if it is set.
+TigerKDFHashBlocksFunc selectHashBlocks(uint32_t blocklen, uint32_t repetitions, bool specialized);
+
+// Hash two lanes' blocks in lockstep, giving each the same state and memory as a hashBlocks kernel would.  Only
+// tigerkdf-sse.c has these.
+typedef void (*TigerKDFHashBlocks2Func)(uint32_t state0[8], uint32_t state1[8], uint32_t *mem, uint32_t blocklen,
+        uint64_t fromAddr0, uint64_t toAddr0, uint64_t fromAddr1, uint64_t toAddr1, uint32_t repetitions);
+
+// Return the fastest two-lane kernel for blocklen and repetitions, or the generic one if specialized is false.
+// Returns testHashBlocks2 instead if it is set.
+TigerKDFHashBlocks2Func selectHashBlocks2(uint32_t blocklen, uint32_t repetitions, bool specialized);
+
+// Kernels the engines use instead of their own while they are not NULL.  The engines' kernels clear every word
+// they write (see tigerkdf-ref.c), so no hash depends on which blocks they read.  tigerkdf-test.c sets kernels
+// that mix in every word they read, so its checks see every address the engines compute.  Only change them while
+// no hash is running.
+extern TigerKDFHashBlocksFunc testHashBlocks;
+extern TigerKDFHashBlocks2Func testHashBlocks2;
+
+// The password independent address schedule for one numblocks: hashWithoutPassword hashes block from[i] of its
+// lane into block i.  Schedules are cached, and shared read-only by every thread and hash that uses the same
+// numblocks.
+typedef struct TigerKDFScheduleStruct {
+    struct TigerKDFScheduleStruct *next;
+    uint32_t numblocks;
+    uint32_t refs;
+    uint32_t from[];
+} TigerKDFSchedule;
+
+// Return the block of its lane that hashWithoutPassword hashes into block i, for i > 0: i with its bits below the
+// highest one reversed, moved up into the previous half of the lane when that is before i.
+static inline uint32_t scheduleFrom(uint32_t i) {
+    uint32_t mask = 1;
+    while(mask << 1 <= i) {
+        mask <<= 1;
+    }
+    uint32_t value = i;
+    uint32_t result = 0;
+    uint32_t m;
+    for(m = mask; m != 1; m >>= 1) {
+        result = (result << 1) | (value & 1);
+        value >>= 1;
+    }
+    if(result + mask < i) {
+        result += mask;
+    }
+    return result;
+}
+
+// Return the word address of the block that hashWithPassword hashes into block i of lane p's password dependent
+// half, from the first word of its state: a block of its own half before i, or for distances back past the start
+// of the half, a block of the password independent half of lane (p + i) % parallelism.
+static inline uint64_t passwordFromAddr(uint32_t state0, uint32_t i, uint32_t p, uint32_t numblocks,
+        uint32_t parallelism, uint32_t blocklen) {
+    uint64_t v = state0;
+    uint64_t v2 = v*v >> 32;
+    uint64_t v3 = v*v2 >> 32;
+    uint32_t distance = (i + numblocks - 1)*v3 >> 32;
+    if(distance < i) {
+        return ((2*p + 1)*(uint64_t)numblocks + i - 1 - distance)*blocklen;
+    }
+    uint32_t q = (p + i) % parallelism;
+    uint32_t b = numblocks - 1 - (distance - i);
+    return (2*numblocks*q + b)*(uint64_t)blocklen;
+}
+
+// Return the schedule for numblocks, building it if it is not cached.  Returns NULL if numblocks is too large to
+// cache or memory is short, in which case compute the addresses on the fly.
+TigerKDFSchedule *acquireSchedule(uint32_t numblocks);
+
+// Release a schedule returned by acquireSchedule, which may be NULL.
+void releaseSchedule(TigerKDFSchedule *schedule);
+
+// A task of one phase of the memory-hard part, run by runLanes: lane p, or the lanes numbered from p times the
+// lanes per task when they are interleaved.  W is the worker running it, below workers.
+typedef void (*TigerKDFLaneFunc)(void *arg, uint32_t p, uint32_t w);
+
+// Run lane(arg, p, w) for every p < parallelism on workers threads, counting the calling one.  Each worker runs its
+// own share of the lanes and then steals lanes from the others' shares.  Lanes of one phase must not wait on each
+// other.  Returns when every lane is done, so it is the barrier between phases.  If threads cannot be started,
+// the ones that did, or just the calling thread, run every lane.
+void runLanes(TigerKDFLaneFunc lane, void *arg, uint32_t parallelism, uint32_t workers);
+
+// Return the number of workers to run parallelism lanes on, from options, which may be NULL.
+uint32_t getWorkers(const TigerKDFOptions *options, uint32_t parallelism);
+
+// The graph file a hash is writing, mapped into memory.
+typedef struct TigerKDFGraphStruct {
+    void *map;
+    uint64_t mapBytes;
+    uint64_t *entries; // The current garlic level's, or NULL if options did not ask for a graph
+} TigerKDFGraph;
+
+// Create and map the graph file options asks for, if any, with entries pointing at the first level.  Returns
+// false if the file cannot be written.
+bool openGraph(TigerKDFGraph *graph, const TigerKDFOptions *options, uint32_t parallelism, uint32_t blockSize,
+        uint32_t numblocks, uint8_t startGarlic, uint8_t stopGarlic);
+
+// Unmap the graph file, which is complete once every level has been hashed.
+void closeGraph(TigerKDFGraph *graph);
+
+// Record in entries, which may be NULL, that block from was hashed into block to.  Addresses are in words.
+static inline void addGraphEdge(uint64_t *entries, uint64_t toAddr, uint64_t fromAddr, uint32_t blocklen) {
+    if(entries != NULL) {
+        entries[toAddr/blocklen] = fromAddr/blocklen;
+    }
+}
+
+// The progress reports, cancellation and deadline of a hash, shared by its threads.  Lanes call checkControl
+// when the block they are on is a multiple of checkMask + 1.
+typedef struct TigerKDFControlStruct {
+    TigerKDFProgressFunc progress;
+    void *progressArg;
+    const volatile int *cancel;
+    double deadline;
+    uint32_t checkMask; // UINT32_MAX if there is nothing to check
+    uint8_t garlic;
+    uint32_t phase;
+    uint64_t phaseBlocks;
+    uint64_t nextReport; // Only used by worker 0
+    atomic_uint_least64_t doneBlocks;
+    atomic_bool stop;
+    // The hash's bandwidth cap, and when the bytes hashed so far are paid for under it.
+    double nanosPerByte; // Zero if there is no cap
+    atomic_uint_least64_t bandwidthDue;
+    bool processCapped; // If the process wide cap was set when the hash started
+    uint64_t bytesPerBlock;
+    atomic_uint_least64_t throttleNanos; // Slept in this phase
+} TigerKDFControl;
+
+// Set up control from options, which may be NULL, for blocks of blockSize bytes hashed repetitions times.
+void initControl(TigerKDFControl *control, const TigerKDFOptions *options, uint32_t blockSize,
+        uint32_t repetitions);
+
+// Start reporting on a phase of a garlic level, which hashes phaseBlocks blocks over all lanes.
+void startControlPhase(TigerKDFControl *control, uint8_t garlic, uint32_t phase, uint64_t phaseBlocks);
+
+// Count blocks hashed by worker w since its last check, and report progress if w is 0.  Returns false if the hash
+// has been cancelled or is past its deadline.
+bool checkControl(TigerKDFControl *control, uint32_t w, uint32_t blocks);
+
+// End a phase started with startControlPhase, reporting it done.  Returns false if the hash was stopped.
+bool endControlPhase(TigerKDFControl *control);
+
+// Add the time lanes slept for bandwidth caps in the current phase of control to stats, which may be NULL.
+static inline void addThrottleStats(TigerKDFStats *stats, TigerKDFControl *control) {
+    if(stats != NULL) {
+        stats->throttleSeconds[control->phase] +=
+            atomic_load_explicit(&control->throttleNanos, memory_order_relaxed)*1e-9;
+    }
+}
+
+// Return true if the hash has been stopped, so threads waiting on each other should give up.
+static inline bool controlStopped(TigerKDFControl *control) {
+    return atomic_load_explicit(&control->stop, memory_order_relaxed);
+}
+
+// Return the current time in seconds, for TigerKDFStats.
+double getTime(void);
+
+// Process-wide memory counters at the start of a hash.
+typedef struct TigerKDFMemoryUsageStruct {
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t rssBytes;
+} TigerKDFMemoryUsage;
+
+// Read the memory counters at the start of a hash, if stats is not NULL, and at the end fill in the memory stats
+// from the difference and from the smaps entry of the mapping holding mem, which is memBytes long.  Call the end
+// before freeing mem.
+void startMemoryStats(TigerKDFStats *stats, TigerKDFMemoryUsage *start);
+void endMemoryStats(TigerKDFStats *stats, const TigerKDFMemoryUsage *start, const void *mem, uint64_t memBytes);
+
+// The sizes of the first released TigerKDFOptions and TigerKDFStats.  Fields added since then follow these.
+#define TIGERKDF_OPTIONS_MIN_SIZE (offsetof(TigerKDFOptions, interleave) + sizeof(uint32_t))
+#define TIGERKDF_STATS_MIN_SIZE (offsetof(TigerKDFStats, numLaneWaits) + sizeof(uint32_t))
+
+// The options a caller passed, copied into the structs this library was built with, so the rest of the library
+// can read and write every field.
+typedef struct TigerKDFCallStruct {
+    TigerKDFOptions options;
+    TigerKDFStats stats;
+    const TigerKDFOptions *callerOptions;
+    TigerKDFStats *callerStats;
+} TigerKDFCall;
+
+// Copy the caller's options, which may be NULL, and any stats they ask for, into call, zeroing the fields the
+// caller's struct does not have.  Returns false if either struct is smaller than its first release, or sets
+// fields past the end of ours.
+bool startCall(TigerKDFCall *call, const TigerKDFOptions *options);
+
+// Return the options to hash with, or NULL if the caller passed none.
+static inline const TigerKDFOptions *callOptions(const TigerKDFCall *call) {
+    return call->callerOptions != NULL? &call->options : NULL;
+}
+
+// Copy the stats back into the caller's struct, as many bytes of them as it has.
+void endCall(TigerKDFCall *call);
+
+// Return the algorithm version selected by options, which may be NULL.
+static inline uint32_t getVersion(const TigerKDFOptions *options) {
+    return options == NULL? TIGERKDF_VERSION_ORIGINAL : options->version;
+}
+
+// Return the arena in options if it can hold memBytes, and otherwise NULL.
+static inline void *getArena(const TigerKDFOptions *options, uint64_t memBytes) {
+    if(options == NULL || options->arena == NULL || options->arenaSize < memBytes ||
+            ((uintptr_t)options->arena & 31) != 0) {
+        return NULL;
+    }
+    return options->arena;
+}
+
+// Return the stats to fill in, cleared, or NULL if options does not ask for them.  The caller's lane histograms
+// are kept.
+static inline TigerKDFStats *getStats(const TigerKDFOptions *options) {
+    if(options == NULL || options->stats == NULL) {
+        return NULL;
+    }
+    TigerKDFStats *stats = options->stats;
+    TigerKDFHistogram *laneWaits = stats->laneWaits;
+    uint32_t numLaneWaits = stats->numLaneWaits;
+    memset(stats, 0, sizeof(TigerKDFStats));
+    stats->laneWaits = laneWaits;
+    stats->numLaneWaits = numLaneWaits;
+    return stats;
+}
+
+// Add one phase of one garlic level to stats, which may be NULL.  Each of the hashedBlocks blocks read two blocks
+// of blocklen words and wrote one, repetitions times.
+static inline void addPhaseStats(TigerKDFStats *stats, uint32_t phase, double seconds, uint64_t hashedBlocks,
+        uint32_t blocklen, uint32_t repetitions) {
+    if(stats != NULL) {
+        stats->phaseSeconds[phase] += seconds;
+        stats->phaseBytes[phase] += 3*hashedBlocks*blocklen*sizeof(uint32_t)*repetitions;
+    }
+}
+
+// Record in stats, which may be NULL, the size of a schedule a garlic level used.
+static inline void addScheduleStats(TigerKDFStats *stats, const TigerKDFSchedule *schedule) {
+    if(stats != NULL && schedule != NULL && schedule->numblocks*sizeof(uint32_t) > stats->scheduleBytes) {
+        stats->scheduleBytes = schedule->numblocks*sizeof(uint32_t);
+    }
+}
+
+// Return the per-lane wait histograms in stats, cleared, or NULL if stats, which may be NULL, does not have room
+// for parallelism lanes.
+static inline TigerKDFHistogram *getLaneWaits(TigerKDFStats *stats, uint32_t parallelism) {
+    if(stats == NULL || stats->laneWaits == NULL || stats->numLaneWaits < 2*(uint64_t)parallelism) {
+        return NULL;
+    }
+    memset(stats->laneWaits, 0, 2*(uint64_t)parallelism*sizeof(TigerKDFHistogram));
+    return stats->laneWaits;
+}
+
+// Count value in its bucket of histogram.
+static inline void addToHistogram(TigerKDFHistogram *histogram, uint64_t value) {
+    uint32_t bucket = value == 0? 0 : 64 - __builtin_clzll(value);
+    if(bucket >= TIGERKDF_HISTOGRAM_BUCKETS) {
+        bucket = TIGERKDF_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram->counts[bucket]++;
+}
+
+// Add the counts of from into to.
+static inline void mergeHistogram(TigerKDFHistogram *to, const TigerKDFHistogram *from) {
+    uint32_t i;
+    for(i = 0; i < TIGERKDF_HISTOGRAM_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+}
+
+// Count in histogram how many of the completed multiply blocks are ahead of the slowest lane.  Progress holds
+// the block each of workers lanes is on, or UINT32_MAX for workers between lanes.
+static inline void addMultLead(TigerKDFHistogram *histogram, atomic_uint_least32_t *progress, uint32_t workers,
+        uint32_t completed) {
+    uint32_t slowest = UINT32_MAX;
+    uint32_t w;
+    for(w = 0; w < workers; w++) {
+        uint32_t block = atomic_load_explicit(progress + w, memory_order_relaxed);
+        if(block < slowest) {
+            slowest = block;
+        }
+    }
+    if(slowest != UINT32_MAX) {
+        addToHistogram(histogram, completed > slowest? completed - slowest : 0);
+    }
+}
+
+#endif
@@ -0,0 +1,546 @@
+// A closed-loop load generator for TigerKDF.  Client threads hash passwords back to back, either in this process
+// or by sending tigerkdf batch records to a local socket, and we record how long each hash took.  By default we
+// double the number of clients until the throughput stops growing, to find where memory bandwidth contention
+// makes latency collapse.
+#define _POSIX_C_SOURCE 200809L // Otherwise getline is not included
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tigerkdf.h"
+#include "tigerkdf-batch.h"
+
+// Latencies are kept in nanoseconds, in buckets of 1/64th of a power of two, so percentiles are good to 2%.
+#define LOAD_SUB_BUCKET_BITS 6
+#define LOAD_SUB_BUCKETS (1 << LOAD_SUB_BUCKET_BITS)
+#define LOAD_BUCKETS ((65 - LOAD_SUB_BUCKET_BITS)*LOAD_SUB_BUCKETS)
+// A sweep stops after this many steps in a row that did not raise the throughput by 10%.
+#define LOAD_FLAT_STEPS 2
+
+typedef struct LoadHistogramStruct {
+    uint64_t counts[LOAD_BUCKETS];
+    uint64_t total;
+} LoadHistogram;
+
+// One set of parameters in the mix, picked with probability weight/totalWeight.
+struct LoadMixStruct {
+    TigerKDFBatchParams params;
+    uint32_t weight;
+};
+
+struct LoadStruct {
+    struct LoadMixStruct *mix;
+    uint32_t numMix;
+    uint32_t totalWeight;
+    const char *socketPath; // NULL to hash in this process
+    uint32_t workers; // TigerKDFOptions.workers for in-process hashes
+    double rate; // Hashes per second to start, over all clients, or 0 to start each when the last one finishes
+    double startTime;
+    double endTime;
+    atomic_bool stop;
+    atomic_uint_least64_t completed;
+    atomic_uint_least64_t errors;
+    atomic_uint_least64_t nextArrival;
+};
+
+struct LoadClientStruct {
+    struct LoadStruct *load;
+    uint32_t id;
+    uint64_t requests;
+    LoadHistogram histogram;
+    void *arena;
+    uint64_t arenaSize;
+    int fd; // The client's connection in socket mode
+};
+
+static void usage(char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, (char *)format, ap);
+    va_end(ap);
+    fprintf(stderr, "\nUsage: tigerkdf-load [OPTIONS]\n"
+        "    -h -g -m -M -r -t -b -V -- Hash parameters, as for tigerkdf (default 16 MiB, 1 lane)\n"
+        "    -x file         -- Parameter mix: lines of a weight followed by name=value overrides of the flags\n"
+        "                       above, such as \"3 m=8192 t=2\"\n"
+        "    -c clients      -- Run only this many clients, rather than doubling them up to -C\n"
+        "    -C clients      -- Most clients to try when looking for the knee (default 4 per CPU)\n"
+        "    -R rate         -- Start this many hashes per second over all clients, and count the time a hash\n"
+        "                       waited to start in its latency, rather than starting each as the last finishes\n"
+        "    -d seconds      -- How long to run each number of clients (default 5)\n"
+        "    -u socket       -- Send batch records to this Unix socket and read one line back for each, rather\n"
+        "                       than hashing in this process\n"
+        "    -P pid          -- Report the RSS of this process, such as the server in socket mode\n"
+        "    -w workers      -- TigerKDFOptions.workers for hashes in this process (default 1)\n"
+        "    -v              -- Print hashes/s and RSS every second\n");
+    exit(1);
+}
+
+static uint32_t readuint32_t(char flag, char *arg) {
+    char *endPtr;
+    char *p = arg;
+    uint32_t value = strtol(p, &endPtr, 0);
+    if(*p == '\0' || *endPtr != '\0') {
+        usage("Invalid integer for parameter -%c", flag);
+    }
+    return value;
+}
+
+// Return the current time in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Sleep until the time now() returns reaches when.
+static void sleepUntil(double when) {
+    double wait = when - now();
+    if(wait > 0.0) {
+        struct timespec ts;
+        ts.tv_sec = wait;
+        ts.tv_nsec = (wait - ts.tv_sec)*1e9;
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Return the bucket of a value.
+static uint32_t histogramBucket(uint64_t value) {
+    if(value < 2*LOAD_SUB_BUCKETS) {
+        return value;
+    }
+    uint32_t shift = 63 - __builtin_clzll(value) - LOAD_SUB_BUCKET_BITS;
+    return (shift + 1)*LOAD_SUB_BUCKETS + (value >> shift) - LOAD_SUB_BUCKETS;
+}
+
+// Return the smallest value in a bucket.
+static uint64_t bucketValue(uint32_t bucket) {
+    if(bucket < 2*LOAD_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t shift = bucket/LOAD_SUB_BUCKETS - 1;
+    return (uint64_t)(bucket % LOAD_SUB_BUCKETS + LOAD_SUB_BUCKETS) << shift;
+}
+
+static void addToHistogram(LoadHistogram *histogram, uint64_t value) {
+    histogram->counts[histogramBucket(value)]++;
+    histogram->total++;
+}
+
+static void mergeHistogram(LoadHistogram *to, const LoadHistogram *from) {
+    uint32_t i;
+    for(i = 0; i < LOAD_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+    to->total += from->total;
+}
+
+// Return the value below which the fraction of the histogram lies, to within a bucket.
+static uint64_t percentile(const LoadHistogram *histogram, double fraction) {
+    uint64_t target = fraction*histogram->total;
+    uint64_t seen = 0;
+    uint32_t i;
+    for(i = 0; i < LOAD_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if(seen > target) {
+            return bucketValue(i);
+        }
+    }
+    return 0;
+}
+
+// Return the resident set size of a process, or of this one if pid is 0, in bytes, or 0 if we cannot read it.
+static uint64_t readRss(uint32_t pid) {
+    char path[64];
+    if(pid == 0) {
+        snprintf(path, sizeof(path), "/proc/self/statm");
+    } else {
+        snprintf(path, sizeof(path), "/proc/%u/statm", pid);
+    }
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        return 0;
+    }
+    unsigned long long size, resident;
+    int fields = fscanf(file, "%llu %llu", &size, &resident);
+    fclose(file);
+    return fields == 2? resident*sysconf(_SC_PAGESIZE) : 0;
+}
+
+// Read a parameter mix.  Returns false on a bad line.
+static bool readMix(const char *fileName, const TigerKDFBatchParams *defaults, struct LoadMixStruct **mix,
+        uint32_t *numMix) {
+    FILE *file = fopen(fileName, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open %s\n", fileName);
+        return false;
+    }
+    char *line = NULL;
+    size_t lineSize = 0;
+    uint32_t lineNum = 0;
+    bool passed = true;
+    while(passed && getline(&line, &lineSize, file) != -1) {
+        lineNum++;
+        char *save;
+        char *field = strtok_r(line, " \t\r\n", &save);
+        if(field == NULL || *field == '#') {
+            continue;
+        }
+        struct LoadMixStruct entry;
+        entry.params = *defaults;
+        char *endPtr;
+        entry.weight = strtoul(field, &endPtr, 0);
+        passed = *endPtr == '\0' && entry.weight != 0;
+        while(passed && (field = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            uint32_t value = 0;
+            passed = strlen(field) > 2 && field[1] == '=';
+            if(passed) {
+                value = strtoul(field + 2, &endPtr, 0);
+                passed = *endPtr == '\0';
+            }
+            switch(passed? field[0] : 0) {
+            case 'h': entry.params.hashSize = value; break;
+            case 'g': entry.params.garlic = value > 255? 255 : value; break;
+            case 'm': entry.params.memSize = value; break;
+            case 'M': entry.params.multipliesPerBlock = value; break;
+            case 'r': entry.params.repetitions = value; break;
+            case 't': entry.params.parallelism = value; break;
+            case 'b': entry.params.blockSize = value; break;
+            case 'V': entry.params.version = value; break;
+            default: passed = false;
+            }
+        }
+        if(!passed) {
+            fprintf(stderr, "%s:%u: lines must be a weight followed by name=value fields\n", fileName, lineNum);
+            break;
+        }
+        *mix = (struct LoadMixStruct *)realloc(*mix, (*numMix + 1)*sizeof(struct LoadMixStruct));
+        if(*mix == NULL) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            passed = false;
+            break;
+        }
+        (*mix)[(*numMix)++] = entry;
+    }
+    free(line);
+    fclose(file);
+    if(passed && *numMix == 0) {
+        fprintf(stderr, "%s has no parameters\n", fileName);
+        passed = false;
+    }
+    return passed;
+}
+
+// Pick parameters from the mix for request number n of a client.
+static const TigerKDFBatchParams *pickParams(struct LoadStruct *load, uint32_t client, uint64_t n) {
+    // A cheap hash of client and request, so every run picks the same sequence.
+    uint64_t x = ((uint64_t)client << 32 | (n & 0xffffffff)) * 0x9e3779b97f4a7c15ULL;
+    uint32_t pick = (x >> 32) % load->totalWeight;
+    uint32_t i;
+    for(i = 0; pick >= load->mix[i].weight; i++) {
+        pick -= load->mix[i].weight;
+    }
+    return &load->mix[i].params;
+}
+
+// Hash one password in this process, growing the client's arena if it needs more memory.
+static bool hashInProcess(struct LoadClientStruct *client, const TigerKDFBatchParams *params, uint8_t *password,
+        uint32_t passwordSize, uint8_t *salt, uint32_t saltSize) {
+    uint64_t needed = TigerKDF_ArenaSize(params->memSize, params->garlic, params->blockSize, params->parallelism);
+    if(needed > client->arenaSize) {
+        free(client->arena);
+        client->arena = aligned_alloc(32, needed);
+        client->arenaSize = client->arena != NULL? needed : 0;
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = params->version;
+    options.arena = client->arena;
+    options.arenaSize = client->arenaSize;
+    options.workers = client->load->workers;
+    uint8_t hash[params->hashSize];
+    return TigerKDF_HashPasswordExt(hash, params->hashSize, password, passwordSize, salt, saltSize,
+        params->memSize, params->multipliesPerBlock, params->garlic, NULL, 0, params->blockSize,
+        params->parallelism, params->repetitions, &options);
+}
+
+// Connect to a Unix socket.  Returns -1 on failure.
+static int connectSocket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Send one batch record to the client's socket and read the reply line.  Returns false on an error reply.
+static bool hashOverSocket(struct LoadClientStruct *client, const TigerKDFBatchParams *params,
+        uint8_t *password, uint32_t passwordSize, uint8_t *salt, uint32_t saltSize) {
+    char record[256];
+    int length = snprintf(record, sizeof(record), "%.*s\t", (int)passwordSize, password);
+    uint32_t i;
+    for(i = 0; i < saltSize; i++) {
+        length += snprintf(record + length, sizeof(record) - length, "%02x", salt[i]);
+    }
+    length += snprintf(record + length, sizeof(record) - length,
+        "\th=%u\tg=%u\tm=%u\tM=%u\tr=%u\tt=%u\tb=%u\tV=%u\n", params->hashSize, params->garlic, params->memSize,
+        params->multipliesPerBlock, params->repetitions, params->parallelism, params->blockSize, params->version);
+    if(write(client->fd, record, length) != length) {
+        return false;
+    }
+    // Replies are one line of hex or "error", so read until the newline.
+    char reply[2*1024 + 2];
+    size_t replySize = 0;
+    while(replySize == 0 || reply[replySize - 1] != '\n') {
+        ssize_t got = read(client->fd, reply + replySize, sizeof(reply) - replySize);
+        if(got <= 0 || replySize + got >= sizeof(reply)) {
+            return false;
+        }
+        replySize += got;
+    }
+    return strncmp(reply, "error", 5) != 0;
+}
+
+// A client hashes until told to stop.  With a rate, it takes the next start time from the shared schedule and
+// measures latency from then, so a hash that had to wait for a free client counts its wait.
+static void *loadClient(void *clientPtr) {
+    struct LoadClientStruct *client = (struct LoadClientStruct *)clientPtr;
+    struct LoadStruct *load = client->load;
+    while(!atomic_load(&load->stop)) {
+        double start;
+        if(load->rate > 0.0) {
+            uint64_t n = atomic_fetch_add(&load->nextArrival, 1);
+            start = load->startTime + n/load->rate;
+            if(start >= load->endTime) {
+                break;
+            }
+            sleepUntil(start);
+        } else {
+            start = now();
+        }
+        const TigerKDFBatchParams *params = pickParams(load, client->id, client->requests);
+        char password[32];
+        int passwordSize = snprintf(password, sizeof(password), "password%u.%llu", client->id,
+            (unsigned long long)client->requests);
+        uint8_t salt[16];
+        memset(salt, 0, sizeof(salt));
+        memcpy(salt, &client->id, sizeof(client->id));
+        memcpy(salt + 8, &client->requests, sizeof(client->requests));
+        client->requests++;
+        bool passed;
+        if(load->socketPath != NULL) {
+            passed = hashOverSocket(client, params, (uint8_t *)password, passwordSize, salt, sizeof(salt));
+        } else {
+            passed = hashInProcess(client, params, (uint8_t *)password, passwordSize, salt, sizeof(salt));
+        }
+        double end = now();
+        // Hashes still running when the step ends do not count.
+        if(end > load->endTime) {
+            break;
+        }
+        if(passed) {
+            addToHistogram(&client->histogram, (end - start)*1e9);
+            atomic_fetch_add(&load->completed, 1);
+        } else {
+            atomic_fetch_add(&load->errors, 1);
+        }
+    }
+    return NULL;
+}
+
+// The result of running one number of clients.
+struct LoadStepStruct {
+    uint32_t clients;
+    double hashesPerSecond;
+    uint64_t errors;
+    uint64_t maxRss;
+    LoadHistogram histogram;
+};
+
+// Run clients for duration seconds and fill in step.  Returns false if clients cannot be started.
+static bool runStep(struct LoadStruct *load, uint32_t clients, double duration, uint32_t pid, bool verbose,
+        struct LoadStepStruct *step) {
+    struct LoadClientStruct *c = (struct LoadClientStruct *)calloc(clients, sizeof(struct LoadClientStruct));
+    pthread_t *threads = (pthread_t *)malloc(clients*sizeof(pthread_t));
+    if(c == NULL || threads == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return false;
+    }
+    atomic_store(&load->stop, false);
+    atomic_store(&load->completed, 0);
+    atomic_store(&load->errors, 0);
+    atomic_store(&load->nextArrival, 0);
+    uint32_t i;
+    for(i = 0; i < clients; i++) {
+        c[i].load = load;
+        c[i].id = i;
+        c[i].fd = -1;
+        if(load->socketPath != NULL && (c[i].fd = connectSocket(load->socketPath)) < 0) {
+            fprintf(stderr, "Unable to connect to %s\n", load->socketPath);
+            return false;
+        }
+    }
+    load->startTime = now();
+    load->endTime = load->startTime + duration;
+    uint32_t started;
+    for(started = 0; started < clients; started++) {
+        if(pthread_create(threads + started, NULL, loadClient, c + started)) {
+            fprintf(stderr, "Unable to start threads\n");
+            break;
+        }
+    }
+    memset(step, 0, sizeof(struct LoadStepStruct));
+    step->clients = clients;
+    // Sample RSS and throughput every second until the step is over.
+    uint64_t lastCompleted = 0;
+    uint32_t second;
+    for(second = 1; load->startTime + second <= load->endTime + 1e-9; second++) {
+        sleepUntil(load->startTime + second);
+        uint64_t rss = readRss(pid);
+        if(rss > step->maxRss) {
+            step->maxRss = rss;
+        }
+        uint64_t completed = atomic_load(&load->completed);
+        if(verbose) {
+            printf("    %3us: %8llu hashes/s, RSS %.1f MiB\n", second,
+                (unsigned long long)(completed - lastCompleted), rss/(1024.0*1024.0));
+        }
+        lastCompleted = completed;
+    }
+    sleepUntil(load->endTime);
+    atomic_store(&load->stop, true);
+    for(i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for(i = 0; i < clients; i++) {
+        mergeHistogram(&step->histogram, &c[i].histogram);
+        free(c[i].arena);
+        if(c[i].fd >= 0) {
+            close(c[i].fd);
+        }
+    }
+    step->hashesPerSecond = step->histogram.total/duration;
+    step->errors = atomic_load(&load->errors);
+    free(threads);
+    free(c);
+    return started == clients;
+}
+
+static void printStep(const struct LoadStepStruct *step) {
+    printf("%4u clients: %10.2f hashes/s, p50 %9.3fms, p99 %9.3fms, p999 %9.3fms, max RSS %8.1f MiB",
+        step->clients, step->hashesPerSecond, percentile(&step->histogram, 0.5)*1e-6,
+        percentile(&step->histogram, 0.99)*1e-6, percentile(&step->histogram, 0.999)*1e-6,
+        step->maxRss/(1024.0*1024.0));
+    if(step->errors != 0) {
+        printf(", %llu errors", (unsigned long long)step->errors);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    TigerKDFBatchParams defaults = {32, 16*1024, 4096, 0, 16384, 1, 1, TIGERKDF_VERSION_ORIGINAL};
+    struct LoadStruct load;
+    memset(&load, 0, sizeof(load));
+    load.workers = 1;
+    const char *mixFile = NULL;
+    uint32_t clients = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t maxClients = 4*(cpus < 1? 1 : cpus);
+    double duration = 5.0;
+    uint32_t pid = 0;
+    bool verbose = false;
+    int c;
+    while((c = getopt(argc, argv, "h:g:m:M:r:t:b:V:x:c:C:R:d:u:P:w:v")) != -1) {
+        switch (c) {
+        case 'h': defaults.hashSize = readuint32_t(c, optarg); break;
+        case 'g': defaults.garlic = readuint32_t(c, optarg); break;
+        case 'm': defaults.memSize = readuint32_t(c, optarg); break;
+        case 'M': defaults.multipliesPerBlock = readuint32_t(c, optarg); break;
+        case 'r': defaults.repetitions = readuint32_t(c, optarg); break;
+        case 't': defaults.parallelism = readuint32_t(c, optarg); break;
+        case 'b': defaults.blockSize = readuint32_t(c, optarg); break;
+        case 'V': defaults.version = readuint32_t(c, optarg); break;
+        case 'x': mixFile = optarg; break;
+        case 'c': clients = readuint32_t(c, optarg); break;
+        case 'C': maxClients = readuint32_t(c, optarg); break;
+        case 'R': load.rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'u': load.socketPath = optarg; break;
+        case 'P': pid = readuint32_t(c, optarg); break;
+        case 'w': load.workers = readuint32_t(c, optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            usage("Invalid argument");
+        }
+    }
+    if(optind != argc) {
+        usage("Extra parameters not recognised\n");
+    }
+    if(duration <= 0.0 || maxClients == 0 || load.rate < 0.0) {
+        usage("Duration, clients and rate must be positive\n");
+    }
+    struct LoadMixStruct single = {defaults, 1};
+    if(mixFile != NULL) {
+        if(!readMix(mixFile, &defaults, &load.mix, &load.numMix)) {
+            return 1;
+        }
+    } else {
+        load.mix = &single;
+        load.numMix = 1;
+    }
+    uint32_t i;
+    for(i = 0; i < load.numMix; i++) {
+        // Hashes of a size TigerKDF rejects would only measure how fast it says no.
+        TigerKDFBatchParams *p = &load.mix[i].params;
+        if(p->hashSize == 0 || p->hashSize > 1024 || p->blockSize < 4 || p->parallelism == 0 ||
+                p->multipliesPerBlock > p->blockSize || p->garlic > 30) {
+            usage("Invalid parameters in the mix\n");
+        }
+        load.totalWeight += load.mix[i].weight;
+    }
+    if(clients != 0) {
+        struct LoadStepStruct step;
+        if(!runStep(&load, clients, duration, pid, verbose, &step)) {
+            return 1;
+        }
+        printStep(&step);
+        return step.errors != 0;
+    }
+    // Double the clients until the throughput stops growing.  The knee is the last step that still grew it.
+    struct LoadStepStruct best, step;
+    memset(&best, 0, sizeof(best));
+    uint32_t flatSteps = 0;
+    for(clients = 1; clients <= maxClients && flatSteps < LOAD_FLAT_STEPS; clients *= 2) {
+        if(!runStep(&load, clients, duration, pid, verbose, &step)) {
+            return 1;
+        }
+        printStep(&step);
+        if(step.hashesPerSecond > 1.1*best.hashesPerSecond) {
+            best = step;
+            flatSteps = 0;
+        } else {
+            flatSteps++;
+        }
+    }
+    printf("knee: ");
+    printStep(&best);
+    return 0;
+}
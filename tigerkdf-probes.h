@@ -0,0 +1,32 @@
+// Static tracepoints for bpftrace and perf, in the provider "tigerkdf".  With <sys/sdt.h> each probe is a nop
+// instruction plus a note recording where its arguments live, so it costs nothing until a tracer attaches.
+// Without it, or with TIGERKDF_NO_PROBES defined, the probes compile to nothing.  For example:
+//
+//     bpftrace -e 'usdt:./libtigerkdf.so:tigerkdf:wait_end { @[arg0] = count(); }'
+//
+// The probes and their arguments are:
+//
+//     garlic_start, garlic_end         level, numblocks, blocklen, parallelism
+//     lane_start, lane_end             phase, lane, numblocks, blocklen
+//     wait_start, wait_end             phase, lane, block
+//     h_start, h_end                   hashSize, version
+#ifndef TIGERKDF_PROBES_H
+#define TIGERKDF_PROBES_H
+
+#if !defined(TIGERKDF_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TIGERKDF_PROBE2(name, a, b) DTRACE_PROBE2(tigerkdf, name, a, b)
+#define TIGERKDF_PROBE3(name, a, b, c) DTRACE_PROBE3(tigerkdf, name, a, b, c)
+#define TIGERKDF_PROBE4(name, a, b, c, d) DTRACE_PROBE4(tigerkdf, name, a, b, c, d)
+#endif
+#endif
+
+// Disabled probes still name their arguments, so variables only traced do not look unused.
+#ifndef TIGERKDF_PROBE2
+#define TIGERKDF_PROBE2(name, a, b) do { (void)(a); (void)(b); } while(0)
+#define TIGERKDF_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while(0)
+#define TIGERKDF_PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while(0)
+#endif
+
+#endif
@@ -1,139 +1,484 @@
+// Portable TigerKDF engine.  It runs the same threaded construction as tigerkdf-sse.c and computes the same
+// hashes, but uses GCC/Clang vector extensions rather than x86 intrinsics, so it builds for any CPU the compiler
+// targets and is vectorized with whatever the target offers.
+#define _POSIX_C_SOURCE 199309L // Otherwise nanosleep is not included
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "blake2/blake2.h"
 #include "pbkdf2.h"
+#include "be32vect.h"
 #include "tigerkdf.h"
+#include "tigerkdf-internal.h"
+#include "tigerkdf-probes.h"
 
-// Forward declarations
-static void hashWithoutPassword(uint32_t p, uint8_t *hash, uint32_t hashSize, uint32_t *mem,
-        uint32_t blocklen, uint32_t numblocks, uint32_t repetitions);
-static void hashWithPassword(uint32_t p, uint32_t *mem, uint32_t blocklen, uint32_t numblocks,
-        uint32_t parallelism, uint32_t repetitions);
-static inline uint32_t hashBlocks(uint32_t value, uint32_t *mem, uint32_t blocklen, uint64_t fromAddr,
-        uint64_t toAddr, uint32_t repetitions);
+// Four 32-bit lanes, the same as one __m128i in tigerkdf-sse.c.
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+
+// _mm_srl_epi32 and _mm_sll_epi32 shift every lane by the whole low 64 bits of their count vector, and clear the
+// lane when that is over 31.  tigerkdf-sse.c builds its counts with _mm_set_epi32(25, 25, 25, 25) and
+// _mm_set_epi32(7, 7, 7, 7), so it shifts by these.  We shift the same way so both engines agree.
+#define SHIFT_RIGHT_COUNT (((uint64_t)25 << 32) | 25)
+#define SHIFT_LEFT_COUNT (((uint64_t)7 << 32) | 7)
+
+struct TigerKDFCommonDataStruct {
+    uint32_t *mem;
+    uint32_t *multHashes;
+    uint8_t *hash;
+    uint32_t hashSize;
+    uint32_t parallelism;
+    uint32_t blocklen;
+    uint32_t numblocks;
+    uint32_t repetitions;
+    uint32_t multipliesPerBlock;
+    atomic_uint_least32_t completedMultiplies;
+    uint32_t version;
+    TigerKDFHashBlocksFunc hashBlocks;
+    TigerKDFSchedule *schedule;
+    // Only set when the caller asked for stats.
+    TigerKDFStats *stats;
+    TigerKDFHistogram *laneWaits;
+    pthread_mutex_t statsMutex;
+    // The block each worker's lane is on in the password independent phase, or UINT32_MAX between lanes.
+    atomic_uint_least32_t *laneProgress;
+    uint32_t workers;
+    // The current garlic level's entries of the graph file, or NULL when not writing one.
+    uint64_t *graph;
+    TigerKDFControl control;
+};
+
+// Do low-bandwidth multplication hashing.
+static void *multHash(void *commonPtr) {
+    struct TigerKDFCommonDataStruct *c = (struct TigerKDFCommonDataStruct *)commonPtr;
+
+    uint8_t *hash = c->hash;
+    uint32_t hashSize = c->hashSize;
+    uint32_t numblocks = c->numblocks;
+    uint32_t repetitions = c->repetitions;
+    uint32_t *multHashes = c->multHashes;
+    uint32_t multipliesPerBlock = c->multipliesPerBlock;
+
+    uint8_t s[sizeof(uint32_t)];
+    be32enc(s, c->parallelism);
+    uint8_t threadKey[32];
+    uint32_t state[8];
+    HVersion(threadKey, 32, hash, hashSize, s, sizeof(uint32_t), c->version);
+    be32dec_vect(state, threadKey, 32);
+    uint32_t i;
+    for(i = 1; i < numblocks*2 && !controlStopped(&c->control); i++) {
+        uint32_t completed = atomic_load_explicit(&c->completedMultiplies, memory_order_relaxed);
+        uint32_t j;
+        for(j = 0; j < 8; j++) {
+            multHashes[8*completed + j] = state[j];
+        }
+        // Release, so the memory threads see the hashes written above once they see the new count.
+        atomic_store_explicit(&c->completedMultiplies, completed + 1, memory_order_release);
+        if(c->laneProgress != NULL) {
+            addMultLead(&c->stats->multLead, c->laneProgress, c->workers, completed + 1);
+        }
+        for(j = 0; j < multipliesPerBlock * repetitions; j += 8) {
+            // This is reversible, and should not lose entropy
+            state[0] = (state[0]*(state[1] | 1)) ^ (state[2] >> 1);
+            state[1] = (state[1]*(state[2] | 1)) ^ (state[3] >> 1);
+            state[2] = (state[2]*(state[3] | 1)) ^ (state[4] >> 1);
+            state[3] = (state[3]*(state[4] | 1)) ^ (state[5] >> 1);
+            state[4] = (state[4]*(state[5] | 1)) ^ (state[6] >> 1);
+            state[5] = (state[5]*(state[6] | 1)) ^ (state[7] >> 1);
+            state[6] = (state[6]*(state[7] | 1)) ^ (state[0] >> 1);
+            state[7] = (state[7]*(state[0] | 1)) ^ (state[1] >> 1);
+        }
+    }
+    pthread_exit(NULL);
+}
+
+// XOR the last hashed data from each parallel process into the result.
 static void xorIntoHash(uint8_t *hash, uint32_t hashSize, uint32_t *mem, uint32_t blocklen,
-        uint32_t numblocks, uint32_t parallelism);
-static uint32_t bitReverse(uint32_t value, uint32_t mask);
+        uint32_t numblocks, uint32_t parallelism) {
+    uint8_t data[hashSize];
+    uint32_t p;
+    for(p = 0; p < parallelism; p++) {
+        uint64_t pos = 2*(p+1)*numblocks*(uint64_t)blocklen - hashSize/sizeof(uint32_t);
+        be32enc_vect_fast(data, mem + pos, hashSize);
+        uint32_t i;
+        for(i = 0; i < hashSize; i++) {
+            hash[i] ^= data[i];
+        }
+    }
+}
 
-// The TigerKDF password hashing function.  MemSize is in MiB.
-bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint8_t startGarlic, uint8_t stopGarlic,
-        uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash) {
-    uint64_t memlen = (1 << 20)*(uint64_t)memSize/sizeof(uint32_t);
-    uint32_t blocklen = blockSize/sizeof(uint32_t);
-    uint32_t numblocks = (memlen/(2*parallelism*blocklen)) << startGarlic;
-    memlen = (2*parallelism*(uint64_t)numblocks*blocklen) << (stopGarlic - startGarlic);
-    uint32_t *mem = (uint32_t *)malloc(memlen*sizeof(uint32_t));
-    if(mem == NULL) {
-        return false;
+// Shift each lane right by count, as _mm_srl_epi32 does.
+static inline v4u32 shiftRight(v4u32 v, uint64_t count) {
+    if(count > 31) {
+        return (v4u32){0, 0, 0, 0};
     }
-    uint8_t i;
-    for(i = startGarlic; i <= stopGarlic; i++) {
-        uint32_t p;
-        for(p = 0; p < parallelism; p++) {
-            hashWithoutPassword(p, hash, hashSize, mem, blocklen, numblocks, repetitions);
+    return v >> (uint32_t)count;
+}
+
+// Shift each lane left by count, as _mm_sll_epi32 does.
+static inline v4u32 shiftLeft(v4u32 v, uint64_t count) {
+    if(count > 31) {
+        return (v4u32){0, 0, 0, 0};
+    }
+    return v << (uint32_t)count;
+}
+
+// Hash three blocks together, four lanes at a time.  This is the same computation as hashBlocks in
+// tigerkdf-sse.c: the even 16-byte words of each block go through state[0..3], and the odd ones through state[4..7].
+// It is always inlined so the kernels below see blocklen and repetitions as constants.
+static inline __attribute__((always_inline)) void hashBlocksInline(uint32_t state[8], uint32_t *mem,
+        uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr, uint32_t repetitions) {
+    v4u32 s1 = {state[0], state[1], state[2], state[3]};
+    v4u32 s2 = {state[4], state[5], state[6], state[7]};
+    uint64_t prevAddr = toAddr - blocklen;
+    v4u32 *m = (v4u32 *)mem;
+    uint32_t i;
+    uint32_t r;
+    for(r = 0; r < repetitions; r++) {
+        for(i = 0; i < blocklen/4;) {
+            s1 += m[prevAddr/4+i];
+            s1 ^= m[fromAddr/4+i];
+            // Rotate right 7
+            s1 = shiftRight(s1, SHIFT_RIGHT_COUNT) | shiftLeft(s1, SHIFT_LEFT_COUNT);
+            m[toAddr/4+i] = s1;
+            i++;
+            s2 += m[prevAddr/4+i];
+            s2 ^= m[fromAddr/4+i];
+            // Rotate right 7
+            s2 = shiftRight(s2, SHIFT_RIGHT_COUNT) | shiftLeft(s2, SHIFT_LEFT_COUNT);
+            m[toAddr/4+i] = s2;
+            i++;
+        }
+    }
+    for(i = 0; i < 4; i++) {
+        state[i] = s1[i];
+        state[i + 4] = s2[i];
+    }
+}
+
+// The generic kernel, for any block size and number of repetitions.
+static void hashBlocks(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr,
+        uint32_t repetitions) {
+    hashBlocksInline(state, mem, blocklen, fromAddr, toAddr, repetitions);
+}
+
+// Define a kernel for one block size in bytes with one repetition, the same ones tigerkdf-sse.c has.
+#define HASH_BLOCKS_KERNEL(blockSize) \
+    static void hashBlocks##blockSize(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, \
+            uint64_t toAddr, uint32_t repetitions) { \
+        (void)blocklen; \
+        (void)repetitions; \
+        hashBlocksInline(state, mem, blockSize/sizeof(uint32_t), fromAddr, toAddr, 1); \
+    }
+
+HASH_BLOCKS_KERNEL(64)
+HASH_BLOCKS_KERNEL(1024)
+HASH_BLOCKS_KERNEL(4096)
+HASH_BLOCKS_KERNEL(16384)
+
+// The specialized kernels, by block length in words.  They all assume repetitions == 1.
+static const struct {
+    uint32_t blocklen;
+    TigerKDFHashBlocksFunc hashBlocks;
+} hashBlocksKernels[] = {
+    {64/sizeof(uint32_t), hashBlocks64},
+    {1024/sizeof(uint32_t), hashBlocks1024},
+    {4096/sizeof(uint32_t), hashBlocks4096},
+    {16384/sizeof(uint32_t), hashBlocks16384},
+};
+
+// Return the fastest hashBlocks kernel for blocklen and repetitions, or the generic one if specialized is false.
+TigerKDFHashBlocksFunc selectHashBlocks(uint32_t blocklen, uint32_t repetitions, bool specialized) {
+    if(testHashBlocks != NULL) {
+        return testHashBlocks;
+    }
+    if(specialized && repetitions == 1) {
+        uint32_t i;
+        for(i = 0; i < sizeof(hashBlocksKernels)/sizeof(hashBlocksKernels[0]); i++) {
+            if(hashBlocksKernels[i].blocklen == blocklen) {
+                return hashBlocksKernels[i].hashBlocks;
+            }
         }
-        for(p = 0; p < parallelism; p++) {
-            hashWithPassword(p, mem, blocklen, numblocks, parallelism, repetitions);
+    }
+    return hashBlocks;
+}
+
+// Hash the multiply context into our state.  If the multiplies are falling behind, sleep
+// for a while.  If waits is not NULL, count how long we waited in it.  Phase and p are for the probes.
+static void hashMultItoState(uint32_t iteration, struct TigerKDFCommonDataStruct *c, uint32_t *state,
+        uint32_t phase, uint32_t p, TigerKDFHistogram *waits) {
+    if(iteration >= atomic_load_explicit(&c->completedMultiplies, memory_order_acquire)) {
+        TIGERKDF_PROBE3(wait_start, phase, p, iteration);
+        // Only read the clock when we have to wait anyway.
+        double start = waits != NULL? getTime() : 0.0;
+        while(iteration >= atomic_load_explicit(&c->completedMultiplies, memory_order_acquire)) {
+            if(controlStopped(&c->control)) {
+                // The multiplies we wait for will never come.
+                return;
+            }
+            struct timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 1000000; // 1ms
+            nanosleep(&ts, NULL);
         }
-        xorIntoHash(hash, hashSize, mem, blocklen, numblocks, parallelism);
-        numblocks *= 2;
-        if(i < stopGarlic || !skipLastHash) {
-            H(hash, hashSize, hash, hashSize, &i, 1);
+        TIGERKDF_PROBE3(wait_end, phase, p, iteration);
+        if(waits != NULL) {
+            addToHistogram(waits, (getTime() - start)*1e9);
         }
+    } else if(waits != NULL) {
+        addToHistogram(waits, 0);
     }
-    free(mem);
-    return true;
+    uint32_t i;
+    for(i = 0; i < 8; i++) {
+        state[i] ^= c->multHashes[iteration*8 + i];
+    }
+    // Perform blake2s hash on the state
+    uint8_t buf[32];
+    be32enc_vect_fast(buf, state, 32);
+    blake2s(buf, buf, NULL, 32, 32, 0);
+    be32dec_vect_fast(state, buf, 32);
+}
+
+// Add the waits of lane p in phase to the stats.
+static void recordWaits(struct TigerKDFCommonDataStruct *c, uint32_t phase, uint32_t p,
+        const TigerKDFHistogram *waits) {
+    if(c->laneWaits != NULL) {
+        mergeHistogram(c->laneWaits + phase*(uint64_t)c->parallelism + p, waits);
+    }
+    pthread_mutex_lock(&c->statsMutex);
+    mergeHistogram(c->stats->waits + phase, waits);
+    pthread_mutex_unlock(&c->statsMutex);
 }
 
 // Hash memory without doing any password dependent memory addressing to thwart cache-timing-attacks.
-static void hashWithoutPassword(uint32_t p, uint8_t *hash, uint32_t hashSize, uint32_t *mem,
-        uint32_t blocklen, uint32_t numblocks, uint32_t repetitions) {
+static void hashWithoutPassword(void *commonPtr, uint32_t p, uint32_t w) {
+    struct TigerKDFCommonDataStruct *c = (struct TigerKDFCommonDataStruct *)commonPtr;
+
+    uint32_t *mem = c->mem;
+    uint8_t *hash = c->hash;
+    uint32_t hashSize = c->hashSize;
+    uint32_t blocklen = c->blocklen;
+    uint32_t numblocks = c->numblocks;
+    uint32_t repetitions = c->repetitions;
+
+    if(controlStopped(&c->control)) {
+        return;
+    }
+    TIGERKDF_PROBE4(lane_start, 0, p, numblocks, blocklen);
     uint64_t start = 2*p*(uint64_t)numblocks*blocklen;
-    uint8_t threadKey[blocklen*sizeof(uint32_t)];
-    uint8_t s[sizeof(uint32_t)];
-    be32enc(s, p);
-    H(threadKey, blocklen*sizeof(uint32_t), hash, hashSize, s, sizeof(uint32_t));
-    be32dec_vect(mem + start, threadKey, blocklen*sizeof(uint32_t));
-    uint32_t value = 1;
-    uint32_t mask = 1;
+    // Expand the key straight into the lane's first block and decode it in place.
+    uint8_t *threadKey = (uint8_t *)(mem + start);
+    expandThreadKey(threadKey, blocklen*sizeof(uint32_t), hash, hashSize, p, c->version, c->workers > 1? 1 : 0);
+    be32dec_vect_fast(mem + start, threadKey, blocklen*sizeof(uint32_t));
+    if(c->graph != NULL) {
+        c->graph[start/blocklen] = TIGERKDF_GRAPH_NO_BLOCK;
+    }
+    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    TigerKDFHistogram histogram;
+    TigerKDFHistogram *waits = NULL;
+    if(c->stats != NULL) {
+        memset(&histogram, 0, sizeof(TigerKDFHistogram));
+        waits = &histogram;
+    }
+    // The schedule is NULL when numblocks is too large to cache.
+    const uint32_t *from = c->schedule != NULL? c->schedule->from : NULL;
     uint64_t toAddr = start + blocklen;
+    uint32_t checked = 1;
     uint32_t i;
     for(i = 1; i < numblocks; i++) {
-        if(mask << 1 <= i) {
-            mask = mask << 1;
+        if((i & c->control.checkMask) == 0) {
+            if(!checkControl(&c->control, w, i - checked)) {
+                break;
+            }
+            checked = i;
         }
-        uint32_t reversePos = bitReverse(i, mask);
-        if(reversePos + mask < i) {
-            reversePos += mask;
+        if(c->laneProgress != NULL) {
+            atomic_store_explicit(c->laneProgress + w, i, memory_order_relaxed);
         }
+        uint32_t reversePos = from != NULL? from[i] : scheduleFrom(i);
         uint64_t fromAddr = start + (uint64_t)blocklen*reversePos;
-        value = hashBlocks(value, mem, blocklen, fromAddr, toAddr, repetitions);
+        addGraphEdge(c->graph, toAddr, fromAddr, blocklen);
+        c->hashBlocks(state, mem, blocklen, fromAddr, toAddr, repetitions);
+        hashMultItoState(i, c, state, 0, p, waits);
         toAddr += blocklen;
     }
+    if(c->laneProgress != NULL) {
+        atomic_store_explicit(c->laneProgress + w, UINT32_MAX, memory_order_relaxed);
+    }
+    if(waits != NULL) {
+        recordWaits(c, 0, p, waits);
+    }
+    TIGERKDF_PROBE4(lane_end, 0, p, numblocks, blocklen);
 }
 
 // Hash memory with dependent memory addressing to thwart TMTO attacks.
-static void hashWithPassword(uint32_t p, uint32_t *mem, uint32_t blocklen, uint32_t numblocks,
-        uint32_t parallelism, uint32_t repetitions) {
+static void hashWithPassword(void *commonPtr, uint32_t p, uint32_t w) {
+    struct TigerKDFCommonDataStruct *c = (struct TigerKDFCommonDataStruct *)commonPtr;
+
+    uint32_t *mem = c->mem;
+    uint32_t parallelism = c->parallelism;
+    uint32_t blocklen = c->blocklen;
+    uint32_t numblocks = c->numblocks;
+    uint32_t repetitions = c->repetitions;
+
+    if(controlStopped(&c->control)) {
+        return;
+    }
+    TIGERKDF_PROBE4(lane_start, 1, p, numblocks, blocklen);
     uint64_t start = (2*p + 1)*(uint64_t)numblocks*blocklen;
-    uint32_t value = 1;
+    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    TigerKDFHistogram histogram;
+    TigerKDFHistogram *waits = NULL;
+    if(c->stats != NULL) {
+        memset(&histogram, 0, sizeof(TigerKDFHistogram));
+        waits = &histogram;
+    }
     uint64_t toAddr = start;
+    uint32_t checked = 0;
     uint32_t i;
     for(i = 0; i < numblocks; i++) {
-        uint64_t v = value;
-        uint64_t v2 = v*v >> 32;
-        uint64_t v3 = v*v2 >> 32;
-        uint32_t distance = (i + numblocks - 1)*v3 >> 32;
-        uint64_t fromAddr;
-        if(distance < i) {
-            fromAddr = start + (i - 1 - distance)*(uint64_t)blocklen;
-        } else {
-            uint32_t q = (p + i) % parallelism;
-            uint32_t b = numblocks - 1 - (distance - i);
-            fromAddr = (2*numblocks*q + b)*(uint64_t)blocklen;
-        }
-        value = hashBlocks(value, mem, blocklen, fromAddr, toAddr, repetitions);
+        if((i & c->control.checkMask) == 0) {
+            if(!checkControl(&c->control, w, i - checked)) {
+                break;
+            }
+            checked = i;
+        }
+        uint64_t fromAddr = passwordFromAddr(state[0], i, p, numblocks, parallelism, blocklen);
+        addGraphEdge(c->graph, toAddr, fromAddr, blocklen);
+        c->hashBlocks(state, mem, blocklen, fromAddr, toAddr, repetitions);
+        hashMultItoState(i, c, state, 1, p, waits);
         toAddr += blocklen;
     }
+    if(waits != NULL) {
+        recordWaits(c, 1, p, waits);
+    }
+    TIGERKDF_PROBE4(lane_end, 1, p, numblocks, blocklen);
 }
 
-// Hash three blocks together with a multiplication latency bound loop
-static inline uint32_t hashBlocks(uint32_t value, uint32_t *mem, uint32_t blocklen, uint64_t fromAddr,
-        uint64_t toAddr, uint32_t repetitions) {
-    uint64_t prevAddr = toAddr - blocklen;
-    uint32_t r;
-    for(r = 0; r < repetitions; r++) {
-        uint32_t i;
-        for(i = 0; i < blocklen; i++) {
-            value = value*(mem[prevAddr + i] | 3) + mem[fromAddr + i];
-            mem[toAddr + i] = value;
+// The TigerKDF password hashing function.  MemSize is in KiB.  Options may be NULL.
+bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t startGarlic,
+        uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash,
+        const TigerKDFOptions *options) {
+    double startTime = getTime();
+    TigerKDFStats *stats = getStats(options);
+    TigerKDFMemoryUsage memoryUsage;
+    startMemoryStats(stats, &memoryUsage);
+    uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
+    uint32_t blocklen = blockSize/sizeof(uint32_t);
+    uint32_t numblocks = (memlen/(2*parallelism*blocklen)) << startGarlic;
+    memlen = (2*parallelism*(uint64_t)numblocks*blocklen) << (stopGarlic - startGarlic);
+    uint64_t memBytes = TigerKDF_ArenaSize(memSize, stopGarlic, blockSize, parallelism);
+    uint32_t *arena = (uint32_t *)getArena(options, memBytes);
+    uint32_t *mem = arena != NULL? arena : (uint32_t *)aligned_alloc(32, memBytes);
+    if(mem == NULL) {
+        return false;
+    }
+    // Those block sizes also leave the last words of some blocks unwritten, so start from zeroed memory to keep
+    // the hash from depending on what the allocator hands us.
+    if(blockSize % 32 != 0) {
+        memset(mem, 0, memBytes);
+    }
+    pthread_t multThread;
+    uint32_t workers = getWorkers(options, parallelism);
+    uint32_t *multHashes = (uint32_t *)malloc(8*sizeof(uint32_t)*memlen/blocklen);
+    if(multHashes == NULL) {
+        if(arena == NULL) {
+            free(mem);
         }
+        return false;
     }
-    return value;
-}
-
-// XOR the last hashed data from each parallel process into the result.
-static void xorIntoHash(uint8_t *hash, uint32_t hashSize, uint32_t *mem, uint32_t blocklen,
-        uint32_t numblocks, uint32_t parallelism) {
-    uint8_t data[hashSize];
-    uint32_t p;
-    for(p = 0; p < parallelism; p++) {
-        uint64_t pos = 2*(p+1)*numblocks*(uint64_t)blocklen - hashSize/sizeof(uint32_t);
-        be32enc_vect(data, mem + pos, hashSize);
-        uint32_t i;
-        for(i = 0; i < hashSize; i++) {
-            hash[i] ^= data[i];
+    TigerKDFGraph graph;
+    if(!openGraph(&graph, options, parallelism, blockSize, numblocks, startGarlic, stopGarlic)) {
+        free(multHashes);
+        if(arena == NULL) {
+            free(mem);
         }
+        return false;
     }
-}
-
-// Compute the bit reversal of value.
-static uint32_t bitReverse(uint32_t value, uint32_t mask) {
-    uint32_t result = 0;
-    while(mask != 1) {
-        result = (result << 1) | (value & 1);
-        value >>= 1;
-        mask >>= 1;
+    struct TigerKDFCommonDataStruct common;
+    common.multHashes = multHashes;
+    common.multipliesPerBlock = multipliesPerBlock;
+    common.hash = hash;
+    common.hashSize = hashSize;
+    common.mem = mem;
+    common.blocklen = blocklen;
+    common.parallelism = parallelism;
+    common.repetitions = repetitions;
+    common.version = getVersion(options);
+    common.hashBlocks = selectHashBlocks(blocklen, repetitions, true);
+    common.stats = stats;
+    common.laneWaits = getLaneWaits(stats, parallelism);
+    common.workers = workers;
+    common.laneProgress = NULL;
+    if(stats != NULL) {
+        // Without it we only lose the lead histogram.
+        common.laneProgress = (atomic_uint_least32_t *)malloc(workers*sizeof(atomic_uint_least32_t));
+    }
+    pthread_mutex_init(&common.statsMutex, NULL);
+    initControl(&common.control, options, blockSize, repetitions);
+    bool passed = true;
+    uint8_t i;
+    for(i = startGarlic; i <= stopGarlic; i++) {
+        common.numblocks = numblocks;
+        atomic_init(&common.completedMultiplies, 0);
+        if(common.laneProgress != NULL) {
+            uint32_t w;
+            for(w = 0; w < workers; w++) {
+                atomic_init(common.laneProgress + w, UINT32_MAX);
+            }
+        }
+        common.graph = graph.entries;
+        common.schedule = acquireSchedule(numblocks);
+        addScheduleStats(stats, common.schedule);
+        TIGERKDF_PROBE4(garlic_start, i, numblocks, blocklen, parallelism);
+        double phaseStart = getTime();
+        startControlPhase(&common.control, i, 0, parallelism*(uint64_t)(numblocks - 1));
+        if(pthread_create(&multThread, NULL, multHash, (void *)&common)) {
+            fprintf(stderr, "Unable to start threads\n");
+            releaseSchedule(common.schedule);
+            passed = false;
+            break;
+        }
+        runLanes(hashWithoutPassword, &common, parallelism, workers);
+        (void)pthread_join(multThread, NULL);
+        releaseSchedule(common.schedule);
+        double phaseEnd = getTime();
+        addPhaseStats(stats, 0, phaseEnd - phaseStart, parallelism*(uint64_t)(numblocks - 1), blocklen, repetitions);
+        addThrottleStats(stats, &common.control);
+        if(!endControlPhase(&common.control)) {
+            passed = false;
+            break;
+        }
+        startControlPhase(&common.control, i, 1, parallelism*(uint64_t)numblocks);
+        runLanes(hashWithPassword, &common, parallelism, workers);
+        addPhaseStats(stats, 1, getTime() - phaseEnd, parallelism*(uint64_t)numblocks, blocklen, repetitions);
+        addThrottleStats(stats, &common.control);
+        if(!endControlPhase(&common.control)) {
+            passed = false;
+            break;
+        }
+        xorIntoHash(hash, hashSize, mem, blocklen, numblocks, parallelism);
+        if(i < stopGarlic || !skipLastHash) {
+            HVersion(hash, hashSize, hash, hashSize, &i, 1, common.version);
+        }
+        TIGERKDF_PROBE4(garlic_end, i, numblocks, blocklen, parallelism);
+        if(graph.entries != NULL) {
+            graph.entries += 2*(uint64_t)parallelism*numblocks;
+        }
+        numblocks *= 2;
+    }
+    endMemoryStats(stats, &memoryUsage, mem, memBytes);
+    free(multHashes);
+    closeGraph(&graph);
+    free(common.laneProgress);
+    pthread_mutex_destroy(&common.statsMutex);
+    if(arena == NULL) {
+        free(mem);
+    }
+    if(stats != NULL) {
+        stats->totalSeconds = getTime() - startTime;
     }
-    return result;
+    return passed;
 }
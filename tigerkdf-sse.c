@@ -3,11 +3,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <immintrin.h>
 #include "blake2/blake2.h"
 #include "pbkdf2.h"
+#include "be32vect.h"
 #include "tigerkdf.h"
+#include "tigerkdf-internal.h"
+#include "tigerkdf-probes.h"
 
 struct TigerKDFCommonDataStruct {
     uint32_t *mem;
@@ -19,12 +23,23 @@ struct TigerKDFCommonDataStruct {
     uint32_t numblocks;
     uint32_t repetitions;
     uint32_t multipliesPerBlock;
-    uint32_t completedMultiplies;
-};
-
-struct TigerKDFContextStruct {
-    struct TigerKDFCommonDataStruct *common;
-    uint32_t p;
+    atomic_uint_least32_t completedMultiplies;
+    uint32_t version;
+    TigerKDFHashBlocksFunc hashBlocks;
+    TigerKDFHashBlocks2Func hashBlocks2;
+    // Lanes each call of a lane function hashes in lockstep, 1 or 2.
+    uint32_t lanesPerTask;
+    TigerKDFSchedule *schedule;
+    // Only set when the caller asked for stats.
+    TigerKDFStats *stats;
+    TigerKDFHistogram *laneWaits;
+    pthread_mutex_t statsMutex;
+    // The block each worker's lane is on in the password independent phase, or UINT32_MAX between lanes.
+    atomic_uint_least32_t *laneProgress;
+    uint32_t workers;
+    // The current garlic level's entries of the graph file, or NULL when not writing one.
+    uint64_t *graph;
+    TigerKDFControl control;
 };
 
 // Print the state.
@@ -68,15 +83,20 @@ static void *multHash(void *commonPtr) {
     be32enc(s, c->parallelism);
     uint8_t threadKey[32];
     uint32_t state[8];
-    H(threadKey, 32, hash, hashSize, s, sizeof(uint32_t));
+    HVersion(threadKey, 32, hash, hashSize, s, sizeof(uint32_t), c->version);
     be32dec_vect(state, threadKey, 32);
     uint32_t i;
-    for(i = 1; i < numblocks*2; i++) {
+    for(i = 1; i < numblocks*2 && !controlStopped(&c->control); i++) {
+        uint32_t completed = atomic_load_explicit(&c->completedMultiplies, memory_order_relaxed);
         uint32_t j;
         for(j = 0; j < 8; j++) {
-            multHashes[8*c->completedMultiplies + j] = state[j];
+            multHashes[8*completed + j] = state[j];
+        }
+        // Release, so the lanes see the hashes written above once they see the new count.
+        atomic_store_explicit(&c->completedMultiplies, completed + 1, memory_order_release);
+        if(c->laneProgress != NULL) {
+            addMultLead(&c->stats->multLead, c->laneProgress, c->workers, completed + 1);
         }
-        (c->completedMultiplies)++;
         for(j = 0; j < multipliesPerBlock * repetitions; j += 8) {
             // This is reversible, and should not lose entropy
             state[0] = (state[0]*(state[1] | 1)) ^ (state[2] >> 1);
@@ -100,7 +120,7 @@ static void xorIntoHash(uint8_t *hash, uint32_t hashSize, uint32_t *mem, uint32_
     uint32_t p;
     for(p = 0; p < parallelism; p++) {
         uint64_t pos = 2*(p+1)*numblocks*(uint64_t)blocklen - hashSize/sizeof(uint32_t);
-        be32enc_vect(data, mem + pos, hashSize);
+        be32enc_vect_fast(data, mem + pos, hashSize);
         uint32_t i;
         for(i = 0; i < hashSize; i++) {
             hash[i] ^= data[i];
@@ -108,20 +128,10 @@ static void xorIntoHash(uint8_t *hash, uint32_t hashSize, uint32_t *mem, uint32_
     }
 }
 
-// Compute the bit reversal of value.
-static uint32_t bitReverse(uint32_t value, uint32_t mask) {
-    uint32_t result = 0;
-    while(mask != 1) {
-        result = (result << 1) | (value & 1);
-        value >>= 1;
-        mask >>= 1;
-    }
-    return result;
-}
-
-// Hash three blocks together with fast SSE friendly hash function optimized for high memory bandwidth.
-static inline void hashBlocks(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr,
-        uint64_t toAddr, uint32_t repetitions) {
+// Hash three blocks together with fast SSE friendly hash function optimized for high memory bandwidth.  This is
+// always inlined so the kernels below see blocklen and repetitions as constants.
+static inline __attribute__((always_inline)) void hashBlocksInline(uint32_t state[8], uint32_t *mem,
+        uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr, uint32_t repetitions) {
     __m128i s1, s2;
     convStateFromUint32ToM128i(state, &s1, &s2);
     uint64_t prevAddr = toAddr - blocklen;
@@ -151,14 +161,168 @@ static inline void hashBlocks(uint32_t state[8], uint32_t *mem, uint32_t blockle
     convStateFromM128iToUint32(&s1, &s2, state);
 }
 
+// The generic kernel, for any block size and number of repetitions.
+static void hashBlocks(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr,
+        uint32_t repetitions) {
+    hashBlocksInline(state, mem, blocklen, fromAddr, toAddr, repetitions);
+}
+
+// Define a kernel for one block size in bytes with one repetition, so the compiler can unroll and schedule the
+// loop for a known trip count.
+#define HASH_BLOCKS_KERNEL(blockSize) \
+    static void hashBlocks##blockSize(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, \
+            uint64_t toAddr, uint32_t repetitions) { \
+        (void)blocklen; \
+        (void)repetitions; \
+        hashBlocksInline(state, mem, blockSize/sizeof(uint32_t), fromAddr, toAddr, 1); \
+    }
+
+HASH_BLOCKS_KERNEL(64)
+HASH_BLOCKS_KERNEL(1024)
+HASH_BLOCKS_KERNEL(4096)
+HASH_BLOCKS_KERNEL(16384)
+
+// The specialized kernels, by block length in words.  They all assume repetitions == 1.
+static const struct {
+    uint32_t blocklen;
+    TigerKDFHashBlocksFunc hashBlocks;
+} hashBlocksKernels[] = {
+    {64/sizeof(uint32_t), hashBlocks64},
+    {1024/sizeof(uint32_t), hashBlocks1024},
+    {4096/sizeof(uint32_t), hashBlocks4096},
+    {16384/sizeof(uint32_t), hashBlocks16384},
+};
+
+// Return the fastest hashBlocks kernel for blocklen and repetitions, or the generic one if specialized is false.
+TigerKDFHashBlocksFunc selectHashBlocks(uint32_t blocklen, uint32_t repetitions, bool specialized) {
+    if(testHashBlocks != NULL) {
+        return testHashBlocks;
+    }
+    if(specialized && repetitions == 1) {
+        uint32_t i;
+        for(i = 0; i < sizeof(hashBlocksKernels)/sizeof(hashBlocksKernels[0]); i++) {
+            if(hashBlocksKernels[i].blocklen == blocklen) {
+                return hashBlocksKernels[i].hashBlocks;
+            }
+        }
+    }
+    return hashBlocks;
+}
+
+// Hash two lanes' blocks at once, each exactly as hashBlocksInline does, with the steps of the two lanes
+// interleaved.  Each lane's add, xor and rotate chain is serial, so the second lane's chain fills the cycles the
+// first one waits on.  The lanes' to blocks must not be the other lane's prev or from blocks.
+static inline __attribute__((always_inline)) void hashBlocks2Inline(uint32_t state0[8], uint32_t state1[8],
+        uint32_t *mem, uint32_t blocklen, uint64_t fromAddr0, uint64_t toAddr0, uint64_t fromAddr1,
+        uint64_t toAddr1, uint32_t repetitions) {
+    __m128i s1, s2, t1, t2;
+    convStateFromUint32ToM128i(state0, &s1, &s2);
+    convStateFromUint32ToM128i(state1, &t1, &t2);
+    uint64_t prevAddr0 = toAddr0 - blocklen;
+    uint64_t prevAddr1 = toAddr1 - blocklen;
+    __m128i *m = (__m128i *)mem;
+    __m128i shiftRightVal = _mm_set_epi32(25, 25, 25, 25);
+    __m128i shiftLeftVal = _mm_set_epi32(7, 7, 7, 7);
+    uint32_t i;
+    uint32_t r;
+    for(r = 0; r < repetitions; r++) {
+        for(i = 0; i < blocklen/4;) {
+            s1 = _mm_add_epi32(s1, m[prevAddr0/4+i]);
+            t1 = _mm_add_epi32(t1, m[prevAddr1/4+i]);
+            s1 = _mm_xor_si128(s1, m[fromAddr0/4+i]);
+            t1 = _mm_xor_si128(t1, m[fromAddr1/4+i]);
+            s1 = _mm_or_si128(_mm_srl_epi32(s1, shiftRightVal), _mm_sll_epi32(s1, shiftLeftVal));
+            t1 = _mm_or_si128(_mm_srl_epi32(t1, shiftRightVal), _mm_sll_epi32(t1, shiftLeftVal));
+            m[toAddr0/4+i] = s1;
+            m[toAddr1/4+i] = t1;
+            i++;
+            s2 = _mm_add_epi32(s2, m[prevAddr0/4+i]);
+            t2 = _mm_add_epi32(t2, m[prevAddr1/4+i]);
+            s2 = _mm_xor_si128(s2, m[fromAddr0/4+i]);
+            t2 = _mm_xor_si128(t2, m[fromAddr1/4+i]);
+            s2 = _mm_or_si128(_mm_srl_epi32(s2, shiftRightVal), _mm_sll_epi32(s2, shiftLeftVal));
+            t2 = _mm_or_si128(_mm_srl_epi32(t2, shiftRightVal), _mm_sll_epi32(t2, shiftLeftVal));
+            m[toAddr0/4+i] = s2;
+            m[toAddr1/4+i] = t2;
+            i++;
+        }
+    }
+    convStateFromM128iToUint32(&s1, &s2, state0);
+    convStateFromM128iToUint32(&t1, &t2, state1);
+}
+
+// The generic two-lane kernel.
+static void hashBlocks2(uint32_t state0[8], uint32_t state1[8], uint32_t *mem, uint32_t blocklen,
+        uint64_t fromAddr0, uint64_t toAddr0, uint64_t fromAddr1, uint64_t toAddr1, uint32_t repetitions) {
+    hashBlocks2Inline(state0, state1, mem, blocklen, fromAddr0, toAddr0, fromAddr1, toAddr1, repetitions);
+}
+
+// Define a two-lane kernel for one block size in bytes with one repetition.
+#define HASH_BLOCKS2_KERNEL(blockSize) \
+    static void hashBlocks2_##blockSize(uint32_t state0[8], uint32_t state1[8], uint32_t *mem, uint32_t blocklen, \
+            uint64_t fromAddr0, uint64_t toAddr0, uint64_t fromAddr1, uint64_t toAddr1, uint32_t repetitions) { \
+        (void)blocklen; \
+        (void)repetitions; \
+        hashBlocks2Inline(state0, state1, mem, blockSize/sizeof(uint32_t), fromAddr0, toAddr0, fromAddr1, \
+            toAddr1, 1); \
+    }
+
+HASH_BLOCKS2_KERNEL(64)
+HASH_BLOCKS2_KERNEL(1024)
+HASH_BLOCKS2_KERNEL(4096)
+HASH_BLOCKS2_KERNEL(16384)
+
+// The specialized two-lane kernels, by block length in words.  They all assume repetitions == 1.
+static const struct {
+    uint32_t blocklen;
+    TigerKDFHashBlocks2Func hashBlocks2;
+} hashBlocks2Kernels[] = {
+    {64/sizeof(uint32_t), hashBlocks2_64},
+    {1024/sizeof(uint32_t), hashBlocks2_1024},
+    {4096/sizeof(uint32_t), hashBlocks2_4096},
+    {16384/sizeof(uint32_t), hashBlocks2_16384},
+};
+
+// Return the fastest two-lane kernel for blocklen and repetitions, or the generic one if specialized is false.
+TigerKDFHashBlocks2Func selectHashBlocks2(uint32_t blocklen, uint32_t repetitions, bool specialized) {
+    if(testHashBlocks2 != NULL) {
+        return testHashBlocks2;
+    }
+    if(specialized && repetitions == 1) {
+        uint32_t i;
+        for(i = 0; i < sizeof(hashBlocks2Kernels)/sizeof(hashBlocks2Kernels[0]); i++) {
+            if(hashBlocks2Kernels[i].blocklen == blocklen) {
+                return hashBlocks2Kernels[i].hashBlocks2;
+            }
+        }
+    }
+    return hashBlocks2;
+}
+
 // Hash the multiply context into our state.  If the multiplies are falling behind, sleep
-// for a while.
-static void hashMultItoState(uint32_t iteration, struct TigerKDFCommonDataStruct *c, uint32_t *state) {
-    while(iteration >= c->completedMultiplies) {
-        struct timespec ts;
-        ts.tv_sec = 0;
-        ts.tv_nsec = 1000000; // 1ms
-        nanosleep(&ts, NULL);
+// for a while.  If waits is not NULL, count how long we waited in it.  Phase and p are for the probes.
+static void hashMultItoState(uint32_t iteration, struct TigerKDFCommonDataStruct *c, uint32_t *state,
+        uint32_t phase, uint32_t p, TigerKDFHistogram *waits) {
+    if(iteration >= atomic_load_explicit(&c->completedMultiplies, memory_order_acquire)) {
+        TIGERKDF_PROBE3(wait_start, phase, p, iteration);
+        // Only read the clock when we have to wait anyway.
+        double start = waits != NULL? getTime() : 0.0;
+        while(iteration >= atomic_load_explicit(&c->completedMultiplies, memory_order_acquire)) {
+            if(controlStopped(&c->control)) {
+                // The multiplies we wait for will never come.
+                return;
+            }
+            struct timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 1000000; // 1ms
+            nanosleep(&ts, NULL);
+        }
+        TIGERKDF_PROBE3(wait_end, phase, p, iteration);
+        if(waits != NULL) {
+            addToHistogram(waits, (getTime() - start)*1e9);
+        }
+    } else if(waits != NULL) {
+        addToHistogram(waits, 0);
     }
     uint32_t i;
     for(i = 0; i < 8; i++) {
@@ -166,117 +330,236 @@ static void hashMultItoState(uint32_t iteration, struct TigerKDFCommonDataStruct
     }
     // Perform blake2s hash on the state
     uint8_t buf[32];
-    be32enc_vect(buf, state, 32);
+    be32enc_vect_fast(buf, state, 32);
     blake2s(buf, buf, NULL, 32, 32, 0);
-    be32dec_vect(state, buf, 32);
+    be32dec_vect_fast(state, buf, 32);
+}
+
+// Add the waits of lane p in phase to the stats.
+static void recordWaits(struct TigerKDFCommonDataStruct *c, uint32_t phase, uint32_t p,
+        const TigerKDFHistogram *waits) {
+    if(c->laneWaits != NULL) {
+        mergeHistogram(c->laneWaits + phase*(uint64_t)c->parallelism + p, waits);
+    }
+    pthread_mutex_lock(&c->statsMutex);
+    mergeHistogram(c->stats->waits + phase, waits);
+    pthread_mutex_unlock(&c->statsMutex);
+}
+
+// Where one of the lanes a lane function hashes in lockstep is.
+struct TigerKDFLaneStruct {
+    uint32_t p;
+    uint64_t start;
+    uint64_t toAddr;
+    uint32_t state[8];
+    TigerKDFHistogram histogram;
+    TigerKDFHistogram *waits;
+};
+
+// Return the lanes lane function call task hashes in lockstep, starting each with the initial state and the
+// first block to hash at start.  Phase is for the probes.
+static uint32_t startLanes(struct TigerKDFCommonDataStruct *c, uint32_t phase, uint32_t task,
+        struct TigerKDFLaneStruct lanes[2]) {
+    uint32_t first = task*c->lanesPerTask;
+    uint32_t numLanes = c->parallelism - first < c->lanesPerTask? c->parallelism - first : c->lanesPerTask;
+    uint32_t k;
+    for(k = 0; k < numLanes; k++) {
+        struct TigerKDFLaneStruct *lane = lanes + k;
+        lane->p = first + k;
+        TIGERKDF_PROBE4(lane_start, phase, lane->p, c->numblocks, c->blocklen);
+        lane->start = (2*lane->p + phase)*(uint64_t)c->numblocks*c->blocklen;
+        lane->toAddr = lane->start;
+        uint32_t i;
+        for(i = 0; i < 8; i++) {
+            lane->state[i] = 1;
+        }
+        lane->waits = NULL;
+        if(c->stats != NULL) {
+            memset(&lane->histogram, 0, sizeof(TigerKDFHistogram));
+            lane->waits = &lane->histogram;
+        }
+    }
+    return numLanes;
+}
+
+// Record the waits of lanes that are done.
+static void endLanes(struct TigerKDFCommonDataStruct *c, uint32_t phase, struct TigerKDFLaneStruct *lanes,
+        uint32_t numLanes) {
+    uint32_t k;
+    for(k = 0; k < numLanes; k++) {
+        if(lanes[k].waits != NULL) {
+            recordWaits(c, phase, lanes[k].p, lanes[k].waits);
+        }
+        TIGERKDF_PROBE4(lane_end, phase, lanes[k].p, c->numblocks, c->blocklen);
+    }
+}
+
+// Hash block i of each lane from its from block, with one kernel call for both lanes of a pair, and move on.
+static inline void hashLaneBlocks(struct TigerKDFCommonDataStruct *c, uint32_t phase, uint32_t i,
+        struct TigerKDFLaneStruct *lanes, uint32_t numLanes, const uint64_t fromAddr[2]) {
+    uint32_t k;
+    for(k = 0; k < numLanes; k++) {
+        addGraphEdge(c->graph, lanes[k].toAddr, fromAddr[k], c->blocklen);
+    }
+    if(numLanes == 2) {
+        c->hashBlocks2(lanes[0].state, lanes[1].state, c->mem, c->blocklen, fromAddr[0], lanes[0].toAddr,
+            fromAddr[1], lanes[1].toAddr, c->repetitions);
+    } else {
+        c->hashBlocks(lanes[0].state, c->mem, c->blocklen, fromAddr[0], lanes[0].toAddr, c->repetitions);
+    }
+    for(k = 0; k < numLanes; k++) {
+        hashMultItoState(i, c, lanes[k].state, phase, lanes[k].p, lanes[k].waits);
+        lanes[k].toAddr += c->blocklen;
+    }
 }
 
 // Hash memory without doing any password dependent memory addressing to thwart cache-timing-attacks.
-static void *hashWithoutPassword(void *contextPtr) {
-    struct TigerKDFContextStruct *ctx = (struct TigerKDFContextStruct *)contextPtr;
-    struct TigerKDFCommonDataStruct *c = ctx->common;
+static void hashWithoutPassword(void *commonPtr, uint32_t task, uint32_t w) {
+    struct TigerKDFCommonDataStruct *c = (struct TigerKDFCommonDataStruct *)commonPtr;
 
     uint32_t *mem = c->mem;
     uint8_t *hash = c->hash;
     uint32_t hashSize = c->hashSize;
-    uint32_t p = ctx->p;
     uint32_t blocklen = c->blocklen;
     uint32_t numblocks = c->numblocks;
-    uint32_t repetitions = c->repetitions;
 
-    uint64_t start = 2*p*(uint64_t)numblocks*blocklen;
-    uint8_t threadKey[blocklen*sizeof(uint32_t)];
-    uint8_t s[sizeof(uint32_t)];
-    be32enc(s, p);
-    H(threadKey, blocklen*sizeof(uint32_t), hash, hashSize, s, sizeof(uint32_t));
-    be32dec_vect(mem + start, threadKey, blocklen*sizeof(uint32_t));
-    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
-    uint32_t mask = 1;
-    uint64_t toAddr = start + blocklen;
+    if(controlStopped(&c->control)) {
+        return;
+    }
+    struct TigerKDFLaneStruct lanes[2];
+    uint32_t numLanes = startLanes(c, 0, task, lanes);
+    uint32_t k;
+    for(k = 0; k < numLanes; k++) {
+        // Expand the key straight into the lane's first block and decode it in place.
+        uint64_t start = lanes[k].start;
+        uint8_t *threadKey = (uint8_t *)(mem + start);
+        expandThreadKey(threadKey, blocklen*sizeof(uint32_t), hash, hashSize, lanes[k].p, c->version,
+            c->workers > 1? 1 : 0);
+        be32dec_vect_fast(mem + start, threadKey, blocklen*sizeof(uint32_t));
+        if(c->graph != NULL) {
+            c->graph[start/blocklen] = TIGERKDF_GRAPH_NO_BLOCK;
+        }
+        lanes[k].toAddr += blocklen;
+    }
+    // The schedule is NULL when numblocks is too large to cache.
+    const uint32_t *from = c->schedule != NULL? c->schedule->from : NULL;
+    uint32_t checked = 1;
     uint32_t i;
     for(i = 1; i < numblocks; i++) {
-        if(mask << 1 <= i) {
-            mask = mask << 1;
+        if((i & c->control.checkMask) == 0) {
+            if(!checkControl(&c->control, w, numLanes*(i - checked))) {
+                break;
+            }
+            checked = i;
+        }
+        if(c->laneProgress != NULL) {
+            atomic_store_explicit(c->laneProgress + w, i, memory_order_relaxed);
         }
-        uint32_t reversePos = bitReverse(i, mask);
-        if(reversePos + mask < i) {
-            reversePos += mask;
+        // Every lane hashes the same block of its own half.
+        uint32_t reversePos = from != NULL? from[i] : scheduleFrom(i);
+        uint64_t fromAddr[2];
+        for(k = 0; k < numLanes; k++) {
+            fromAddr[k] = lanes[k].start + (uint64_t)blocklen*reversePos;
         }
-        uint64_t fromAddr = start + (uint64_t)blocklen*reversePos;
-//printf("hashing block %u without password\n", i);
-        hashBlocks(state, mem, blocklen, fromAddr, toAddr, repetitions);
-        hashMultItoState(i, c, state);
-        toAddr += blocklen;
+        hashLaneBlocks(c, 0, i, lanes, numLanes, fromAddr);
     }
-    pthread_exit(NULL);
+    if(c->laneProgress != NULL) {
+        atomic_store_explicit(c->laneProgress + w, UINT32_MAX, memory_order_relaxed);
+    }
+    endLanes(c, 0, lanes, numLanes);
 }
 
 // Hash memory with dependent memory addressing to thwart TMTO attacks.
-static void *hashWithPassword(void *contextPtr) {
-    struct TigerKDFContextStruct *ctx = (struct TigerKDFContextStruct *)contextPtr;
-    struct TigerKDFCommonDataStruct *c = ctx->common;
+static void hashWithPassword(void *commonPtr, uint32_t task, uint32_t w) {
+    struct TigerKDFCommonDataStruct *c = (struct TigerKDFCommonDataStruct *)commonPtr;
 
-    uint32_t *mem = c->mem;
     uint32_t parallelism = c->parallelism;
-    uint32_t p = ctx->p;
     uint32_t blocklen = c->blocklen;
     uint32_t numblocks = c->numblocks;
-    uint32_t repetitions = c->repetitions;
 
-    uint64_t start = (2*p + 1)*(uint64_t)numblocks*blocklen;
-    uint32_t state[8] = {1, 1, 1, 1, 1, 1, 1, 1};
-    uint64_t toAddr = start;
+    if(controlStopped(&c->control)) {
+        return;
+    }
+    struct TigerKDFLaneStruct lanes[2];
+    uint32_t numLanes = startLanes(c, 1, task, lanes);
+    uint32_t checked = 0;
     uint32_t i;
     for(i = 0; i < numblocks; i++) {
-        uint64_t v = state[0];
-        uint64_t v2 = v*v >> 32;
-        uint64_t v3 = v*v2 >> 32;
-        uint32_t distance = (i + numblocks - 1)*v3 >> 32;
-        uint64_t fromAddr;
-        if(distance < i) {
-            fromAddr = start + (i - 1 - distance)*(uint64_t)blocklen;
-        } else {
-            uint32_t q = (p + i) % parallelism;
-            uint32_t b = numblocks - 1 - (distance - i);
-            fromAddr = (2*numblocks*q + b)*(uint64_t)blocklen;
+        if((i & c->control.checkMask) == 0) {
+            if(!checkControl(&c->control, w, numLanes*(i - checked))) {
+                break;
+            }
+            checked = i;
         }
-//printf("hashing block %u with password\n", i);
-        hashBlocks(state, mem, blocklen, fromAddr, toAddr, repetitions);
-        hashMultItoState(i, c, state);
-        toAddr += blocklen;
+        uint64_t fromAddr[2];
+        uint32_t k;
+        for(k = 0; k < numLanes; k++) {
+            fromAddr[k] = passwordFromAddr(lanes[k].state[0], i, lanes[k].p, numblocks, parallelism, blocklen);
+        }
+        hashLaneBlocks(c, 1, i, lanes, numLanes, fromAddr);
     }
-    pthread_exit(NULL);
+    endLanes(c, 1, lanes, numLanes);
 }
 
-// The TigerKDF password hashing function.  MemSize is in KiB.
+// The TigerKDF password hashing function.  MemSize is in KiB.  Options may be NULL.
 bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t startGarlic,
-        uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash) {
+        uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions, bool skipLastHash,
+        const TigerKDFOptions *options) {
+    double startTime = getTime();
+    TigerKDFStats *stats = getStats(options);
+    TigerKDFMemoryUsage memoryUsage;
+    startMemoryStats(stats, &memoryUsage);
     uint64_t memlen = (1 << 10)*(uint64_t)memSize/sizeof(uint32_t);
     uint32_t blocklen = blockSize/sizeof(uint32_t);
     uint32_t numblocks = (memlen/(2*parallelism*blocklen)) << startGarlic;
     memlen = (2*parallelism*(uint64_t)numblocks*blocklen) << (stopGarlic - startGarlic);
-    uint32_t *mem = (uint32_t *)aligned_alloc(32, memlen*sizeof(uint32_t));
+    uint64_t memBytes = TigerKDF_ArenaSize(memSize, stopGarlic, blockSize, parallelism);
+    uint32_t *arena = (uint32_t *)getArena(options, memBytes);
+    uint32_t *mem = arena != NULL? arena : (uint32_t *)aligned_alloc(32, memBytes);
     if(mem == NULL) {
         return false;
     }
+    // Those block sizes also leave the last words of some blocks unwritten, so start from zeroed memory to keep
+    // the hash from depending on what the allocator hands us.
+    if(blockSize % 32 != 0) {
+        memset(mem, 0, memBytes);
+    }
     pthread_t multThread;
-    pthread_t *memThreads = (pthread_t *)aligned_alloc(32, parallelism*sizeof(pthread_t));
-    if(memThreads == NULL) {
-        return false;
+    uint32_t workers = getWorkers(options, parallelism);
+    // Interleaving needs a second lane for the worker.  AUTO does not interleave; see TIGERKDF_INTERLEAVE_AUTO.
+    uint32_t interleave = options != NULL? options->interleave : TIGERKDF_INTERLEAVE_AUTO;
+    uint32_t lanesPerTask = 1;
+    if(interleave == TIGERKDF_INTERLEAVE_PAIRS && parallelism >= 2) {
+        lanesPerTask = 2;
     }
-    struct TigerKDFContextStruct *c = (struct TigerKDFContextStruct *)aligned_alloc(32,
-            parallelism*sizeof(struct TigerKDFContextStruct));
-    if(c == NULL) {
-        return false;
+    uint32_t tasks = (parallelism + lanesPerTask - 1)/lanesPerTask;
+    if(workers > tasks) {
+        workers = tasks;
     }
     struct TigerKDFCommonDataStruct common;
     uint32_t *multHashes = (uint32_t *)aligned_alloc(32, 8*sizeof(uint32_t)*memlen/blocklen);
     if(multHashes == NULL) {
         return false;
     }
-    if(c == NULL) {
+    TigerKDFGraph graph;
+    if(!openGraph(&graph, options, parallelism, blockSize, numblocks, startGarlic, stopGarlic)) {
+        free(multHashes);
+        if(arena == NULL) {
+            free(mem);
+        }
         return false;
     }
+    common.stats = stats;
+    common.laneWaits = getLaneWaits(stats, parallelism);
+    common.workers = workers;
+    common.laneProgress = NULL;
+    if(stats != NULL) {
+        // Without it we only lose the lead histogram.
+        common.laneProgress = (atomic_uint_least32_t *)malloc(workers*sizeof(atomic_uint_least32_t));
+    }
+    pthread_mutex_init(&common.statsMutex, NULL);
+    initControl(&common.control, options, blockSize, repetitions);
+    bool passed = true;
     uint8_t i;
     for(i = startGarlic; i <= stopGarlic; i++) {
         common.multHashes = multHashes;
@@ -290,45 +573,68 @@ bool TigerKDF(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multi
         common.repetitions = repetitions;
         common.multHashes = multHashes;
         common.multipliesPerBlock = multipliesPerBlock;
-        common.completedMultiplies = 0;
+        atomic_init(&common.completedMultiplies, 0);
+        common.version = getVersion(options);
+        common.hashBlocks = selectHashBlocks(blocklen, repetitions, true);
+        common.hashBlocks2 = selectHashBlocks2(blocklen, repetitions, true);
+        common.lanesPerTask = lanesPerTask;
+        if(common.laneProgress != NULL) {
+            uint32_t w;
+            for(w = 0; w < workers; w++) {
+                atomic_init(common.laneProgress + w, UINT32_MAX);
+            }
+        }
+        common.graph = graph.entries;
+        common.schedule = acquireSchedule(numblocks);
+        addScheduleStats(stats, common.schedule);
+        TIGERKDF_PROBE4(garlic_start, i, numblocks, blocklen, parallelism);
+        double phaseStart = getTime();
+        startControlPhase(&common.control, i, 0, parallelism*(uint64_t)(numblocks - 1));
         int rc = pthread_create(&multThread, NULL, multHash, (void *)&common);
         if(rc) {
             fprintf(stderr, "Unable to start threads\n");
-            return false;
-        }
-        uint32_t p;
-        for(p = 0; p < parallelism; p++) {
-            c[p].common = &common;
-            c[p].p = p;
-            rc = pthread_create(&memThreads[p], NULL, hashWithoutPassword, (void *)(c + p));
-            if(rc) {
-                fprintf(stderr, "Unable to start threads\n");
-                return false;
-            }
-        }
-        for(p = 0; p < parallelism; p++) {
-            (void)pthread_join(memThreads[p], NULL);
+            releaseSchedule(common.schedule);
+            passed = false;
+            break;
         }
+        runLanes(hashWithoutPassword, &common, tasks, workers);
         (void)pthread_join(multThread, NULL);
-        for(p = 0; p < parallelism; p++) {
-            int rc = pthread_create(&memThreads[p], NULL, hashWithPassword, (void *)(c + p));
-            if(rc) {
-                fprintf(stderr, "Unable to start threads\n");
-                return false;
-            }
+        releaseSchedule(common.schedule);
+        double phaseEnd = getTime();
+        addPhaseStats(stats, 0, phaseEnd - phaseStart, parallelism*(uint64_t)(numblocks - 1), blocklen, repetitions);
+        addThrottleStats(stats, &common.control);
+        if(!endControlPhase(&common.control)) {
+            passed = false;
+            break;
         }
-        for(p = 0; p < parallelism; p++) {
-            (void)pthread_join(memThreads[p], NULL);
+        startControlPhase(&common.control, i, 1, parallelism*(uint64_t)numblocks);
+        runLanes(hashWithPassword, &common, tasks, workers);
+        addPhaseStats(stats, 1, getTime() - phaseEnd, parallelism*(uint64_t)numblocks, blocklen, repetitions);
+        addThrottleStats(stats, &common.control);
+        if(!endControlPhase(&common.control)) {
+            passed = false;
+            break;
         }
         xorIntoHash(hash, hashSize, mem, blocklen, numblocks, parallelism);
-        numblocks *= 2;
         if(i < stopGarlic || !skipLastHash) {
-            H(hash, hashSize, hash, hashSize, &i, 1);
+            HVersion(hash, hashSize, hash, hashSize, &i, 1, common.version);
+        }
+        TIGERKDF_PROBE4(garlic_end, i, numblocks, blocklen, parallelism);
+        if(graph.entries != NULL) {
+            graph.entries += 2*(uint64_t)parallelism*numblocks;
         }
+        numblocks *= 2;
     }
+    endMemoryStats(stats, &memoryUsage, mem, memBytes);
     free(multHashes);
-    free(c);
-    free(memThreads);
-    free(mem);
-    return true;
+    closeGraph(&graph);
+    free(common.laneProgress);
+    pthread_mutex_destroy(&common.statsMutex);
+    if(arena == NULL) {
+        free(mem);
+    }
+    if(stats != NULL) {
+        stats->totalSeconds = getTime() - startTime;
+    }
+    return passed;
 }
@@ -8,6 +8,10 @@
 #include <string.h>
 
 #include "tigerkdf.h"
+#include "tigerkdf-internal.h"
+#include "pbkdf2.h"
+#include "blake2/blake2.h"
+#include "blake2/blake2-kat.h"
 
 void print_hex(char *message, uint8_t *x, int len) {
     int i;
@@ -149,20 +153,1116 @@ void verifyClientServer(void) {
     }
 }
 
+// An independent BLAKE2s, written from RFC 7693, to check the BLAKE2Xs lane keys against.
+static const uint8_t testSigma[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+};
+
+static const uint32_t testIV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+    0x1f83d9ab, 0x5be0cd19};
+
+static uint32_t testLoad32(const uint8_t *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t testRotr(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void testMix(uint32_t v[16], uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t x, uint32_t y) {
+    v[a] += v[b] + x;
+    v[d] = testRotr(v[d] ^ v[a], 16);
+    v[c] += v[d];
+    v[b] = testRotr(v[b] ^ v[c], 12);
+    v[a] += v[b] + y;
+    v[d] = testRotr(v[d] ^ v[a], 8);
+    v[c] += v[d];
+    v[b] = testRotr(v[b] ^ v[c], 7);
+}
+
+// Hash an unkeyed message with the 32-byte BLAKE2s parameter block param, and return the first outSize bytes.
+static void testBlake2s(uint8_t *out, uint32_t outSize, const uint8_t param[32], const uint8_t *in,
+        uint32_t inSize) {
+    uint32_t h[8];
+    uint32_t i, r;
+    for(i = 0; i < 8; i++) {
+        h[i] = testIV[i] ^ testLoad32(param + 4*i);
+    }
+    uint32_t done = 0;
+    do {
+        uint8_t block[64];
+        uint32_t length = inSize - done < 64? inSize - done : 64;
+        memset(block, 0, 64);
+        memcpy(block, in + done, length);
+        done += length;
+        uint32_t m[16], v[16];
+        for(i = 0; i < 16; i++) {
+            m[i] = testLoad32(block + 4*i);
+        }
+        for(i = 0; i < 8; i++) {
+            v[i] = h[i];
+            v[i + 8] = testIV[i];
+        }
+        v[12] ^= done;
+        if(done == inSize) {
+            v[14] = ~v[14];
+        }
+        for(r = 0; r < 10; r++) {
+            const uint8_t *s = testSigma[r];
+            testMix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            testMix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            testMix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            testMix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            testMix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            testMix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            testMix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            testMix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for(i = 0; i < 8; i++) {
+            h[i] ^= v[i] ^ v[i + 8];
+        }
+    } while(done < inSize);
+    for(i = 0; i < outSize; i++) {
+        out[i] = h[i/4] >> (8*(i%4));
+    }
+}
+
+// BLAKE2Xs of in, with the parameter blocks spelled out byte by byte as the BLAKE2X paper gives them.
+static void testBlake2xs(uint8_t *out, uint32_t outSize, const uint8_t *in, uint32_t inSize) {
+    uint32_t xofLength = outSize < 0xffff? outSize : 0xffff;
+    uint8_t param[32];
+    memset(param, 0, 32);
+    param[0] = 32; // Digest length
+    param[2] = 1; // Fanout
+    param[3] = 1; // Depth
+    param[12] = xofLength;
+    param[13] = xofLength >> 8;
+    uint8_t root[32];
+    testBlake2s(root, 32, param, in, inSize);
+    uint32_t i;
+    for(i = 0; 32*i < outSize; i++) {
+        memset(param, 0, 32);
+        param[0] = outSize - 32*i < 32? outSize - 32*i : 32;
+        param[4] = 32; // Leaf length
+        param[8] = i; // Node offset
+        param[9] = i >> 8;
+        param[10] = i >> 16;
+        param[11] = i >> 24;
+        param[12] = xofLength;
+        param[13] = xofLength >> 8;
+        param[15] = 32; // Inner length
+        testBlake2s(out + 32*i, param[0], param, root, 32);
+    }
+}
+
+// Check the independent BLAKE2s against the RFC 7693 example, and then the tree key version's lane keys against
+// BLAKE2Xs of the hash and the lane number, for key sizes that use the 8-way kernel, the tail, or both, and for
+// a size too long for the 16-bit output length.
+void verifyTreeKeyExpansion(void) {
+    uint8_t param[32];
+    memset(param, 0, 32);
+    param[0] = 32;
+    param[2] = 1;
+    param[3] = 1;
+    uint8_t digest[32];
+    static const uint8_t abcDigest[32] = {0x50, 0x8c, 0x5e, 0x8c, 0x32, 0x7c, 0x14, 0xe2, 0xe1, 0xa7, 0x2b, 0xa3,
+        0x4e, 0xeb, 0x45, 0x2f, 0x37, 0x45, 0x8b, 0x20, 0x9e, 0xd6, 0x3a, 0x29, 0x4d, 0x99, 0x9b, 0x4c, 0x86, 0x67,
+        0x59, 0x82};
+    testBlake2s(digest, 32, param, (uint8_t *)"abc", 3);
+    if(memcmp(digest, abcDigest, 32)) {
+        fprintf(stderr, "Test BLAKE2s got wrong answer!\n");
+        exit(1);
+    }
+    uint8_t hash[32];
+    uint32_t i;
+    for(i = 0; i < 32; i++) {
+        hash[i] = i*7;
+    }
+    uint32_t keySizes[] = {12, 32, 100, 256, 292, 1024, 65536 + 36};
+    uint32_t p = 0;
+    for(i = 0; i < sizeof(keySizes)/sizeof(uint32_t); i++) {
+        uint32_t keySize = keySizes[i];
+        uint8_t *key = malloc(keySize);
+        uint8_t *expected = malloc(keySize);
+        uint8_t in[36];
+        if(key == NULL || expected == NULL) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            exit(1);
+        }
+        expandThreadKey(key, keySize, hash, 32, p, TIGERKDF_VERSION_TREE_KEY, 0);
+        memcpy(in, hash, 32);
+        be32enc(in + 32, p);
+        testBlake2xs(expected, keySize, in, 36);
+        if(memcmp(key, expected, keySize)) {
+            fprintf(stderr, "Tree key of %u bytes for lane %u got wrong answer!\n", keySize, p);
+            exit(1);
+        }
+        free(key);
+        free(expected);
+        p = p*3 + 1;
+    }
+}
+
+// Check that server relief agrees with the full hash for the tree key version.
+void verifyTreeKey(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = TIGERKDF_VERSION_TREE_KEY;
+    uint8_t hash1[32], hash2[32];
+    if(!TigerKDF_ClientHashPasswordExt(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1024, 4096, 1,
+            NULL, 0, 16384, 2, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    TigerKDF_ServerHashPassword(hash1, 32, 1);
+    if(!TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1024, 4096, 1,
+            NULL, 0, 16384, 2, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(memcmp(hash1, hash2, 32)) {
+        fprintf(stderr, "Tree key client/server got wrong answer!\n");
+        exit(1);
+    }
+}
+
+// Check that options and stats from an older or newer caller are honored, and that ones the library cannot read
+// are refused.
+void verifyOptionsSize(void) {
+    // A caller built against a later release, with a field this library does not know.
+    struct {
+        TigerKDFOptions options;
+        uint64_t newField;
+    } newer;
+    struct {
+        TigerKDFStats stats;
+        uint64_t newField;
+    } newerStats;
+    memset(&newer, 0, sizeof(newer));
+    memset(&newerStats, 0, sizeof(newerStats));
+    newer.options.size = sizeof(newer);
+    newer.options.stats = &newerStats.stats;
+    newerStats.stats.size = sizeof(newerStats);
+    uint8_t hash1[32], hash2[32];
+    if(!TigerKDF_HashPasswordExt(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0,
+            64, 2, 1, NULL) || !TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt",
+            4, 64, 16, 1, NULL, 0, 64, 2, 1, &newer.options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(memcmp(hash1, hash2, 32) || newerStats.stats.totalSeconds <= 0.0 ||
+            newerStats.stats.size != sizeof(newerStats) || newerStats.newField != 0) {
+        fprintf(stderr, "Options from a newer caller got wrong answer!\n");
+        exit(1);
+    }
+    newer.newField = 1;
+    if(TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0,
+            64, 2, 1, &newer.options)) {
+        fprintf(stderr, "Options with an unknown field set were accepted!\n");
+        exit(1);
+    }
+    newer.newField = 0;
+    newer.options.size = 0;
+    if(TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0,
+            64, 2, 1, &newer.options)) {
+        fprintf(stderr, "Options without a size were accepted!\n");
+        exit(1);
+    }
+    newer.options.size = sizeof(TigerKDFOptions);
+    newerStats.stats.size = offsetof(TigerKDFStats, totalSeconds);
+    if(TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0,
+            64, 2, 1, &newer.options)) {
+        fprintf(stderr, "Stats too small to hold their fields were accepted!\n");
+        exit(1);
+    }
+    TigerKDF_ServerHashPassword(hash2, 32, 1);
+    TigerKDF_ServerHashPasswordExt(hash2, 32, 1, &newer.options);
+    uint8_t zeros[32] = {0};
+    if(memcmp(hash2, zeros, 32)) {
+        fprintf(stderr, "Server relief with invalid options did not clear the hash!\n");
+        exit(1);
+    }
+}
+
+// Check the multi-buffer BLAKE2s against the keyed known answers in every lane, and that lanes hashing
+// different messages each get what blake2s gives, and that states out of lockstep are refused.
+void verifyBlake2sMulti(void) {
+    uint8_t key[BLAKE2S_KEYBYTES];
+    uint8_t buf[8][KAT_LENGTH];
+    uint32_t i, j;
+    for(i = 0; i < BLAKE2S_KEYBYTES; i++) {
+        key[i] = i;
+    }
+    for(j = 0; j < 8; j++) {
+        for(i = 0; i < KAT_LENGTH; i++) {
+            buf[j][i] = i + 37*j;
+        }
+    }
+    for(i = 0; i < KAT_LENGTH; i++) {
+        uint8_t hash[8][BLAKE2S_OUTBYTES];
+        uint8_t *out[8];
+        const uint8_t *in[8];
+        for(j = 0; j < 8; j++) {
+            out[j] = hash[j];
+            in[j] = buf[0];
+        }
+        uint32_t n;
+        for(n = 4; n <= 8; n += 4) {
+            memset(hash, 0, sizeof(hash));
+            int ret = n == 4? blake2s_x4(out, in, key, BLAKE2S_OUTBYTES, i, BLAKE2S_KEYBYTES) :
+                blake2s_x8(out, in, key, BLAKE2S_OUTBYTES, i, BLAKE2S_KEYBYTES);
+            if(ret != 0) {
+                fprintf(stderr, "Multi-buffer BLAKE2s failed!\n");
+                exit(1);
+            }
+            for(j = 0; j < n; j++) {
+                if(memcmp(hash[j], blake2s_keyed_kat[i], BLAKE2S_OUTBYTES)) {
+                    fprintf(stderr, "%u-way BLAKE2s got wrong answer for %u bytes!\n", n, i);
+                    exit(1);
+                }
+            }
+        }
+        for(j = 0; j < 8; j++) {
+            in[j] = buf[j];
+        }
+        if(blake2s_x8(out, in, NULL, BLAKE2S_OUTBYTES, i, 0) != 0) {
+            fprintf(stderr, "Multi-buffer BLAKE2s failed!\n");
+            exit(1);
+        }
+        for(j = 0; j < 8; j++) {
+            uint8_t expected[BLAKE2S_OUTBYTES];
+            blake2s(expected, in[j], NULL, BLAKE2S_OUTBYTES, i, 0);
+            if(memcmp(hash[j], expected, BLAKE2S_OUTBYTES)) {
+                fprintf(stderr, "Multi-buffer BLAKE2s lane %u got wrong answer for %u bytes!\n", j, i);
+                exit(1);
+            }
+        }
+    }
+    blake2s_state states[4];
+    blake2s_state *S[4];
+    uint8_t hash[4][BLAKE2S_OUTBYTES];
+    uint8_t *out[4];
+    const uint8_t *in[4];
+    for(j = 0; j < 4; j++) {
+        blake2s_init(&states[j], BLAKE2S_OUTBYTES);
+        S[j] = &states[j];
+        out[j] = hash[j];
+        in[j] = buf[j];
+    }
+    blake2s_update(S[3], buf[3], 1);
+    if(blake2s_x4_update_final(S, in, 64, out, BLAKE2S_OUTBYTES) == 0) {
+        fprintf(stderr, "Multi-buffer BLAKE2s hashed states out of lockstep!\n");
+        exit(1);
+    }
+}
+
+// HMAC-BLAKE2s of the two messages, the way the baseline pbkdf2.c computed it: hashing only the first 32 bytes
+// of the inner pad.
+static void testHmacBlake2s(uint8_t digest[32], const uint8_t *key, uint32_t keySize, const uint8_t *msg1,
+        uint32_t msg1Size, const uint8_t *msg2, uint32_t msg2Size) {
+    uint8_t keyHash[32], pad[64], inner[32];
+    blake2s_state S;
+    if(keySize > 64) {
+        blake2s(keyHash, key, NULL, 32, keySize, 0);
+        key = keyHash;
+        keySize = 32;
+    }
+    uint32_t i;
+    memset(pad, 0x36, 64);
+    for(i = 0; i < keySize; i++) {
+        pad[i] ^= key[i];
+    }
+    blake2s_init(&S, 32);
+    blake2s_update(&S, pad, 32);
+    blake2s_update(&S, msg1, msg1Size);
+    blake2s_update(&S, msg2, msg2Size);
+    blake2s_final(&S, inner, 32);
+    memset(pad, 0x5c, 64);
+    for(i = 0; i < keySize; i++) {
+        pad[i] ^= key[i];
+    }
+    blake2s_init(&S, 32);
+    blake2s_update(&S, pad, 64);
+    blake2s_update(&S, inner, 32);
+    blake2s_final(&S, digest, 32);
+}
+
+// PBKDF2 over testHmacBlake2s, one HMAC at a time from scratch, as the baseline PBKDF2_BLAKE2 did.
+static void testPbkdf2Blake2s(const uint8_t *password, uint32_t passwordSize, const uint8_t *salt,
+        uint32_t saltSize, uint64_t c, uint8_t *buf, uint32_t dkLen) {
+    uint32_t i;
+    for(i = 0; 32*i < dkLen; i++) {
+        uint8_t ivec[4], U[32], T[32];
+        be32enc(ivec, i + 1);
+        testHmacBlake2s(U, password, passwordSize, salt, saltSize, ivec, 4);
+        memcpy(T, U, 32);
+        uint64_t j;
+        for(j = 2; j <= c; j++) {
+            testHmacBlake2s(U, password, passwordSize, U, 32, NULL, 0);
+            uint32_t k;
+            for(k = 0; k < 32; k++) {
+                T[k] ^= U[k];
+            }
+        }
+        memcpy(buf + 32*i, T, dkLen - 32*i < 32? dkLen - 32*i : 32);
+    }
+}
+
+// Check PBKDF2_BLAKE2, with its cached pad states, 8- and 4-way HMACs and threads, against the baseline
+// computation.  The sizes cover single blocks, every mix of 8, 4 and 1 block tails, and derivations just under and
+// over the 2^14 HMACs that are split over threads, which we force so the split is covered on any host, and with
+// the split limited by the caller.
+void verifyPbkdf2(void) {
+    static const struct {
+        uint32_t dkLen;
+        uint32_t c;
+        uint32_t threads;
+        uint32_t maxThreads;
+    } cases[] = {
+        {1, 1, 0, 0}, {31, 2, 0, 0}, {32, 1, 0, 0}, {33, 3, 0, 0}, {100, 5, 0, 0}, {128, 1, 0, 0}, {128, 4, 0, 0},
+        {256, 2, 0, 0}, {11*32, 5, 0, 0}, {12*32, 3, 0, 0}, {13*32 + 5, 1, 0, 0}, {15*32 + 1, 2, 0, 0},
+        {16383*32, 1, 3, 0}, {16384*32 + 7, 1, 3, 0}, {3300*32 + 20, 5, 8, 0}, {4 << 20, 1, 7, 0},
+        {4 << 20, 1, 1, 0}, {4 << 20, 2, 0, 0}, {16384*32 + 5, 1, 8, 1}, {6000*32 + 9, 3, 8, 3},
+    };
+    uint8_t longPassword[100];
+    uint32_t i;
+    for(i = 0; i < sizeof(longPassword); i++) {
+        longPassword[i] = i;
+    }
+    for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+        uint32_t dkLen = cases[i].dkLen;
+        uint8_t *key = malloc(dkLen);
+        uint8_t *expected = malloc(dkLen);
+        if(key == NULL || expected == NULL) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            exit(1);
+        }
+        // Every other case uses a password longer than the HMAC block.
+        const uint8_t *password = i & 1? longPassword : (uint8_t *)"password";
+        uint32_t passwordSize = i & 1? sizeof(longPassword) : 8;
+        PBKDF2_BLAKE2_SetThreads(cases[i].threads);
+        PBKDF2_BLAKE2_Threads(password, passwordSize, (uint8_t *)"salt", 4, cases[i].c, key, dkLen,
+            cases[i].maxThreads);
+        PBKDF2_BLAKE2_SetThreads(0);
+        testPbkdf2Blake2s(password, passwordSize, (uint8_t *)"salt", 4, cases[i].c, expected, dkLen);
+        if(memcmp(key, expected, dkLen)) {
+            fprintf(stderr, "PBKDF2_BLAKE2 got wrong answer for %u bytes, %u iterations and %u threads, "
+                "at most %u!\n", dkLen, cases[i].c, cases[i].threads, cases[i].maxThreads);
+            exit(1);
+        }
+        free(key);
+        free(expected);
+    }
+}
+
+// Check PBKDF2-HMAC-BLAKE2b against known answers, then check that the BLAKE2b version of server relief agrees
+// with the full hash and differs from the original version.
+void verifyBlake2b(void) {
+    static const uint8_t expected1[20] = {
+        0x68, 0x4e, 0x7c, 0xc1, 0xdd, 0x9b, 0x24, 0x1d, 0x2c, 0x97,
+        0x7f, 0x38, 0xa8, 0x96, 0x64, 0x5d, 0xa4, 0x9b, 0x85, 0xeb};
+    static const uint8_t expected3[20] = {
+        0x05, 0x43, 0xfd, 0x2a, 0x48, 0xf0, 0xd9, 0xec, 0xde, 0xc5,
+        0x98, 0x63, 0xcf, 0x92, 0x34, 0xbf, 0xbb, 0x1d, 0x35, 0xcc};
+    uint8_t key[20];
+    PBKDF2_BLAKE2B((uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1, key, 20);
+    if(memcmp(key, expected1, 20)) {
+        fprintf(stderr, "PBKDF2_BLAKE2B got wrong answer for 1 iteration!\n");
+        exit(1);
+    }
+    PBKDF2_BLAKE2B((uint8_t *)"password", 8, (uint8_t *)"salt", 4, 3, key, 20);
+    if(memcmp(key, expected3, 20)) {
+        fprintf(stderr, "PBKDF2_BLAKE2B got wrong answer for 3 iterations!\n");
+        exit(1);
+    }
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.version = TIGERKDF_VERSION_BLAKE2B;
+    uint8_t hash1[32], hash2[32], hash3[32];
+    if(!TigerKDF_ClientHashPasswordExt(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1024, 4096, 1,
+            (uint8_t *)"data", 4, 16384, 2, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    TigerKDF_ServerHashPasswordExt(hash1, 32, 1, &options);
+    if(!TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1024, 4096, 1,
+            (uint8_t *)"data", 4, 16384, 2, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(memcmp(hash1, hash2, 32)) {
+        fprintf(stderr, "BLAKE2b client/server got wrong answer!\n");
+        exit(1);
+    }
+    if(!TigerKDF_HashPassword(hash3, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 1024, 4096, 1,
+            (uint8_t *)"data", 4, 16384, 2, 1)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(!memcmp(hash2, hash3, 32)) {
+        fprintf(stderr, "BLAKE2b version matches the original version!\n");
+        exit(1);
+    }
+}
+
+// The portable engine from tigerkdf-ref.c, which the Makefile builds into this program under this name.
+bool TigerKDFRef(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock,
+        uint8_t startGarlic, uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+        bool skipLastHash, const TigerKDFOptions *options);
+
+// A kernel for testHashBlocks.  Unlike the engines' kernels, it mixes every word it reads into the state and into
+// every word it writes, so a hash depends on every block address the engine computed.
+static void mixBlocks(uint32_t state[8], uint32_t *mem, uint32_t blocklen, uint64_t fromAddr, uint64_t toAddr,
+        uint32_t repetitions) {
+    uint64_t prevAddr = toAddr - blocklen;
+    uint32_t r, i;
+    for(r = 0; r < repetitions; r++) {
+        for(i = 0; i < blocklen; i++) {
+            uint32_t v = (state[i % 8] + mem[prevAddr + i]) ^ mem[fromAddr + i];
+            state[i % 8] = (v >> 7) | (v << 25);
+            mem[toAddr + i] = state[i % 8];
+        }
+    }
+}
+
+// The two-lane kernel for testHashBlocks2.
+static void mixBlocks2(uint32_t state0[8], uint32_t state1[8], uint32_t *mem, uint32_t blocklen,
+        uint64_t fromAddr0, uint64_t toAddr0, uint64_t fromAddr1, uint64_t toAddr1, uint32_t repetitions) {
+    mixBlocks(state0, mem, blocklen, fromAddr0, toAddr0, repetitions);
+    mixBlocks(state1, mem, blocklen, fromAddr1, toAddr1, repetitions);
+}
+
+// Make the engines use mixBlocks, or their own kernels if mix is false.
+static void useMixBlocks(bool mix) {
+    testHashBlocks = mix? mixBlocks : NULL;
+    testHashBlocks2 = mix? mixBlocks2 : NULL;
+}
+
+// Return the contents of a file, which the caller frees, and remove the file.
+static uint8_t *readFile(const char *fileName, uint64_t *size) {
+    FILE *file = fopen(fileName, "rb");
+    uint8_t *data = NULL;
+    if(file != NULL && fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        data = length >= 0? malloc(length + 1) : NULL;
+        if(data != NULL && (fseek(file, 0, SEEK_SET) != 0 || fread(data, 1, length, file) != (size_t)length)) {
+            free(data);
+            data = NULL;
+        }
+        *size = length;
+    }
+    if(file != NULL) {
+        fclose(file);
+    }
+    if(data == NULL) {
+        fprintf(stderr, "Unable to read %s\n", fileName);
+        exit(1);
+    }
+    remove(fileName);
+    return data;
+}
+
+// Exit with message unless the file holds size bytes of data, and remove it.
+static void compareFile(const uint8_t *data, uint64_t size, const char *fileName, const char *message) {
+    uint64_t fileSize;
+    uint8_t *fileData = readFile(fileName, &fileSize);
+    if(fileSize != size || memcmp(fileData, data, size)) {
+        fprintf(stderr, "%s\n", message);
+        exit(1);
+    }
+    free(fileData);
+}
+
+// Exit with message unless the two files are the same, and remove them.
+static void compareFiles(const char *fileName1, const char *fileName2, const char *message) {
+    uint64_t size;
+    uint8_t *data = readFile(fileName1, &size);
+    compareFile(data, size, fileName2, message);
+    free(data);
+}
+
+// Check that the SSE and portable engines write the same graph and compute the same hash, both with their own
+// kernels and with mixBlocks, whose hashes depend on the memory the engines addressed.
+void verifyEngines(void) {
+    struct {
+        uint32_t memSize, multipliesPerBlock;
+        uint8_t startGarlic, stopGarlic;
+        uint32_t blockSize, parallelism, repetitions;
+    } params[] = {
+        {64, 16, 0, 1, 64, 3, 1},
+        {300, 100, 0, 1, 100, 5, 2},
+        {1024, 1024, 1, 2, 1024, 2, 1},
+        {512, 64, 0, 0, 4096, 1, 3},
+    };
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    uint32_t i, mix;
+    for(mix = 0; mix < 2; mix++) {
+        useMixBlocks(mix);
+        for(i = 0; i < sizeof(params)/sizeof(params[0]); i++) {
+            uint8_t hash1[32], hash2[32];
+            uint32_t j;
+            for(j = 0; j < 32; j++) {
+                hash1[j] = hash2[j] = j*13 + i;
+            }
+            options.graphFile = "tigerkdf-test-sse.graph";
+            bool passed = TigerKDF(hash1, 32, params[i].memSize, params[i].multipliesPerBlock,
+                params[i].startGarlic, params[i].stopGarlic, params[i].blockSize, params[i].parallelism,
+                params[i].repetitions, false, &options);
+            options.graphFile = "tigerkdf-test-ref.graph";
+            passed = passed && TigerKDFRef(hash2, 32, params[i].memSize, params[i].multipliesPerBlock,
+                params[i].startGarlic, params[i].stopGarlic, params[i].blockSize, params[i].parallelism,
+                params[i].repetitions, false, &options);
+            if(!passed) {
+                fprintf(stderr, "Password hashing failed!\n");
+                exit(1);
+            }
+            if(memcmp(hash1, hash2, 32)) {
+                fprintf(stderr, "Portable engine got wrong answer!\n");
+                exit(1);
+            }
+            compareFiles("tigerkdf-test-sse.graph", "tigerkdf-test-ref.graph",
+                "Portable engine wrote a different graph!");
+        }
+    }
+    useMixBlocks(false);
+}
+
+// Check that the number of workers running the lanes does not change the graph or the hash, including more lanes
+// than workers, both with the engine's kernels and with mixBlocks.
+void verifyWorkers(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.graphFile = "tigerkdf-test-workers.graph";
+    uint8_t hash1[32], hash2[32];
+    uint32_t workers[] = {1, 3, 0};
+    uint32_t i, mix;
+    for(mix = 0; mix < 2; mix++) {
+        useMixBlocks(mix);
+        uint8_t *graph = NULL;
+        uint64_t graphSize = 0;
+        for(i = 0; i < sizeof(workers)/sizeof(uint32_t); i++) {
+            options.workers = workers[i];
+            if(!TigerKDF_HashPasswordExt(i == 0? hash1 : hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt",
+                    4, 4096, 1024, 1, NULL, 0, 1024, 64, 1, &options)) {
+                fprintf(stderr, "Password hashing failed!\n");
+                exit(1);
+            }
+            if(i == 0) {
+                graph = readFile(options.graphFile, &graphSize);
+                continue;
+            }
+            if(memcmp(hash1, hash2, 32)) {
+                fprintf(stderr, "Hashing with %u workers got wrong answer!\n", workers[i]);
+                exit(1);
+            }
+            compareFile(graph, graphSize, options.graphFile, "Hashing with more workers wrote a different graph!");
+        }
+        free(graph);
+    }
+    useMixBlocks(false);
+}
+
+// Check that hashing lanes in pairs, including an odd lane out, writes the same graph and gives the same hash as
+// one lane at a time, both with the engine's kernels and with mixBlocks and mixBlocks2.
+void verifyInterleave(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.graphFile = "tigerkdf-test-interleave.graph";
+    uint8_t hash1[32], hash2[32];
+    uint32_t interleave[] = {TIGERKDF_INTERLEAVE_OFF, TIGERKDF_INTERLEAVE_PAIRS, TIGERKDF_INTERLEAVE_AUTO};
+    uint32_t i, mix;
+    for(mix = 0; mix < 2; mix++) {
+        useMixBlocks(mix);
+        uint8_t *graph = NULL;
+        uint64_t graphSize = 0;
+        for(i = 0; i < sizeof(interleave)/sizeof(uint32_t); i++) {
+            options.interleave = interleave[i];
+            options.workers = 1;
+            if(!TigerKDF_HashPasswordExt(i == 0? hash1 : hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt",
+                    4, 1024, 256, 1, NULL, 0, 1024, 5, 1, &options)) {
+                fprintf(stderr, "Password hashing failed!\n");
+                exit(1);
+            }
+            if(i == 0) {
+                graph = readFile(options.graphFile, &graphSize);
+                continue;
+            }
+            if(memcmp(hash1, hash2, 32)) {
+                fprintf(stderr, "Hashing with interleave %u got wrong answer!\n", interleave[i]);
+                exit(1);
+            }
+            compareFile(graph, graphSize, options.graphFile, "Interleaving lanes wrote a different graph!");
+        }
+        free(graph);
+    }
+    useMixBlocks(false);
+}
+
+// Exit unless a graph file from a hash of parallelism lanes of numblocks 64 byte blocks per half lane, with garlic
+// 0 and 1, has the right header and follows the schedule: each password independent block hashes in the block
+// scheduleFrom gives, and each password dependent one a block before it in its own half, or any block of the
+// password independent half of lane (p + i) % parallelism.
+static void checkGraph(const uint8_t *data, uint64_t size, uint32_t parallelism, uint32_t numblocks,
+        const char *engine) {
+    TigerKDFGraphHeader header;
+    if(size < sizeof(TigerKDFGraphHeader)) {
+        fprintf(stderr, "Graph file from the %s engine is too short!\n", engine);
+        exit(1);
+    }
+    memcpy(&header, data, sizeof(TigerKDFGraphHeader));
+    if(memcmp(header.magic, TIGERKDF_GRAPH_MAGIC, sizeof(header.magic)) || header.format != TIGERKDF_GRAPH_FORMAT ||
+            header.parallelism != parallelism || header.blockSize != 64 || header.numblocks != numblocks ||
+            header.startGarlic != 0 || header.stopGarlic != 1) {
+        fprintf(stderr, "Bad graph file header from the %s engine!\n", engine);
+        exit(1);
+    }
+    // Levels have 2*parallelism*numblocks and then twice that many blocks.
+    uint64_t numEntries = 2*(uint64_t)parallelism*numblocks*3;
+    if(size != sizeof(TigerKDFGraphHeader) + numEntries*sizeof(uint64_t)) {
+        fprintf(stderr, "Graph file from the %s engine has %llu bytes!\n", engine, (unsigned long long)size);
+        exit(1);
+    }
+    const uint8_t *entries = data + sizeof(TigerKDFGraphHeader);
+    uint64_t levelStart = 0;
+    uint32_t n, p, phase, i;
+    for(n = numblocks; n <= 2*numblocks; n *= 2) {
+        for(p = 0; p < parallelism; p++) {
+            for(phase = 0; phase < 2; phase++) {
+                uint64_t start = (2*(uint64_t)p + phase)*n;
+                for(i = 0; i < n; i++) {
+                    uint64_t entry;
+                    memcpy(&entry, entries + (levelStart + start + i)*sizeof(uint64_t), sizeof(uint64_t));
+                    bool good;
+                    if(phase == 0) {
+                        good = entry == (i == 0? TIGERKDF_GRAPH_NO_BLOCK : start + scheduleFrom(i));
+                    } else {
+                        uint64_t other = 2*(uint64_t)n*((p + i) % parallelism);
+                        good = (entry >= start && entry < start + i) || (entry >= other && entry < other + n);
+                    }
+                    if(!good) {
+                        fprintf(stderr, "Bad graph file entry %llu from the %s engine!\n",
+                            (unsigned long long)(levelStart + start + i), engine);
+                        exit(1);
+                    }
+                }
+            }
+        }
+        levelStart += 2*(uint64_t)parallelism*n;
+    }
+}
+
+// Check that writing the graph file does not change the hash, that the SSE and portable engines write the same
+// graph, and that it follows the schedule.
+void verifyGraph(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    uint8_t hash1[32], hash2[32];
+    uint32_t numblocks = 64*1024/(2*3*64);
+    options.graphFile = "tigerkdf-test-graph.bin";
+    if(!TigerKDF_HashPassword(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0, 64,
+            3, 1) || !TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1,
+            NULL, 0, 64, 3, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(memcmp(hash1, hash2, 32)) {
+        fprintf(stderr, "Writing the graph changed the hash!\n");
+        exit(1);
+    }
+    uint64_t size;
+    uint8_t *graph = readFile(options.graphFile, &size);
+    checkGraph(graph, size, 3, numblocks, "SSE");
+    free(graph);
+    // The portable engine is only built into this program as TigerKDFRef, so run both engines directly.
+    memcpy(hash2, hash1, 32);
+    options.graphFile = "tigerkdf-test-graph.bin";
+    if(!TigerKDF(hash1, 32, 64, 16, 0, 1, 64, 3, 1, false, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    graph = readFile(options.graphFile, &size);
+    options.graphFile = "tigerkdf-test-graph-ref.bin";
+    if(!TigerKDFRef(hash2, 32, 64, 16, 0, 1, 64, 3, 1, false, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    checkGraph(graph, size, 3, numblocks, "SSE");
+    compareFile(graph, size, options.graphFile, "Portable engine wrote a different graph!");
+    free(graph);
+}
+
+// Counts progress reports, and cancels the hash at the first one if cancel is set.
+struct ProgressStruct {
+    uint32_t reports;
+    uint32_t phasesDone;
+    double lastFraction;
+    bool cancel;
+    int cancelled;
+};
+
+static void countProgress(void *arg, uint8_t garlic, uint32_t phase, double fraction) {
+    struct ProgressStruct *progress = (struct ProgressStruct *)arg;
+    (void)garlic;
+    (void)phase;
+    if(fraction < 0.0 || fraction > 1.0 || (fraction < progress->lastFraction && progress->lastFraction != 1.0)) {
+        fprintf(stderr, "Bad progress fraction %f!\n", fraction);
+        exit(1);
+    }
+    progress->reports++;
+    progress->phasesDone += fraction == 1.0;
+    progress->lastFraction = fraction;
+    if(progress->cancel) {
+        progress->cancelled = 1;
+    }
+}
+
+// Check that reporting progress does not change the hash, and that cancelling or passing the deadline fails it.
+void verifyControl(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    struct ProgressStruct progress;
+    memset(&progress, 0, sizeof(progress));
+    options.progress = countProgress;
+    options.progressArg = &progress;
+    uint8_t hash1[32], hash2[32];
+    if(!TigerKDF_HashPassword(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 1, NULL, 0,
+            1024, 2, 1) || !TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+            4096, 1024, 1, NULL, 0, 1024, 2, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    if(memcmp(hash1, hash2, 32) || progress.phasesDone != 4 || progress.reports <= 4) {
+        fprintf(stderr, "Progress reports changed the hash or were missing!\n");
+        exit(1);
+    }
+    memset(&progress, 0, sizeof(progress));
+    progress.cancel = true;
+    options.cancel = &progress.cancelled;
+    if(TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 1, NULL, 0,
+            1024, 2, 1, &options) || progress.phasesDone != 0) {
+        fprintf(stderr, "Cancelling did not stop the hash!\n");
+        exit(1);
+    }
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    options.deadline = 1e-9;
+    if(TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 1, NULL, 0,
+            1024, 2, 1, &options)) {
+        fprintf(stderr, "A hash past its deadline did not stop!\n");
+        exit(1);
+    }
+}
+
+// Check that the per-hash and process wide bandwidth caps slow the hash down without changing it.
+void verifyBandwidth(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    TigerKDFStats stats;
+    memset(&stats, 0, sizeof(TigerKDFStats));
+    stats.size = sizeof(TigerKDFStats);
+    options.stats = &stats;
+    uint8_t hash1[32], hash2[32];
+    if(!TigerKDF_HashPassword(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 0, NULL, 0,
+            1024, 2, 1)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    uint32_t i;
+    for(i = 0; i < 2; i++) {
+        if(i == 0) {
+            options.maxBandwidth = 0.25;
+        } else {
+            options.maxBandwidth = 0.0;
+            TigerKDF_SetProcessBandwidth(0.25);
+        }
+        if(!TigerKDF_HashPasswordExt(hash2, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 0,
+                NULL, 0, 1024, 2, 1, &options)) {
+            fprintf(stderr, "Password hashing failed!\n");
+            exit(1);
+        }
+        if(memcmp(hash1, hash2, 32) || stats.throttleSeconds[0] + stats.throttleSeconds[1] == 0.0) {
+            fprintf(stderr, "Bandwidth cap changed the hash or did not throttle it!\n");
+            exit(1);
+        }
+    }
+    TigerKDF_SetProcessBandwidth(0.0);
+}
+
+// Check that the cost estimate counts the same traffic as a real hash, and the multiplies and memory the
+// arithmetic of TigerKDF gives, and that it rejects invalid parameters.
+void verifyCost(void) {
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    TigerKDFStats stats;
+    memset(&stats, 0, sizeof(TigerKDFStats));
+    stats.size = sizeof(TigerKDFStats);
+    options.stats = &stats;
+    uint8_t hash[32];
+    if(!TigerKDF_HashPasswordExt(hash, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 4096, 1024, 1, NULL, 0,
+            1024, 3, 1, &options)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    TigerKDFCostModel model = {1, 1e9, 1e9, 1e6, 1e9, 0.001};
+    TigerKDFCost cost;
+    // 682 blocks per half lane at garlic 0, and 1364 at garlic 1.
+    if(!TigerKDF_EstimateCost(&cost, 32, 4096, 1024, 0, 1, 1024, 3, 1, &options, &model) ||
+            cost.trafficBytes != stats.phaseBytes[0] + stats.phaseBytes[1] + 2*3*1024 ||
+            cost.blake2sCalls != 3*(1363 + 2727) || cost.multiplies != (1363 + 2727)*1024ULL ||
+            cost.memBytes != TigerKDF_ArenaSize(4096, 1, 1024, 3) || cost.multHashBytes != 32*6*1364 ||
+            cost.peakBytes < cost.memBytes + cost.multHashBytes || cost.seconds <= model.fixedSeconds) {
+        fprintf(stderr, "Cost estimate does not match the hash!\n");
+        exit(1);
+    }
+    if(TigerKDF_EstimateCost(&cost, 32, 4096, 1024, 0, 1, 1024, 0, 1, NULL, NULL)) {
+        fprintf(stderr, "Cost estimate accepted invalid parameters!\n");
+        exit(1);
+    }
+}
+
+// Check that subkeys are the same each time, differ from each other and with their labels, and that a bad list is
+// rejected.
+void verifySubkeys(void) {
+    uint8_t encrypt[32], mac[48], verifier[16], again[32];
+    TigerKDFSubkey subkeys[] = {{"encrypt", encrypt, 32}, {"mac", mac, 48}, {"verifier", verifier, 16}};
+    if(!TigerKDF_DeriveSubkeys(subkeys, 3, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0, 64,
+            2, 1, NULL)) {
+        fprintf(stderr, "Subkey derivation failed!\n");
+        exit(1);
+    }
+    subkeys[0].key = again;
+    if(!TigerKDF_DeriveSubkeys(subkeys, 3, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0, 64,
+            2, 1, NULL) || memcmp(encrypt, again, 32) || !memcmp(encrypt, mac, 16) || !memcmp(mac, verifier, 16)) {
+        fprintf(stderr, "Subkeys are not repeatable or not independent!\n");
+        exit(1);
+    }
+    subkeys[0].label = "encryption";
+    if(!TigerKDF_DeriveSubkeys(subkeys, 3, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0, 64,
+            2, 1, NULL) || !memcmp(encrypt, again, 32)) {
+        fprintf(stderr, "Subkey label did not change the key!\n");
+        exit(1);
+    }
+    subkeys[1].keySize = 0;
+    if(TigerKDF_DeriveSubkeys(subkeys, 3, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64, 16, 1, NULL, 0, 64,
+            2, 1, NULL)) {
+        fprintf(stderr, "Empty subkey was accepted!\n");
+        exit(1);
+    }
+}
+
+// Remember a job the pool is done with, in the slot arg points to.
+static void keepDoneJob(void *arg, TigerKDFJob *job) {
+    *(TigerKDFJob **)arg = job;
+}
+
+// Check that jobs run a few blocks at a time, alone and in a pool, give the same hashes as hashing in one go, and
+// that a job writes the same graph.
+void verifyJobs(void) {
+    struct {
+        uint32_t memSize, multipliesPerBlock;
+        uint8_t garlic;
+        uint32_t blockSize, parallelism, version;
+    } params[] = {
+        {64, 16, 1, 64, 3, TIGERKDF_VERSION_ORIGINAL},
+        {256, 100, 2, 100, 2, TIGERKDF_VERSION_TREE_KEY},
+        {1024, 1024, 0, 1024, 1, TIGERKDF_VERSION_BLAKE2B},
+    };
+    uint32_t numParams = sizeof(params)/sizeof(params[0]);
+    TigerKDFOptions options;
+    memset(&options, 0, sizeof(TigerKDFOptions));
+    options.size = sizeof(TigerKDFOptions);
+    uint8_t hashes[3][32];
+    uint8_t hash[32];
+    TigerKDFJob *jobs[3];
+    uint32_t i, mix;
+    // First with mixBlocks, whose hash also shows that the job hashed the blocks its graph says, and then with the
+    // engine's kernels, whose hashes the pooled jobs below are checked against.
+    for(mix = 0; mix < 2; mix++) {
+        useMixBlocks(mix == 0);
+        for(i = 0; i < numParams; i++) {
+            options.version = params[i].version;
+            options.graphFile = "tigerkdf-test-job.graph";
+            TigerKDFJob *job = TigerKDF_CreateJob(32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+                params[i].memSize, params[i].multipliesPerBlock, params[i].garlic, (uint8_t *)"data", 4,
+                params[i].blockSize, params[i].parallelism, 1, &options);
+            options.graphFile = "tigerkdf-test-hash.graph";
+            if(job == NULL || !TigerKDF_HashPasswordExt(hashes[i], 32, (uint8_t *)"password", 8,
+                    (uint8_t *)"salt", 4, params[i].memSize, params[i].multipliesPerBlock, params[i].garlic,
+                    (uint8_t *)"data", 4, params[i].blockSize, params[i].parallelism, 1, &options)) {
+                fprintf(stderr, "Password hashing failed!\n");
+                exit(1);
+            }
+            while(!TigerKDF_RunJob(job, 7));
+            if(!TigerKDF_FinishJob(job, hash) || memcmp(hash, hashes[i], 32)) {
+                fprintf(stderr, "Sliced job got wrong answer!\n");
+                exit(1);
+            }
+            compareFiles("tigerkdf-test-job.graph", "tigerkdf-test-hash.graph",
+                "Sliced job wrote a different graph!");
+        }
+    }
+    options.graphFile = NULL;
+    TigerKDFPool *pool = TigerKDF_CreatePool(2, 1024, 0);
+    if(pool == NULL) {
+        fprintf(stderr, "Unable to create pool!\n");
+        exit(1);
+    }
+    for(i = 0; i < numParams; i++) {
+        options.version = params[i].version;
+        TigerKDFJob *job = TigerKDF_CreateJob(32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4,
+            params[i].memSize, params[i].multipliesPerBlock, params[i].garlic, (uint8_t *)"data", 4,
+            params[i].blockSize, params[i].parallelism, 1, &options);
+        if(job == NULL) {
+            fprintf(stderr, "Password hashing failed!\n");
+            exit(1);
+        }
+        jobs[i] = NULL;
+        TigerKDF_SubmitJob(pool, job, i == 1? 1.0 : 0.0, keepDoneJob, jobs + i);
+    }
+    TigerKDF_DestroyPool(pool);
+    for(i = 0; i < numParams; i++) {
+        if(jobs[i] == NULL || !TigerKDF_FinishJob(jobs[i], hash) || memcmp(hash, hashes[i], 32)) {
+            fprintf(stderr, "Pooled job got wrong answer!\n");
+            exit(1);
+        }
+    }
+}
+
 /*******************************************************************/
 
+// A job the pool is done with, and how many jobs it was done with before it.
+struct DoneJobStruct {
+    TigerKDFJob *job;
+    uint32_t order;
+    atomic_uint *doneJobs;
+};
+
+static void orderDoneJob(void *arg, TigerKDFJob *job) {
+    struct DoneJobStruct *done = (struct DoneJobStruct *)arg;
+    done->job = job;
+    done->order = atomic_fetch_add(done->doneJobs, 1);
+}
+
+// Check that a pool does not start a job while the ones it started would then hold more than its memory limit:
+// a small job queued behind a large one finishes first without a limit, and second with one that only the large
+// job fits in.
+void verifyPoolLimit(void) {
+    uint32_t memSizes[2] = {16384, 64};
+    uint8_t hashes[2][32];
+    uint32_t i, limited;
+    for(i = 0; i < 2; i++) {
+        if(!TigerKDF_HashPassword(hashes[i], 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memSizes[i], 16,
+                0, NULL, 0, 1024, 1, 1)) {
+            fprintf(stderr, "Password hashing failed!\n");
+            exit(1);
+        }
+    }
+    for(limited = 0; limited < 2; limited++) {
+        uint64_t maxBytes = limited? TigerKDF_ArenaSize(memSizes[0], 0, 1024, 1) : 0;
+        TigerKDFPool *pool = TigerKDF_CreatePool(2, 1024, maxBytes);
+        if(pool == NULL) {
+            fprintf(stderr, "Unable to create pool!\n");
+            exit(1);
+        }
+        atomic_uint doneJobs;
+        atomic_init(&doneJobs, 0);
+        struct DoneJobStruct done[2];
+        for(i = 0; i < 2; i++) {
+            TigerKDFJob *job = TigerKDF_CreateJob(32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, memSizes[i],
+                16, 0, NULL, 0, 1024, 1, 1, NULL);
+            if(job == NULL) {
+                fprintf(stderr, "Password hashing failed!\n");
+                exit(1);
+            }
+            done[i].job = NULL;
+            done[i].doneJobs = &doneJobs;
+            TigerKDF_SubmitJob(pool, job, 0.0, orderDoneJob, done + i);
+        }
+        TigerKDF_DestroyPool(pool);
+        uint8_t hash[32];
+        for(i = 0; i < 2; i++) {
+            if(done[i].job == NULL || !TigerKDF_FinishJob(done[i].job, hash) || memcmp(hash, hashes[i], 32)) {
+                fprintf(stderr, "Pooled job got wrong answer!\n");
+                exit(1);
+            }
+        }
+        if(done[0].order != (limited? 0 : 1)) {
+            fprintf(stderr, limited? "Pool went over its memory limit!\n" : "Pooled jobs did not take turns!\n");
+            exit(1);
+        }
+    }
+}
+
+// Check that lane keys far larger than a thread's stack are derived in place, by the engine and by a job.
+void verifyLargeBlock(void) {
+    uint32_t blockSize = 16 << 20;
+    uint8_t hash1[32], hash2[32];
+    if(!TigerKDF_HashPassword(hash1, 32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64 << 10, 16, 0, NULL,
+            0, blockSize, 1, 1)) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    TigerKDFJob *job = TigerKDF_CreateJob(32, (uint8_t *)"password", 8, (uint8_t *)"salt", 4, 64 << 10, 16, 0,
+        NULL, 0, blockSize, 1, 1, NULL);
+    if(job == NULL) {
+        fprintf(stderr, "Password hashing failed!\n");
+        exit(1);
+    }
+    while(!TigerKDF_RunJob(job, 64));
+    if(!TigerKDF_FinishJob(job, hash2) || memcmp(hash1, hash2, 32)) {
+        fprintf(stderr, "Job with a large block got wrong answer!\n");
+        exit(1);
+    }
+}
+
 int main()
 {
     printf("****************************************** Basic tests\n");
 
     verifyGarlic();
     verifyClientServer();
+    verifyTreeKeyExpansion();
+    verifyTreeKey();
+    verifyOptionsSize();
+    verifyBlake2sMulti();
+    verifyPbkdf2();
+    verifyBlake2b();
+    verifyEngines();
+    verifyWorkers();
+    verifyInterleave();
+    verifyGraph();
+    verifyControl();
+    verifyBandwidth();
+    verifyCost();
+    verifyJobs();
+    verifyPoolLimit();
+    verifyLargeBlock();
+    verifySubkeys();
 
-    simpletest("password", "salt", "", 1);
     simpletest("password", "salt", "", 1024);
-    simpletest("password", "salt", "data", 1024);
+    simpletest("password", "salt", "", 1024*1024);
+    simpletest("password", "salt", "data", 1024*1024);
     simpletest("passwordPASSWORDpassword",
-                         "saltSALTsaltSALTsaltSALTsaltSALTsalt","", 1);
+                         "saltSALTsaltSALTsaltSALTsaltSALTsalt","", 1024);
 
     PHC_test();
 
@@ -170,9 +1270,9 @@ int main()
     test_output(128, (uint8_t *)"password", strlen("password"), (uint8_t *)"salt",
         strlen("salt"), NULL, 0, 1024*1024, 4096, 0, 16384, 2, 1);
     test_output(64, (uint8_t *)"password", strlen("password"), (uint8_t *)"salt",
-        strlen("salt"), NULL, 0, 10*1024, 4096, 0, 64, 1, 64);
+        strlen("salt"), NULL, 0, 10*1024, 64, 0, 64, 1, 64);
     test_output(64, (uint8_t *)"password", strlen("password"), (uint8_t *)"salt",
-        strlen("salt"), NULL, 0, 10*1024, 4096, 4, 128, 1, 1);
+        strlen("salt"), NULL, 0, 10*1024, 128, 4, 128, 1, 1);
 
     return 0;
 }
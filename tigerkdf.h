@@ -1,31 +1,317 @@
+#ifndef TIGERKDF_H
+#define TIGERKDF_H
+
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+// Marks the functions libtigerkdf exports.  The library is built with -fvisibility=hidden, so nothing else in it
+// is visible to programs linking the shared library.
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define TIGERKDF_API __attribute__((visibility("default")))
+#else
+#define TIGERKDF_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Algorithm variants, or'ed together in TigerKDFOptions.version.  Store the version alongside the hash.  The
+// functions that take no options compute TIGERKDF_VERSION_ORIGINAL.
+#define TIGERKDF_VERSION_ORIGINAL 0
+// Expand each lane's first block with BLAKE2Xs, whose 32-byte output blocks are independent, rather than
+// with PBKDF2 over the whole block.  hashBlocks clears every word it writes (see tigerkdf-ref.c), so no lane's
+// first block reaches the output, and this gives the same hashes as the version without it.
+#define TIGERKDF_VERSION_TREE_KEY 0x1
+// Use PBKDF2 over HMAC-BLAKE2b, with 64-byte output blocks, for H, the thread keys and the rehash after each
+// garlic level.  BLAKE2b is faster per byte on 64-bit CPUs.  With TIGERKDF_VERSION_TREE_KEY, lane keys still use
+// BLAKE2Xs.
+#define TIGERKDF_VERSION_BLAKE2B 0x2
+
+// Counts of values by size.  Bucket 0 counts zeros, and bucket b > 0 counts values from 2^(b-1) up to 2^b - 1.
+// The last bucket also counts anything larger.
+#define TIGERKDF_HISTOGRAM_BUCKETS 40
+typedef struct TigerKDFHistogramStruct {
+    uint64_t counts[TIGERKDF_HISTOGRAM_BUCKETS];
+} TigerKDFHistogram;
+
+// Where the time of a hash went, filled in when TigerKDFOptions.stats is set.  Phase 0 is the password
+// independent fill, and phase 1 the password dependent one.  Times are wall-clock seconds, summed over garlic
+// levels.
+typedef struct TigerKDFStatsStruct {
+    uint32_t size; // sizeof(TigerKDFStats), set by the caller, so the library writes only what the caller has
+    double totalSeconds; // The whole memory-hard part, including starting threads and rehashing
+    double phaseSeconds[2];
+    uint64_t phaseBytes[2]; // Bytes of memory read and written by each phase
+    // Seconds lanes slept to stay under the bandwidth caps, summed over lanes, so divide by the number of workers
+    // for the latency the caps added.
+    double throttleSeconds[2];
+    // Bytes of the largest cached address schedule the password independent phase used, or 0 if the addresses
+    // were computed on the fly.  Schedules are shared with other hashes that use the same parameters.
+    uint64_t scheduleBytes;
+    // Page faults from getrusage, and how much the resident set grew from the start of the hash to the end of its
+    // last level, before it frees its memory.  These are process-wide, so they include any other thread
+    // touching memory at the same time.
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t rssBytes;
+    // Bytes of the mapping holding the hashed memory that transparent huge pages backed at the end of the hash,
+    // from /proc/self/smaps, at most the size of the memory.  Zero where smaps is not available.
+    uint64_t hugePageBytes;
+    // Nanoseconds each block of each phase waited for the multiply thread, over all lanes.  Zero means it did not
+    // wait at all.
+    TigerKDFHistogram waits[2];
+    // How many blocks the multiply thread was ahead of the slowest running lane, each time it finished a block.
+    TigerKDFHistogram multLead;
+    // Set these to get each lane's waits too: if numLaneWaits is at least 2*parallelism, laneWaits[phase*parallelism
+    // + p] is filled in for lane p.  They are kept when the rest of the struct is cleared for a new hash.
+    TigerKDFHistogram *laneWaits;
+    uint32_t numLaneWaits;
+} TigerKDFStats;
+
+// Called as a hash progresses with the fraction done, from 0 to 1, of one phase of one garlic level.
+typedef void (*TigerKDFProgressFunc)(void *arg, uint8_t garlic, uint32_t phase, double fraction);
+
+// Optional settings for the *Ext functions.  Start from TIGERKDF_OPTIONS_INIT, or zero the struct and set size,
+// and then set the fields you need.  Fields are only ever added at the end, and the library reads only the size
+// bytes the caller has, so fields added after a program was built keep their defaults.  Calls fail if size is
+// smaller than this first released version of the struct, or if the caller is newer and sets fields the library
+// does not know.  The same goes for TigerKDFStats, which the library writes only size bytes of.
+typedef struct TigerKDFOptionsStruct {
+    uint32_t size; // sizeof(TigerKDFOptions)
+    uint32_t version; // An or of TIGERKDF_VERSION_* flags
+    // Memory to hash in rather than allocating it, so that a caller hashing many passwords faults its pages in
+    // only once.  It must be aligned to 32 bytes.  If it is smaller than TigerKDF_ArenaSize says, the hash
+    // allocates its own memory as usual.  The arena is left holding data derived from the password, so clear it
+    // before freeing it.  One arena must not be used by two hashes at once.
+    void *arena;
+    uint64_t arenaSize;
+    TigerKDFStats *stats; // If not NULL, filled in with where the time of the hash went
+    // Threads that run the parallelism lanes, as tasks they take from each other when they run out.  Zero means
+    // one per online CPU.  It is never more than parallelism, and the hash is the same for any value.
+    uint32_t workers;
+    // If not NULL, the hash also writes the block dependency graph it followed to this file, in the format below.
+    // The hash fails if the file cannot be written.
+    const char *graphFile;
+    // If not NULL, called on the calling thread about every 1% of each phase, and with 1.0 when the phase is done.
+    TigerKDFProgressFunc progress;
+    void *progressArg;
+    // The hash stops if *cancel becomes non-zero, or once the deadline is passed, if it is not zero.  The deadline
+    // is in seconds of clock_gettime(CLOCK_MONOTONIC).  Lanes check every 64 KiB or so that they hash, and the hash
+    // then frees its memory and threads and fails, leaving the hash output undefined.
+    const volatile int *cancel;
+    double deadline;
+    // If not zero, lanes sleep as needed to keep the memory this hash reads and writes, counted as in
+    // TigerKDFStats.phaseBytes, under this many GiB/s.  They pace themselves every 64 KiB or so that they hash.
+    double maxBandwidth;
+    // How each worker hashes its lanes, one of TIGERKDF_INTERLEAVE_*.  The hash is the same for any value.
+    uint32_t interleave;
+} TigerKDFOptions;
+
+// Initializers for a zeroed TigerKDFOptions or TigerKDFStats with its size set.
+#define TIGERKDF_OPTIONS_INIT {.size = sizeof(TigerKDFOptions)}
+#define TIGERKDF_STATS_INIT {.size = sizeof(TigerKDFStats)}
+
+// Let the engine choose.  hashBlocks already runs two independent chains per lane, and in tigerkdf-bench
+// interleave two lanes were no faster, so for now this hashes one lane at a time.
+#define TIGERKDF_INTERLEAVE_AUTO 0
+// Hash one lane at a time.
+#define TIGERKDF_INTERLEAVE_OFF 1
+// Hash two lanes in lockstep whenever there are two lanes, even if that leaves workers idle.
+#define TIGERKDF_INTERLEAVE_PAIRS 2
+
+// The graph file is this header, followed by one uint64_t in native byte order for each block of memory of each
+// garlic level from startGarlic to stopGarlic.  Level g has 2*parallelism*(numblocks << (g - startGarlic))
+// blocks, numbered as they lie in memory: lane p's password independent half is blocks 2*p*n to 2*p*n + n - 1
+// for n blocks per half lane, and its password dependent half follows it.  Entry b is the block that was hashed
+// with block b - 1 into block b, or TIGERKDF_GRAPH_NO_BLOCK for the first block of each lane, which is the lane's
+// key.  Entries have a fixed place in the file, so it can be mapped and read from any point.
+#define TIGERKDF_GRAPH_MAGIC "TKDFGRPH"
+#define TIGERKDF_GRAPH_FORMAT 1
+#define TIGERKDF_GRAPH_NO_BLOCK UINT64_MAX
+typedef struct TigerKDFGraphHeaderStruct {
+    char magic[8]; // TIGERKDF_GRAPH_MAGIC, without its terminating zero
+    uint32_t format; // TIGERKDF_GRAPH_FORMAT
+    uint32_t parallelism;
+    uint32_t blockSize; // In bytes
+    uint32_t numblocks; // Blocks per half lane at startGarlic
+    uint8_t startGarlic;
+    uint8_t stopGarlic;
+    uint8_t reserved[6];
+} TigerKDFGraphHeader;
+
+// Cap the memory bandwidth of all hashes in the process together at gibPerSecond GiB/s, on top of any per-hash
+// TigerKDFOptions.maxBandwidth, or remove the cap if it is zero.  Only hashes started while a cap is set pace
+// themselves against it.
+TIGERKDF_API void TigerKDF_SetProcessBandwidth(double gibPerSecond);
+
+// The bytes of memory a hash with these parameters uses, which is the smallest useful TigerKDFOptions.arenaSize.
+// MemSize is in KiB.
+TIGERKDF_API uint64_t TigerKDF_ArenaSize(uint32_t memSize, uint8_t garlic, uint32_t blockSize,
+    uint32_t parallelism);
+
+// How fast this host runs the parts of a hash, as tigerkdf-bench calibrate measures them.  Bandwidths count
+// bytes as TigerKDFStats.phaseBytes does.
+typedef struct TigerKDFCostModelStruct {
+    uint32_t cpus; // Online CPUs when the model was calibrated
+    double laneBytesPerSecond; // What one lane hashes alone, not counting its BLAKE2s calls
+    double memoryBytesPerSecond; // What all lanes together can hash at most
+    double blake2sPerSecond; // Calls hashing the 32-byte state after each block, on one CPU
+    double multipliesPerSecond; // Multiplies of the multiply thread
+    double fixedSeconds; // Time each hash takes besides its blocks and multiplies: H, lane keys, threads
+} TigerKDFCostModel;
+
+// What a hash will cost, from TigerKDF_EstimateCost.
+typedef struct TigerKDFCostStruct {
+    uint64_t peakBytes; // The sum of the next four
+    uint64_t memBytes; // The memory hashed, TigerKDF_ArenaSize, whether allocated or an arena
+    uint64_t multHashBytes; // The multiply thread's output, one state per block of the last level
+    uint64_t scheduleBytes; // The largest cached address schedule, shared by hashes with the same parameters
+    // The default stack size of each thread the hash starts.  This is reserved rather than touched, so it adds
+    // to virtual rather than resident memory.
+    uint64_t stackBytes;
+    uint64_t trafficBytes; // Bytes read and written: TigerKDFStats.phaseBytes, plus writing each lane's key
+    uint64_t blake2sCalls; // Of the state, one per hashed block.  BLAKE2s calls inside H are not counted.
+    uint64_t multiplies;
+    double seconds; // Predicted wall-clock time, or 0 without a model
+} TigerKDFCost;
+
+// Fill in cost for hashing from startGarlic to stopGarlic, which are 0 and garlic for TigerKDF_HashPassword and
+// oldGarlic + 1 and newGarlic for TigerKDF_UpdatePasswordHash, without hashing.  MemSize is in KiB.  Options,
+// which may be NULL, gives the number of workers, and model, which may be NULL, the speed of this host.  Returns
+// false if the parameters are not valid.
+TIGERKDF_API bool TigerKDF_EstimateCost(TigerKDFCost *cost, uint32_t hashSize, uint32_t memSize,
+    uint32_t multipliesPerBlock, uint8_t startGarlic, uint8_t stopGarlic, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions, const TigerKDFOptions *options, const TigerKDFCostModel *model);
+
+// Read or write a cost model as lines of a field name and its value.  Lines starting with # are comments.
+TIGERKDF_API bool TigerKDF_ReadCostModel(TigerKDFCostModel *model, const char *fileName);
+TIGERKDF_API bool TigerKDF_WriteCostModel(const TigerKDFCostModel *model, const char *fileName);
 
 // PBKDF2 based hash function.  Uses PBKDF2-SHA256 by default.
-void H(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize, uint8_t *salt, uint32_t saltSize);
+TIGERKDF_API void TigerKDF_H(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize,
+    uint8_t *salt, uint32_t saltSize);
 
 // This is the prototype required for the password hashing competition.
 // t_cost is an integer multiplier on CPU work.  m_cost is an integer number of MiB of memory to hash.
-int PHS(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen,
+TIGERKDF_API int PHS(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen,
     unsigned int t_cost, unsigned int m_cost);
 
 // A simple password hashing interface.  MemSize is in MiB.
-bool TigerKDF_SimpleHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint32_t passwordSize,
-    uint8_t *salt, uint32_t saltSize, uint32_t memSize);
+TIGERKDF_API bool TigerKDF_SimpleHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password,
+    uint32_t passwordSize, uint8_t *salt, uint32_t saltSize, uint32_t memSize);
 
 // The full password hashing interface.  MemSize is in MiB.
-bool TigerKDF_HashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
-    uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic,
-    uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions);
+TIGERKDF_API bool TigerKDF_HashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
+    uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic, uint8_t *data,
+    uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions);
+
+// The full password hashing interface with options, which may be NULL.  MemSize is in MiB.
+TIGERKDF_API bool TigerKDF_HashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t *password,
+    uint8_t passwordSize, uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock,
+    uint8_t garlic, uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions, const TigerKDFOptions *options);
+
+// One key for TigerKDF_DeriveSubkeys to derive: keySize bytes written to key, for the label, a NUL-terminated
+// string naming what the key is for.
+typedef struct TigerKDFSubkeyStruct {
+    const char *label;
+    uint8_t *key;
+    uint32_t keySize;
+} TigerKDFSubkey;
+
+// Derive several independent keys, such as an encryption key, a MAC key and a verifier, from one memory-hard hash
+// of the password, which costs the same as TigerKDF_HashPasswordExt with a 32-byte hash.  One PBKDF2 call over
+// that hash then expands it into all of the keys, with every label and key size in its salt, so each key
+// depends on the whole list: derive the same list, in the same order, to get the same keys.  MemSize is in KiB.
+// Returns false if the parameters are not valid.
+TIGERKDF_API bool TigerKDF_DeriveSubkeys(TigerKDFSubkey *subkeys, uint32_t numSubkeys, uint8_t *password,
+    uint8_t passwordSize, uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock,
+    uint8_t garlic, uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions, const TigerKDFOptions *options);
+
+// A password hash computed a slice at a time, so that one large hash does not hold up small ones behind it.  A
+// job hashes its lanes one after another on whatever thread runs it, and keeps its place, lane state and
+// multiply chain between slices, so it gives the same hash as TigerKDF_HashPasswordExt.  Of the options, only
+// version, arena and graphFile are used, and an arena must stay untouched until the job is freed.
+//
+// Since one thread runs every lane, and the multiply chain too rather than beside the lanes, a job takes about
+// parallelism times as long as TigerKDF_HashPasswordExt with a worker per lane, plus the multiplies.  Jobs suit
+// many small hashes sharing a pool; a large hash with parallelism above 1 is faster on its own.
+typedef struct TigerKDFJobStruct TigerKDFJob;
+
+// Called by a pool worker when a job is done, after which the pool no longer touches it.
+typedef void (*TigerKDFJobDoneFunc)(void *arg, TigerKDFJob *job);
+
+// Create a job for the hash TigerKDF_HashPasswordExt would compute, or return NULL if the parameters are not
+// valid, memory is short, or the graph file options asks for cannot be created.  This computes H, but the job
+// allocates the memory it hashes in its first slice.
+TIGERKDF_API TigerKDFJob *TigerKDF_CreateJob(uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
+    uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic, uint8_t *data,
+    uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions,
+    const TigerKDFOptions *options);
+
+// Hash up to blocks more blocks of the job, counting each lane's key as a block.  Returns true once the job is
+// done, whether it passed or failed, and false while it has blocks left.
+TIGERKDF_API bool TigerKDF_RunJob(TigerKDFJob *job, uint64_t blocks);
+
+// Copy the hash of a done job into hash, which has the job's hashSize bytes, and free the job.  Returns false
+// if the job failed or is not done, in which case it is still freed.
+TIGERKDF_API bool TigerKDF_FinishJob(TigerKDFJob *job, uint8_t *hash);
+
+// Worker threads that run submitted jobs a slice at a time.  After each slice a job goes back in the queue, and
+// workers take the job with the earliest deadline next, then jobs without one, oldest slice first.  A job holds
+// its memory from its first slice until it is done, so the pool only starts jobs while the memory of the started
+// ones, as TigerKDF_ArenaSize counts it, is within a limit.  Jobs are started in queue order, and only started
+// jobs take turns; the rest wait in the queue until enough started jobs are done.
+typedef struct TigerKDFPoolStruct TigerKDFPool;
+
+// Start workers threads, zero meaning one per online CPU, that run jobs sliceBytes of memory at a time, and that
+// start jobs while the memory of the started ones is at most maxBytes.  A job larger than maxBytes runs once no
+// other job is started.  Zero maxBytes means no limit.  Returns NULL if no thread could be started.
+TIGERKDF_API TigerKDFPool *TigerKDF_CreatePool(uint32_t workers, uint64_t sliceBytes, uint64_t maxBytes);
+
+// Queue a job, with a deadline in seconds of clock_gettime(CLOCK_MONOTONIC), or 0 for none.  The pool calls
+// done(arg, job) when the job is done.  The deadline only orders jobs: a late job still runs to the end.
+TIGERKDF_API void TigerKDF_SubmitJob(TigerKDFPool *pool, TigerKDFJob *job, double deadline,
+    TigerKDFJobDoneFunc done, void *arg);
+
+// Wait for every submitted job to be done, and then stop the workers and free the pool.
+TIGERKDF_API void TigerKDF_DestroyPool(TigerKDFPool *pool);
 
 // Update an existing password hash to a more difficult level of garlic.
-bool TigerKDF_UpdatePasswordHash(uint8_t *hash, uint32_t hashSize, uint32_t memSize, uint32_t multipliesPerBlock,
-        uint8_t oldGarlic, uint8_t newGarlic, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions);
+TIGERKDF_API bool TigerKDF_UpdatePasswordHash(uint8_t *hash, uint32_t hashSize, uint32_t memSize,
+    uint32_t multipliesPerBlock, uint8_t oldGarlic, uint8_t newGarlic, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions);
+
+// Update an existing password hash with options, which must select the version the hash was made with.
+TIGERKDF_API bool TigerKDF_UpdatePasswordHashExt(uint8_t *hash, uint32_t hashSize, uint32_t memSize,
+    uint32_t multipliesPerBlock, uint8_t oldGarlic, uint8_t newGarlic, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions, const TigerKDFOptions *options);
 
 // Client-side portion of work for server-relief mode.
-bool TigerKDF_ClientHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password, uint8_t passwordSize,
-    uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock, uint8_t garlic, uint8_t *data,
-    uint32_t dataSize, uint32_t blockSize, uint32_t parallelism, uint32_t repetitions);
+TIGERKDF_API bool TigerKDF_ClientHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t *password,
+    uint8_t passwordSize, uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock,
+    uint8_t garlic, uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions);
+
+// Client-side portion of work for server-relief mode, with options.
+TIGERKDF_API bool TigerKDF_ClientHashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t *password,
+    uint8_t passwordSize, uint8_t *salt, uint32_t saltSize, uint32_t memSize, uint32_t multipliesPerBlock,
+    uint8_t garlic, uint8_t *data, uint32_t dataSize, uint32_t blockSize, uint32_t parallelism,
+    uint32_t repetitions, const TigerKDFOptions *options);
 
 // Server portion of work for server-relief mode.
-void TigerKDF_ServerHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t garlic);
+TIGERKDF_API void TigerKDF_ServerHashPassword(uint8_t *hash, uint32_t hashSize, uint8_t garlic);
+
+// Server portion of work for server-relief mode, with the options the client used.  If options is not valid, hash
+// is cleared, so that it matches no stored hash.
+TIGERKDF_API void TigerKDF_ServerHashPasswordExt(uint8_t *hash, uint32_t hashSize, uint8_t garlic,
+    const TigerKDFOptions *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif